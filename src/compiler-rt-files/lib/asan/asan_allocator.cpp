@@ -229,8 +229,14 @@ struct QuarantineCallback {
 
   void *Allocate(uptr size) {
 #if FUZZALLOC_ASAN
-    void *res = get_allocator().Allocate(cache_, size, 1,
-                                         FUZZALLOC_ASAN_QUARANTINE_TAG);
+    // Shard the quarantine's bookkeeping allocations across the reserved
+    // quarantine tags so that recycling threads don't all contend on a
+    // single mspace
+    AsanThread *t = GetCurrentThread();
+    tag_t quarantine_tag =
+        FUZZALLOC_ASAN_QUARANTINE_TAG +
+        (t ? t->tid() % FUZZALLOC_ASAN_NUM_QUARANTINE_TAGS : 0);
+    void *res = get_allocator().Allocate(cache_, size, 1, quarantine_tag);
 #else
     void *res = get_allocator().Allocate(cache_, size, 1);
 #endif // FUZZALLOC_ASAN
@@ -317,6 +323,53 @@ struct Allocator {
   uptr max_user_defined_malloc_size;
   atomic_uint8_t rss_limit_exceeded;
 
+#if FUZZALLOC_ASAN
+  // ------------- Per-def-site adaptive quarantine accounting -------------
+  // The quarantine byte budget is shared by every def site, so a def site
+  // that frees constantly churns through the FIFO and evicts the entries of
+  // rarely-freed sites. Charging high-churn sites a multiple of their real
+  // size shrinks their effective quarantine (their chunks recycle sooner)
+  // while rarely-freed sites keep a full-length use-after-free detection
+  // window. Indexed by the full tag mask because primary-allocator chunks
+  // can carry arbitrary upper address bits
+  static const u32 kQuarantineDecayThreshold = 1 << 16;
+  static const uptr kQuarantineMaxOvercharge = 15;
+
+  StaticSpinMutex quarantine_decay_mutex;
+  atomic_uint32_t quarantine_free_count[FUZZALLOC_TAG_MASK + 1];
+  atomic_uint32_t quarantine_free_total;
+
+  uptr QuarantineChargeSize(tag_t def_site_tag, uptr size) {
+    u32 total =
+        atomic_fetch_add(&quarantine_free_total, 1, memory_order_relaxed) + 1;
+    u32 tag_frees = atomic_fetch_add(&quarantine_free_count[def_site_tag], 1,
+                                     memory_order_relaxed) +
+                    1;
+
+    // Periodically halve every counter so the churn estimate tracks recent
+    // behaviour rather than the whole campaign. Racing updates only make the
+    // decay approximate
+    if (UNLIKELY(total >= kQuarantineDecayThreshold)) {
+      SpinMutexLock l(&quarantine_decay_mutex);
+      if (atomic_load(&quarantine_free_total, memory_order_relaxed) >=
+          kQuarantineDecayThreshold) {
+        for (uptr tag = 0; tag <= FUZZALLOC_TAG_MASK; tag++) {
+          u32 n =
+              atomic_load(&quarantine_free_count[tag], memory_order_relaxed);
+          if (n)
+            atomic_store(&quarantine_free_count[tag], n / 2,
+                         memory_order_relaxed);
+        }
+        atomic_store(&quarantine_free_total, total / 2, memory_order_relaxed);
+      }
+    }
+
+    // Overcharge proportionally to this def site's share of recent frees
+    uptr overcharge = ((uptr)tag_frees * kQuarantineMaxOvercharge) / total;
+    return size + size * overcharge;
+  }
+#endif // FUZZALLOC_ASAN
+
   // ------------------- Options --------------------------
   atomic_uint16_t min_redzone;
   atomic_uint16_t max_redzone;
@@ -675,16 +728,26 @@ struct Allocator {
     thread_stats.freed += m->UsedSize();
 
     // Push into quarantine.
+#if FUZZALLOC_ASAN
+    // Charge against the quarantine budget adaptively: high-churn def sites
+    // pay a multiple of their real size, rarely-freed ones pay face value
+    // (see QuarantineChargeSize)
+    uptr quarantine_charge = QuarantineChargeSize(
+        (tag_t)(reinterpret_cast<uptr>(ptr) >> FUZZALLOC_TAG_SHIFT),
+        m->UsedSize());
+#else
+    uptr quarantine_charge = m->UsedSize();
+#endif // FUZZALLOC_ASAN
     if (t) {
       AsanThreadLocalMallocStorage *ms = &t->malloc_storage();
       AllocatorCache *ac = GetAllocatorCache(ms);
       quarantine.Put(GetQuarantineCache(ms), QuarantineCallback(ac, stack), m,
-                     m->UsedSize());
+                     quarantine_charge);
     } else {
       SpinMutexLock l(&fallback_mutex);
       AllocatorCache *ac = &fallback_allocator_cache;
       quarantine.Put(&fallback_quarantine_cache, QuarantineCallback(ac, stack),
-                     m, m->UsedSize());
+                     m, quarantine_charge);
     }
   }
 
@@ -697,7 +697,9 @@ void InitializeAsanInterceptors() {
   ASAN_INTERCEPT_FUNC(vfork);
 #endif
 
-#if FUZZALLOC_ASAN
+#if FUZZALLOC_ASAN && !FUZZALLOC_ASAN_STATIC_MALLOC
+  // With static malloc dispatch the malloc family is defined directly (see
+  // asan_malloc_linux.cpp), so there are no interceptor trampolines to wire
   ASAN_INTERCEPT_FUNC(__tagged_malloc);
   ASAN_INTERCEPT_FUNC(free);
 #endif
@@ -35,6 +35,37 @@ using namespace __asan;
 typedef __fuzzalloc::tag_t TAG_T;
 #endif // FUZZALLOC_ASAN
 
+#if FUZZALLOC_ASAN_STATIC_MALLOC
+#if SANITIZER_ANDROID
+#error FUZZALLOC_ASAN_STATIC_MALLOC is not supported on Android
+#endif
+
+// Triage-replay build mode: the malloc family is defined directly rather
+// than through the interceptor trampoline/weak-alias machinery, and stack
+// capture is guarded by a constexpr instead of malloc_context_size - the
+// unwinder call is compiled out entirely, so the per-allocation prologue
+// reduces to a direct call into the fuzzalloc-backed allocator. Allocation
+// and free stacks come out empty, which is fine when the build only exists
+// to reproduce crashes (the crashing access itself still gets a stack)
+static constexpr bool kStaticMallocCapturesStacks = false;
+
+#undef GET_STACK_TRACE_MALLOC
+#undef GET_STACK_TRACE_FREE
+#define GET_STACK_TRACE_MALLOC                                                 \
+  BufferedStackTrace stack;                                                    \
+  if (kStaticMallocCapturesStacks)                                             \
+  stack.Unwind(GetMallocContextSize(), StackTrace::GetCurrentPc(),             \
+               GET_CURRENT_FRAME(), nullptr, 0, 0,                             \
+               common_flags()->fast_unwind_on_malloc)
+#define GET_STACK_TRACE_FREE GET_STACK_TRACE_MALLOC
+
+#define MALLOC_INTERCEPTOR(ret_type, func, ...)                                \
+  extern "C" SANITIZER_INTERFACE_ATTRIBUTE ret_type func(__VA_ARGS__)
+#else
+#define MALLOC_INTERCEPTOR(ret_type, func, ...)                                \
+  INTERCEPTOR(ret_type, func, __VA_ARGS__)
+#endif // FUZZALLOC_ASAN_STATIC_MALLOC
+
 static uptr allocated_for_dlsym;
 static uptr last_dlsym_alloc_size_in_words;
 static const uptr kDlsymAllocPoolSize = SANITIZER_RTEMS ? 4096 : 1024;
@@ -125,7 +156,7 @@ static void *ReallocFromLocalPool(void *ptr, uptr size) {
   return new_ptr;
 }
 
-INTERCEPTOR(void, free, void *ptr) {
+MALLOC_INTERCEPTOR(void, free, void *ptr) {
   if (UNLIKELY(IsInDlsymAllocPool(ptr))) {
     DeallocateFromLocalPool(ptr);
     return;
@@ -135,7 +166,7 @@ INTERCEPTOR(void, free, void *ptr) {
 }
 
 #if SANITIZER_INTERCEPT_CFREE
-INTERCEPTOR(void, cfree, void *ptr) {
+MALLOC_INTERCEPTOR(void, cfree, void *ptr) {
   if (UNLIKELY(IsInDlsymAllocPool(ptr)))
     return;
   GET_STACK_TRACE_FREE;
@@ -143,7 +174,7 @@ INTERCEPTOR(void, cfree, void *ptr) {
 }
 #endif // SANITIZER_INTERCEPT_CFREE
 
-INTERCEPTOR(void*, malloc, uptr size) {
+MALLOC_INTERCEPTOR(void*, malloc, uptr size) {
   if (UNLIKELY(UseLocalPool()))
     // Hack: dlsym calls malloc before REAL(malloc) is retrieved from dlsym.
     return AllocateFromLocalPool(size);
@@ -152,7 +183,7 @@ INTERCEPTOR(void*, malloc, uptr size) {
   return asan_malloc(size, &stack);
 }
 
-INTERCEPTOR(void*, calloc, uptr nmemb, uptr size) {
+MALLOC_INTERCEPTOR(void*, calloc, uptr nmemb, uptr size) {
   if (UNLIKELY(UseLocalPool()))
     // Hack: dlsym calls calloc before REAL(calloc) is retrieved from dlsym.
     return AllocateFromLocalPool(nmemb * size);
@@ -161,7 +192,7 @@ INTERCEPTOR(void*, calloc, uptr nmemb, uptr size) {
   return asan_calloc(nmemb, size, &stack);
 }
 
-INTERCEPTOR(void*, realloc, void *ptr, uptr size) {
+MALLOC_INTERCEPTOR(void*, realloc, void *ptr, uptr size) {
   if (UNLIKELY(IsInDlsymAllocPool(ptr)))
     return ReallocFromLocalPool(ptr, size);
   if (UNLIKELY(UseLocalPool()))
@@ -172,7 +203,7 @@ INTERCEPTOR(void*, realloc, void *ptr, uptr size) {
 }
 
 #if FUZZALLOC_ASAN
-INTERCEPTOR(void *, __tagged_malloc, TAG_T alloc_site_tag, SIZE_T size) {
+MALLOC_INTERCEPTOR(void *, __tagged_malloc, TAG_T alloc_site_tag, SIZE_T size) {
   if (UNLIKELY(UseLocalPool())) {
     // Hack: dlsym calls malloc before REAL(malloc) is retrieved from dlsym.
     //
@@ -185,7 +216,7 @@ INTERCEPTOR(void *, __tagged_malloc, TAG_T alloc_site_tag, SIZE_T size) {
   return asan___tagged_malloc(alloc_site_tag, size, &stack);
 }
 
-INTERCEPTOR(void *, __tagged_calloc, TAG_T alloc_site_tag, SIZE_T nmemb,
+MALLOC_INTERCEPTOR(void *, __tagged_calloc, TAG_T alloc_site_tag, SIZE_T nmemb,
             SIZE_T size) {
   if (UNLIKELY(UseLocalPool())) {
     // Hack: dlsym calls calloc before REAL(calloc) is retrieved from dlsym.
@@ -199,7 +230,7 @@ INTERCEPTOR(void *, __tagged_calloc, TAG_T alloc_site_tag, SIZE_T nmemb,
   return asan___tagged_calloc(alloc_site_tag, nmemb, size, &stack);
 }
 
-INTERCEPTOR(void *, __tagged_realloc, TAG_T alloc_site_tag, void *ptr,
+MALLOC_INTERCEPTOR(void *, __tagged_realloc, TAG_T alloc_site_tag, void *ptr,
             SIZE_T size) {
   if (UNLIKELY(IsInDlsymAllocPool(ptr)))
     return ReallocFromLocalPool(ptr, size);
@@ -212,7 +243,7 @@ INTERCEPTOR(void *, __tagged_realloc, TAG_T alloc_site_tag, void *ptr,
 #endif // FUZZALLOC_ASAN
 
 #if SANITIZER_INTERCEPT_REALLOCARRAY
-INTERCEPTOR(void*, reallocarray, void *ptr, uptr nmemb, uptr size) {
+MALLOC_INTERCEPTOR(void*, reallocarray, void *ptr, uptr nmemb, uptr size) {
   ENSURE_ASAN_INITED();
   GET_STACK_TRACE_MALLOC;
   return asan_reallocarray(ptr, nmemb, size, &stack);
@@ -220,12 +251,12 @@ INTERCEPTOR(void*, reallocarray, void *ptr, uptr nmemb, uptr size) {
 #endif  // SANITIZER_INTERCEPT_REALLOCARRAY
 
 #if SANITIZER_INTERCEPT_MEMALIGN
-INTERCEPTOR(void*, memalign, uptr boundary, uptr size) {
+MALLOC_INTERCEPTOR(void*, memalign, uptr boundary, uptr size) {
   GET_STACK_TRACE_MALLOC;
   return asan_memalign(boundary, size, &stack, FROM_MALLOC);
 }
 
-INTERCEPTOR(void*, __libc_memalign, uptr boundary, uptr size) {
+MALLOC_INTERCEPTOR(void*, __libc_memalign, uptr boundary, uptr size) {
   GET_STACK_TRACE_MALLOC;
   void *res = asan_memalign(boundary, size, &stack, FROM_MALLOC);
   DTLS_on_libc_memalign(res, size);
@@ -234,13 +265,13 @@ INTERCEPTOR(void*, __libc_memalign, uptr boundary, uptr size) {
 #endif // SANITIZER_INTERCEPT_MEMALIGN
 
 #if SANITIZER_INTERCEPT_ALIGNED_ALLOC
-INTERCEPTOR(void*, aligned_alloc, uptr boundary, uptr size) {
+MALLOC_INTERCEPTOR(void*, aligned_alloc, uptr boundary, uptr size) {
   GET_STACK_TRACE_MALLOC;
   return asan_aligned_alloc(boundary, size, &stack);
 }
 #endif // SANITIZER_INTERCEPT_ALIGNED_ALLOC
 
-INTERCEPTOR(uptr, malloc_usable_size, void *ptr) {
+MALLOC_INTERCEPTOR(uptr, malloc_usable_size, void *ptr) {
   GET_CURRENT_PC_BP_SP;
   (void)sp;
   return asan_malloc_usable_size(ptr, pc, bp);
@@ -255,37 +286,37 @@ struct fake_mallinfo {
   int x[10];
 };
 
-INTERCEPTOR(struct fake_mallinfo, mallinfo, void) {
+MALLOC_INTERCEPTOR(struct fake_mallinfo, mallinfo, void) {
   struct fake_mallinfo res;
   REAL(memset)(&res, 0, sizeof(res));
   return res;
 }
 
-INTERCEPTOR(int, mallopt, int cmd, int value) {
+MALLOC_INTERCEPTOR(int, mallopt, int cmd, int value) {
   return 0;
 }
 #endif // SANITIZER_INTERCEPT_MALLOPT_AND_MALLINFO
 
-INTERCEPTOR(int, posix_memalign, void **memptr, uptr alignment, uptr size) {
+MALLOC_INTERCEPTOR(int, posix_memalign, void **memptr, uptr alignment, uptr size) {
   if (UNLIKELY(UseLocalPool()))
     return PosixMemalignFromLocalPool(memptr, alignment, size);
   GET_STACK_TRACE_MALLOC;
   return asan_posix_memalign(memptr, alignment, size, &stack);
 }
 
-INTERCEPTOR(void*, valloc, uptr size) {
+MALLOC_INTERCEPTOR(void*, valloc, uptr size) {
   GET_STACK_TRACE_MALLOC;
   return asan_valloc(size, &stack);
 }
 
 #if SANITIZER_INTERCEPT_PVALLOC
-INTERCEPTOR(void*, pvalloc, uptr size) {
+MALLOC_INTERCEPTOR(void*, pvalloc, uptr size) {
   GET_STACK_TRACE_MALLOC;
   return asan_pvalloc(size, &stack);
 }
 #endif // SANITIZER_INTERCEPT_PVALLOC
 
-INTERCEPTOR(void, malloc_stats, void) {
+MALLOC_INTERCEPTOR(void, malloc_stats, void) {
   __asan_print_accumulated_stats();
 }
 
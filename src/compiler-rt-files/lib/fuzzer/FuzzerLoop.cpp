@@ -35,6 +35,12 @@
 #endif
 #endif
 
+// Provided by the fuzzalloc runtime when the target links it. Snapshots
+// every tagged (def-site) mspace on the first call and rolls them back to
+// that snapshot on subsequent calls, leaving the fuzzer's own (untagged)
+// allocations alone. Weak so that in-process runs work without the runtime
+extern "C" __attribute__((weak)) void __fuzzalloc_reset_def_sites();
+
 namespace fuzzer {
 static const size_t kMaxUnitSizeToPrint = 256;
 
@@ -608,6 +614,14 @@ void Fuzzer::ExecuteCallback(const uint8_t *Data, size_t Size) {
     CrashOnOverwrittenData();
   CurrentUnitSize = 0;
   delete[] DataCopy;
+
+  // Roll the target's tagged mspaces back to their post-first-iteration
+  // snapshot so that leaked or retained allocations (and free-list
+  // fragmentation) don't accumulate across in-process runs. The first call
+  // takes the snapshot, so state created during the first iteration (lazy
+  // initialization and the like) survives
+  if (Options.ResetMspaces && __fuzzalloc_reset_def_sites)
+    __fuzzalloc_reset_def_sites();
 }
 
 std::string Fuzzer::WriteToOutputCorpus(const Unit &U) {
@@ -701,10 +715,31 @@ void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
   }
 }
 
+// A def-use feature counts as rare until the whole campaign has produced it
+// this many times; each rare feature in an input's unique feature set grants
+// the input one extra round of mutations, up to this cap over MutateDepth.
+static const uint16_t kRareDataFlowFeatureFreq = 64;
+static const size_t kMaxDataFlowEnergyBoost = 4;
+
 void Fuzzer::MutateAndTestOne() {
   MD.StartMutationSequence();
 
   auto &II = Corpus.ChooseUnitToMutate(MD.GetRand());
+
+  // Rarity-weighted dataflow scheduling: inputs whose unique features include
+  // def-use pairs the campaign has rarely seen get extra mutation energy, so
+  // executions concentrate where data-flow feedback is still informative
+  // instead of re-hitting saturated pairs
+  int MutateDepth = Options.MutateDepth;
+  if (Options.UseDataFlow) {
+    size_t RareDataFlowFeatures = 0;
+    for (auto Feature : II.UniqFeatureSet)
+      if (TPC.IsDataFlowFeature(Feature) &&
+          TPC.GetDataFlowFeatureFreq(Feature) < kRareDataFlowFeatureFreq)
+        RareDataFlowFeatures++;
+    MutateDepth *= static_cast<int>(
+        1 + Min(RareDataFlowFeatures, kMaxDataFlowEnergyBoost));
+  }
   if (Options.DoCrossOver) {
     auto &CrossOverII = Corpus.ChooseUnitToCrossOverWith(
         MD.GetRand(), Options.CrossOverUniformDist);
@@ -723,7 +758,7 @@ void Fuzzer::MutateAndTestOne() {
       Min(MaxMutationLen, Max(U.size(), TmpMaxMutationLen));
   assert(CurrentMaxMutationLen > 0);
 
-  for (int i = 0; i < Options.MutateDepth; i++) {
+  for (int i = 0; i < MutateDepth; i++) {
     if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
       break;
     MaybeExitGracefully();
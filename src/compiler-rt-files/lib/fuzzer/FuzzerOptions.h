@@ -39,6 +39,7 @@ struct FuzzingOptions {
   bool UseCmp = false;
   int UseValueProfile = false;
   bool UseDataFlow = false;
+  bool ResetMspaces = false;
   bool Shrink = false;
   bool ReduceInputs = false;
   int ReloadIntervalSec = 1;
@@ -27,6 +27,10 @@
 // Used by -fsanitize-coverage=stack-depth to track stack depth
 ATTRIBUTES_INTERFACE_TLS_INITIAL_EXEC uintptr_t __sancov_lowest_stack;
 
+// Written inline by the -fuzzalloc-inline-dataflow instrumentation
+ATTRIBUTES_INTERFACE_TLS_INITIAL_EXEC
+uint8_t __dataflow_counters[fuzzer::kDataFlowCountersSize];
+
 namespace fuzzer {
 
 TracePC TPC;
@@ -116,6 +120,18 @@ void TracePC::HandleCallerCallee(uintptr_t Caller, uintptr_t Callee) {
   ValueProfileMap.AddValueModPrime(Idx);
 }
 
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::HandleDataFlow(tag_t DefSite, uintptr_t UseSite,
+                             int64_t Offset) {
+  // Same def/use hash as the AFL-map instrumentation in
+  // InstrumentMemAccesses: ((3 * (def_site - DEFAULT_TAG)) ^ use_site) -
+  // use_site, with the access offset folded into the use site
+  uintptr_t Use = UseSite + (uintptr_t)Offset;
+  uintptr_t Hash =
+      ((3 * ((uintptr_t)DefSite - FUZZALLOC_DEFAULT_TAG)) ^ Use) - Use;
+  DataFlowMap.AddValue(Hash);
+}
+
 /// \return the address of the previous instruction.
 /// Note: the logic is copied from `sanitizer_common/sanitizer_stacktrace.h`
 inline ALWAYS_INLINE uintptr_t GetPreviousInstructionPc(uintptr_t PC) {
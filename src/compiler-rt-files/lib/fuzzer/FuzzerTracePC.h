@@ -17,11 +17,24 @@
 
 #include "fuzzalloc.h"
 
+#include <cstring>
 #include <set>
 #include <unordered_map>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 8-bit dataflow hit counters updated inline by the
+// -fuzzalloc-inline-dataflow instrumentation (one byte per def/use hash),
+// avoiding a __sanitizer_cov_trace_dataflow call per memory access. Must
+// match `kDFCountersSize` in InstrumentMemAccesses.cpp
+extern ATTRIBUTES_INTERFACE_TLS_INITIAL_EXEC uint8_t __dataflow_counters[];
+
 namespace fuzzer {
 
+constexpr size_t kDataFlowCountersSize = 1 << 16;
+
 // TableOfRecentCompares (TORC) remembers the most recently performed
 // comparisons of type T.
 // We record the arguments of CMP instructions in this table unconditionally
@@ -69,6 +82,100 @@ struct MemMemTable {
   }
 };
 
+// Fixed-size bitmap over def-use features. Same size and feature layout as
+// ValueBitMap, but AddValue additionally marks the containing 256-bit block
+// in a coarse summary bitmap, so the post-execution scan (ForEach) and the
+// pre-execution clear (Reset) touch only the blocks the last run actually
+// wrote instead of walking the full map. A typical execution produces a
+// handful of dataflow features, so both operations scale with features
+// produced rather than map size.
+struct DataFlowBitMap {
+  static const size_t kMapSizeInBits = 1 << 16;
+  static const size_t kBitsInWord = sizeof(uintptr_t) * 8;
+  static const size_t kMapSizeInWords = kMapSizeInBits / kBitsInWord;
+  // One summary bit per 256-bit block, so a dirty block is one AVX2 register
+  static const size_t kWordsPerBlock = 32 / sizeof(uintptr_t);
+  static const size_t kNumBlocks = kMapSizeInWords / kWordsPerBlock;
+  static const size_t kSummaryWords = kNumBlocks / kBitsInWord;
+
+  // Clear only the dirty blocks (and the summary itself)
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void Reset() {
+    for (size_t S = 0; S < kSummaryWords; S++) {
+      uintptr_t Dirty = Summary[S];
+      Summary[S] = 0;
+      while (Dirty) {
+        size_t Block = S * kBitsInWord + (size_t)__builtin_ctzl(Dirty);
+        Dirty &= Dirty - 1;
+        uintptr_t *Words = &Map[Block * kWordsPerBlock];
+#if defined(__AVX2__)
+        _mm256_store_si256(reinterpret_cast<__m256i *>(Words),
+                           _mm256_setzero_si256());
+#else
+        for (size_t W = 0; W < kWordsPerBlock; W++)
+          Words[W] = 0;
+#endif
+      }
+    }
+  }
+
+  ATTRIBUTE_NO_SANITIZE_ALL
+  bool AddValue(uintptr_t Value) {
+    uintptr_t Idx = Value % kMapSizeInBits;
+    uintptr_t WordIdx = Idx / kBitsInWord;
+    uintptr_t BitIdx = Idx % kBitsInWord;
+    uintptr_t Old = Map[WordIdx];
+    uintptr_t New = Old | ((uintptr_t)1 << BitIdx);
+    Map[WordIdx] = New;
+
+    uintptr_t Block = WordIdx / kWordsPerBlock;
+    Summary[Block / kBitsInWord] |= (uintptr_t)1 << (Block % kBitsInWord);
+
+    return New != Old;
+  }
+
+  size_t SizeInBits() const { return kMapSizeInBits; }
+
+  template <class Callback>
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void ForEach(Callback CB) const {
+    for (size_t S = 0; S < kSummaryWords; S++) {
+      uintptr_t Dirty = Summary[S];
+      while (Dirty) {
+        size_t Block = S * kBitsInWord + (size_t)__builtin_ctzl(Dirty);
+        Dirty &= Dirty - 1;
+        const uintptr_t *Words = &Map[Block * kWordsPerBlock];
+#if defined(__AVX2__)
+        // One 256-bit compare yields a mask of the non-zero words in the
+        // block; only those are scanned bit-by-bit
+        __m256i V =
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(Words));
+        __m256i Z = _mm256_cmpeq_epi64(V, _mm256_setzero_si256());
+        unsigned NonZero =
+            ~(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(Z)) & 0xf;
+        while (NonZero) {
+          size_t W = (size_t)__builtin_ctz(NonZero);
+          NonZero &= NonZero - 1;
+          uintptr_t M = Words[W];
+#else
+        for (size_t W = 0; W < kWordsPerBlock; W++) {
+          uintptr_t M = Words[W];
+#endif
+          while (M) {
+            size_t J = (size_t)__builtin_ctzl(M);
+            M &= M - 1;
+            CB((Block * kWordsPerBlock + W) * kBitsInWord + J);
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  ATTRIBUTE_ALIGNED(512) uintptr_t Map[kMapSizeInWords];
+  uintptr_t Summary[kSummaryWords];
+};
+
 class TracePC {
  public:
   void HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop);
@@ -88,6 +195,8 @@ class TracePC {
   void ResetMaps() {
     ValueProfileMap.Reset();
     DataFlowMap.Reset();
+    if (UseDataFlow)
+      memset(__dataflow_counters, 0, kDataFlowCountersSize);
     ClearExtraCounters();
     ClearInlineCounters();
   }
@@ -133,6 +242,21 @@ class TracePC {
   static uintptr_t GetNextInstructionPc(uintptr_t PC);
   bool PcIsFuncEntry(const PCTableEntry *TE) { return TE->PCFlags & 1; }
 
+  // True if Feature falls in the range CollectFeatures assigns to the
+  // def-use bitmap. The feature layout is fixed once the modules are
+  // registered, so features recorded in corpus entries stay classifiable
+  // for the lifetime of the process
+  bool IsDataFlowFeature(size_t Feature) const {
+    return UseDataFlow && Feature >= DataFlowFirstFeature &&
+           Feature < DataFlowFirstFeature + DataFlowBitMap::kMapSizeInBits;
+  }
+
+  // How many executions across the whole campaign have produced this
+  // def-use feature (saturating). Only valid if IsDataFlowFeature(Feature)
+  uint16_t GetDataFlowFeatureFreq(size_t Feature) const {
+    return DataFlowFeatureFreqs[Feature - DataFlowFirstFeature];
+  }
+
 private:
   bool UseCounters = false;
   uint32_t UseValueProfileMask = false;
@@ -181,7 +305,14 @@ private:
   uint8_t *FocusFunctionCounterPtr = nullptr;
 
   ValueBitMap ValueProfileMap;
-  ValueBitMap DataFlowMap;
+  DataFlowBitMap DataFlowMap;
+
+  // Campaign-global hit counts of the def-use bitmap features, maintained
+  // during CollectFeatures (hence mutable) and consumed by the fuzzing loop
+  // to weight mutation energy towards inputs exercising still-rare flows
+  mutable uint16_t DataFlowFeatureFreqs[DataFlowBitMap::kMapSizeInBits] = {};
+  mutable size_t DataFlowFirstFeature = 0;
+
   uintptr_t InitialStack;
 };
 
@@ -276,8 +407,20 @@ void TracePC::CollectFeatures(Callback HandleFeature) const {
   }
 
   if (UseDataFlow) {
-    DataFlowMap.ForEach([&](size_t Idx) { HandleFeature(FirstFeature + Idx); });
+    DataFlowFirstFeature = FirstFeature;
+    DataFlowMap.ForEach([&](size_t Idx) {
+      if (DataFlowFeatureFreqs[Idx] != UINT16_MAX)
+        DataFlowFeatureFreqs[Idx]++;
+      HandleFeature(FirstFeature + Idx);
+    });
     FirstFeature += DataFlowMap.SizeInBits();
+
+    // Counters written inline by the -fuzzalloc-inline-dataflow
+    // instrumentation (zero unless that mode is enabled at build time)
+    FirstFeature += 8 * ForEachNonZeroByte(
+                            __dataflow_counters,
+                            __dataflow_counters + kDataFlowCountersSize,
+                            FirstFeature, Handle8bitCounter);
   }
 
   // Step function, grows similar to 8 * Log_2(A).
@@ -101,8 +101,12 @@ class LargeMmapAllocator {
              SanitizerToolName, map_size, alignment);
       return nullptr;
     }
-    uptr map_beg =
-        reinterpret_cast<uptr>(REAL(__tagged_malloc)(alloc_site_tag, map_size));
+    // Steady-state large allocations are served from the mapping cache, so
+    // they never enter the kernel
+    uptr map_beg = ReuseMapping(&map_size, alloc_site_tag);
+    if (!map_beg)
+      map_beg = reinterpret_cast<uptr>(
+          REAL(__tagged_malloc)(alloc_site_tag, map_size));
     if (!map_beg)
       return nullptr;
     MapUnmapCallback().OnMap(map_beg, map_size);
@@ -151,7 +155,8 @@ class LargeMmapAllocator {
       stat->Sub(AllocatorStatMapped, h->map_size);
     }
     MapUnmapCallback().OnUnmap(h->map_beg, h->map_size);
-    UnmapOrDie(reinterpret_cast<void*>(h->map_beg), h->map_size);
+    if (!CacheMapping(h->map_beg, h->map_size))
+      UnmapOrDie(reinterpret_cast<void*>(h->map_beg), h->map_size);
   }
 
   uptr TotalMemoryUsed() {
@@ -252,9 +257,11 @@ class LargeMmapAllocator {
   }
 
   void PrintStats() {
-    Printf("Stats: LargeMmapAllocator: allocated %zd times, "
+    Printf("Stats: LargeMmapAllocator: allocated %zd times "
+           "(%zd from the mapping cache), "
            "remains %zd (%zd K) max %zd M; by size logs: ",
-           stats.n_allocs, stats.n_allocs - stats.n_frees,
+           stats.n_allocs, stats.n_cache_reuses,
+           stats.n_allocs - stats.n_frees,
            stats.currently_allocated >> 10, stats.max_allocated >> 20);
     for (uptr i = 0; i < ARRAY_SIZE(stats.by_size_log); i++) {
       uptr c = stats.by_size_log[i];
@@ -311,13 +318,97 @@ class LargeMmapAllocator {
     return RoundUpTo(size, page_size_) + page_size_;
   }
 
+  // Size-bucketed cache of deallocated regions, so that steady-state large
+  // allocations (e.g. per-input frame buffers) are recycled instead of paying
+  // a syscall pair per allocation. Cached regions have had their pages
+  // returned to the OS with MADV_DONTNEED, so they cost address space but no
+  // RSS and read as zero when reused, exactly like a fresh mapping. A
+  // region's def site tag lives in its upper address bits, so it is only
+  // reused for allocations with the same tag
+
+  // Park a deallocated region in the cache. Returns false (and caches
+  // nothing) if the region would take the cache over its byte budget
+  bool CacheMapping(uptr beg, uptr size) {
+    uptr bucket = MostSignificantSetBitIndex(size);
+    CHECK_LT(bucket, kMapCacheBuckets);
+    if (map_cache_bytes_ + size > kMapCacheMaxBytes)
+      return false;
+
+    // Drop the pages before the region becomes visible for reuse
+    ReleaseMemoryPagesToOS(beg, beg + size);
+
+    uptr evict_beg = 0;
+    uptr evict_size = 0;
+    {
+      SpinMutexLock l(&mutex_);
+      MapCacheEntry *e = &map_cache_[bucket][0];
+      for (uptr i = 0; i < kMapCacheEntriesPerBucket; i++) {
+        if (!map_cache_[bucket][i].beg) {
+          e = &map_cache_[bucket][i];
+          break;
+        }
+      }
+      if (e->beg) {
+        // Bucket full: replace an entry so the cache tracks the sizes (and
+        // tags) the target currently allocates
+        evict_beg = e->beg;
+        evict_size = e->size;
+        map_cache_bytes_ -= e->size;
+      }
+      e->beg = beg;
+      e->size = size;
+      map_cache_bytes_ += size;
+    }
+    if (evict_beg)
+      UnmapOrDie(reinterpret_cast<void *>(evict_beg), evict_size);
+    return true;
+  }
+
+  // Look for a cached region with the right def site tag that is large
+  // enough. On success returns its base and updates *map_size to the cached
+  // region's (possibly larger) size
+  uptr ReuseMapping(uptr *map_size, tag_t alloc_site_tag) {
+    uptr needed = *map_size;
+    uptr min_bucket = MostSignificantSetBitIndex(needed);
+    uptr max_bucket = Min(min_bucket + 2, kMapCacheBuckets);
+    SpinMutexLock l(&mutex_);
+    for (uptr bucket = min_bucket; bucket < max_bucket; bucket++) {
+      for (uptr i = 0; i < kMapCacheEntriesPerBucket; i++) {
+        MapCacheEntry *e = &map_cache_[bucket][i];
+        if (!e->beg || e->size < needed)
+          continue;
+        if ((tag_t)(e->beg >> FUZZALLOC_TAG_SHIFT) != alloc_site_tag)
+          continue;
+        uptr beg = e->beg;
+        *map_size = e->size;
+        map_cache_bytes_ -= e->size;
+        e->beg = 0;
+        stats.n_cache_reuses++;
+        return beg;
+      }
+    }
+    return 0;
+  }
+
+  static const uptr kMapCacheBuckets = 64;
+  static const uptr kMapCacheEntriesPerBucket = 8;
+  static const uptr kMapCacheMaxBytes = 256UL << 20;
+
+  struct MapCacheEntry {
+    uptr beg;  // 0 means the slot is empty
+    uptr size;
+  };
+
   uptr page_size_;
   Header **chunks_;
   PtrArrayT ptr_array_;
   uptr n_chunks_;
   bool chunks_sorted_;
+  MapCacheEntry map_cache_[kMapCacheBuckets][kMapCacheEntriesPerBucket];
+  uptr map_cache_bytes_;
   struct Stats {
-    uptr n_allocs, n_frees, currently_allocated, max_allocated, by_size_log[64];
+    uptr n_allocs, n_frees, n_cache_reuses, currently_allocated, max_allocated,
+        by_size_log[64];
   } stats;
   StaticSpinMutex mutex_;
 };
@@ -0,0 +1,53 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdint.h>
+
+#include "fuzzalloc.h" // for FUZZALLOC_TAG_MAX
+
+#if defined(__cplusplus)
+extern "C" {
+#endif // __cplusplus
+
+/// Environment variable carrying the SysV shared memory key of the per-tag
+/// allocation statistics segment. When set, the allocator creates (or
+/// attaches to) the segment and keeps the counters there, so `fuzzalloc-stat`
+/// can dump them while the target runs. When unset, no statistics are kept
+#define ALLOC_STATS_KEY_ENV_VAR "FUZZALLOC_ALLOC_STATS"
+
+/// Per-def-site allocation counters. Updated with relaxed atomics on the
+/// allocation and deallocation paths
+typedef struct {
+  /// Number of allocations serviced for this def site
+  uint64_t allocs;
+
+  /// Bytes (usable size) currently live for this def site
+  uint64_t live_bytes;
+
+  /// High-water mark of `live_bytes`
+  uint64_t peak_bytes;
+} alloc_stats_t;
+
+/// Size (in bytes) of the statistics segment: one entry per possible tag
+#define ALLOC_STATS_SIZE ((FUZZALLOC_TAG_MAX + 1) * sizeof(alloc_stats_t))
+
+/// The per-tag allocation statistics, indexed by def site tag. Points at a
+/// private dummy array until the shared memory segment is attached
+extern alloc_stats_t *__alloc_stats_ptr;
+
+/// Non-zero once the shared memory segment is attached. The allocator only
+/// pays for the counter updates when this is set
+extern int __alloc_stats_enabled;
+
+#if defined(__cplusplus)
+}
+#endif // __cplusplus
+
+#endif // ALLOC_STATS_H
@@ -0,0 +1,65 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#ifndef DATAFLOW_CLASSIFY_H
+#define DATAFLOW_CLASSIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/// AFL's hit-count buckets. A classified counter has exactly one bit set, so
+/// a classified map byte is a bitmask over the buckets the feature hit -
+/// tools can compare, OR and popcount classified maps directly
+static const uint8_t dataflow_count_class[256] = {
+    [0] = 0,
+    [1] = 1,
+    [2] = 2,
+    [3] = 4,
+    [4 ... 7] = 8,
+    [8 ... 15] = 16,
+    [16 ... 31] = 32,
+    [32 ... 127] = 64,
+    [128 ... 255] = 128,
+};
+
+/// Bucket-classify a dataflow (or edge) map in place, as AFL does for its
+/// trace map after every execution. Maps are almost entirely zero, so the
+/// cost is dominated by skimming over zero bytes: with AVX2 a single testz
+/// skips 32 bytes at a time, and only blocks containing live counters take
+/// the table lookups. `size` must be a multiple of 8
+static inline void dataflow_classify_counts(uint8_t *map, size_t size) {
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(map + i));
+    if (_mm256_testz_si256(v, v)) {
+      continue;
+    }
+    for (size_t j = i; j < i + 32; j++) {
+      map[j] = dataflow_count_class[map[j]];
+    }
+  }
+#endif
+
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    __builtin_memcpy(&word, map + i, sizeof(word));
+    if (!word) {
+      continue;
+    }
+    for (size_t j = i; j < i + 8; j++) {
+      map[j] = dataflow_count_class[map[j]];
+    }
+  }
+}
+
+#endif // DATAFLOW_CLASSIFY_H
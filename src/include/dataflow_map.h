@@ -0,0 +1,41 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#ifndef DATAFLOW_MAP_H
+#define DATAFLOW_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif // __cplusplus
+
+/// Environment variable carrying the SysV shared memory ID of the dataflow
+/// map. Set by the fuzzer, mirroring AFL's `__AFL_SHM_ID` handshake
+#define DATAFLOW_SHM_ENV_VAR "__DATAFLOW_SHM_ID"
+
+/// Environment variable carrying the dataflow map size (in bytes). Must be a
+/// power of two and must match the map size the target was instrumented with
+/// (`-fuzzalloc-dataflow-map-size`)
+#define DATAFLOW_MAP_SIZE_ENV_VAR "FUZZALLOC_DATAFLOW_MAP_SIZE"
+
+/// Default dataflow map size (in bytes). The same size as AFL's edge map
+#define DATAFLOW_MAP_DEFAULT_SIZE 0x10000UL
+
+/// The dataflow map. Instrumented code records def-use features here (rather
+/// than in AFL's edge map) when built with `-fuzzalloc-dataflow-map`
+extern uint8_t *__dataflow_area_ptr;
+
+/// The size (in bytes) of the dataflow map
+extern size_t __dataflow_map_size;
+
+#if defined(__cplusplus)
+}
+#endif // __cplusplus
+
+#endif // DATAFLOW_MAP_H
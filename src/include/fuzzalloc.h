@@ -23,36 +23,85 @@ extern "C" {
 /// The number of usable bits on the X86-64 architecture
 #define NUM_USABLE_BITS 48
 
-/// Number of bits in a tag
-#define NUM_TAG_BITS 16
+/// Number of bits in a tag. Configurable at build time with
+/// -DFUZZALLOC_TAG_BITS=N (16 <= N <= 24) for targets with more than ~32k
+/// def sites. Tags wider than 16 bits use a two-level scheme: the upper 16
+/// bits select a region exactly as before, and the remaining low bits select
+/// a slab within that region, so widening the tag subdivides regions rather
+/// than changing the memory layout. Every allocator table scales with the
+/// tag range but lives in BSS, so only the pages actually touched are ever
+/// committed
+#if !defined(FUZZALLOC_TAG_BITS)
+#define FUZZALLOC_TAG_BITS 16
+#endif
+
+#if FUZZALLOC_TAG_BITS < 16 || FUZZALLOC_TAG_BITS > 24
+#error FUZZALLOC_TAG_BITS must be between 16 and 24
+#endif
+
+#define NUM_TAG_BITS FUZZALLOC_TAG_BITS
+
+/// Number of region-selecting (level one) tag bits
+#define FUZZALLOC_REGION_BITS 16
+
+/// Number of slab-selecting (level two) tag bits. Zero in the default
+/// single-level configuration
+#define FUZZALLOC_SUBTAG_BITS (NUM_TAG_BITS - FUZZALLOC_REGION_BITS)
 
 /// Tag shift amount
 #define FUZZALLOC_TAG_SHIFT (NUM_USABLE_BITS - NUM_TAG_BITS)
 
 /// Tag type
+#if NUM_TAG_BITS <= 16
 typedef uint16_t tag_t;
+#else
+typedef uint32_t tag_t;
+#endif
+
+/// The region (level one) part of a tag
+#define FUZZALLOC_GET_REGION_TAG(tag)                                          \
+  ((tag_t)((tag_t)(tag) >> FUZZALLOC_SUBTAG_BITS))
+
+/// The slab (level two) part of a tag
+#define FUZZALLOC_GET_SUBTAG(tag)                                              \
+  ((tag_t)((tag_t)(tag) & ((1U << FUZZALLOC_SUBTAG_BITS) - 1)))
 
 /// The default def site tag. Used by default for non-instrumented code
 #define FUZZALLOC_DEFAULT_TAG 1
 
+/// Number of tags reserved for non-instrumented code. Allocations from
+/// uninstrumented code can be sharded across the tags in
+/// [FUZZALLOC_DEFAULT_TAG, FUZZALLOC_DEFAULT_TAG + FUZZALLOC_NUM_DEFAULT_TAGS)
+/// so background allocation traffic doesn't funnel through a single mspace
+#define FUZZALLOC_NUM_DEFAULT_TAGS 4
+
 /// ASan's quarantine region gets its own mspace. Note that the quarantine
 /// region is only defined if we're building with ASan
-#define FUZZALLOC_ASAN_QUARANTINE_TAG (FUZZALLOC_DEFAULT_TAG + 1)
+#define FUZZALLOC_ASAN_QUARANTINE_TAG                                          \
+  (FUZZALLOC_DEFAULT_TAG + FUZZALLOC_NUM_DEFAULT_TAGS)
 
 /// The default minimum tag value
-#define FUZZALLOC_TAG_MIN (FUZZALLOC_DEFAULT_TAG + 1)
+#define FUZZALLOC_TAG_MIN (FUZZALLOC_DEFAULT_TAG + FUZZALLOC_NUM_DEFAULT_TAGS)
+
+/// Number of tags reserved for ASan's quarantine. Quarantine bookkeeping
+/// allocations are sharded across the tags in [FUZZALLOC_ASAN_QUARANTINE_TAG,
+/// FUZZALLOC_ASAN_QUARANTINE_TAG + FUZZALLOC_ASAN_NUM_QUARANTINE_TAGS) by
+/// thread so that recycling threads don't contend on a single mspace
+#define FUZZALLOC_ASAN_NUM_QUARANTINE_TAGS 4
 
 /// The default minimum tag value when compiling with ASan
-#define FUZZALLOC_ASAN_TAG_MIN (FUZZALLOC_ASAN_QUARANTINE_TAG + 1)
+#define FUZZALLOC_ASAN_TAG_MIN                                                 \
+  (FUZZALLOC_ASAN_QUARANTINE_TAG + FUZZALLOC_ASAN_NUM_QUARANTINE_TAGS)
 
 /// Tag mask
 #define FUZZALLOC_TAG_MASK ((1UL << NUM_TAG_BITS) - 1)
 
-/// The default maximum tag value
-#define FUZZALLOC_TAG_MAX 0x7FFEUL
+/// The default maximum tag value. The top tag bit stays clear so that every
+/// mspace lands in the canonical (47-bit) user half of the address space
+#define FUZZALLOC_TAG_MAX ((1UL << (NUM_TAG_BITS - 1)) - 2)
 
 /// The default maximum tag value when compiling with ASan
-#define FUZZALLOC_ASAN_TAG_MAX 0x6FFDUL
+#define FUZZALLOC_ASAN_TAG_MAX (FUZZALLOC_TAG_MAX - 0x1001UL)
 
 /// The ASan shadow memory offset when using fuzzalloc. Ensure that it is far
 /// enough from the maximum fuzzalloc tag so that an mspace doesn't get
@@ -60,6 +109,14 @@ typedef uint16_t tag_t;
 #define FUZZALLOC_ASAN_SHADOW_OFFSET                                           \
   ((FUZZALLOC_ASAN_TAG_MAX + 2) << FUZZALLOC_TAG_SHIFT)
 
+/// Reset all live mspaces to their snapshotted state (taking the snapshot on
+/// the first call). Intended to be called between iterations by persistent
+/// mode fuzzing harnesses so that teardown cost does not scale with the
+/// number of live allocations. With `FUZZALLOC_SNAPSHOT` set the reset also
+/// rolls back `.data`/`.bss` and the libc heap page-by-page via soft-dirty
+/// tracking, making forking between iterations unnecessary entirely
+void __fuzzalloc_reset_all(void);
+
 #if defined(__cplusplus)
 }
 
@@ -0,0 +1,55 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#ifndef MEM_TRACE_H
+#define MEM_TRACE_H
+
+#include <stdint.h>
+
+#include "fuzzalloc.h" // for tag_t
+
+#if defined(__cplusplus)
+extern "C" {
+#endif // __cplusplus
+
+/// Environment variable naming the trace file. When set, the debug-log
+/// instrumentation records binary ring-buffer records into it (via a shared
+/// mmap) instead of formatting a printf-style message per access
+#define MEM_TRACE_FILE_ENV_VAR "FUZZALLOC_TRACE_FILE"
+
+/// Environment variable giving the ring capacity (in records, a power of
+/// two). Older records are overwritten once the ring wraps
+#define MEM_TRACE_RECORDS_ENV_VAR "FUZZALLOC_TRACE_RECORDS"
+
+/// Default ring capacity (in records)
+#define MEM_TRACE_DEFAULT_RECORDS (1UL << 20)
+
+/// Magic number identifying a trace file
+#define MEM_TRACE_MAGIC 0x46545243U
+
+/// Trace file header. `head` counts records ever written (not wrapped); the
+/// slot for record `n` is `n & (num_records - 1)`
+typedef struct {
+  uint32_t magic;
+  uint32_t num_records;
+  uint64_t head;
+} mem_trace_header_t;
+
+/// One traced memory access. The use site offset is truncated to 32 bits to
+/// keep records at 16 bytes
+typedef struct {
+  tag_t def_site;
+  uint16_t unused;
+  int32_t offset;
+  uint64_t ret_addr;
+} mem_trace_record_t;
+
+#if defined(__cplusplus)
+}
+#endif // __cplusplus
+
+#endif // MEM_TRACE_H
@@ -12,10 +12,18 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "Utils/FuzzallocUtils.h"
@@ -24,6 +32,18 @@ using namespace llvm;
 
 #define DEBUG_TYPE "fuzzalloc-collect-stats"
 
+static cl::opt<bool> ClCostReport(
+    "fuzzalloc-cost-report",
+    cl::desc("Estimate the run-time cost of the def-use instrumentation: each "
+             "load/store is weighted by how often its block is expected to "
+             "execute per function entry (BlockFrequencyInfo). Reports the "
+             "module total and the most expensive functions, for choosing a "
+             "-fuzzalloc-cost-budget"),
+    cl::init(false), cl::Hidden);
+
+/// Number of functions listed in the cost report
+static const unsigned kNumCostReportFuncs = 10;
+
 namespace {
 
 /// Collect useful statistics
@@ -36,6 +56,13 @@ private:
   unsigned long NumOfInstrumentedDerefs;
   unsigned long NumOfHeapifiedAllocas;
 
+  /// Estimated instrumentation cost (with -fuzzalloc-cost-report): the module
+  /// total and the most expensive functions, each in expected memory-access
+  /// executions per function entry
+  uint64_t TotalInstCost;
+  SmallVector<std::pair<uint64_t, std::string>, kNumCostReportFuncs>
+      TopInstCosts;
+
 public:
   static char ID;
   CollectStats() : ModulePass(ID) {}
@@ -51,6 +78,7 @@ public:
 char CollectStats::ID = 0;
 
 void CollectStats::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<BlockFrequencyInfoWrapperPass>();
   AU.setPreservesAll();
 }
 
@@ -62,6 +90,15 @@ void CollectStats::print(raw_ostream &O, const Module *M) const {
   O << "  num. of dereferenced pointers: " << this->NumOfInstrumentedDerefs
     << "\n";
   O << "  num. of heapified allocas: " << this->NumOfHeapifiedAllocas << "\n";
+
+  if (ClCostReport) {
+    O << "  est. instrumentation cost (accesses per function entry): "
+      << this->TotalInstCost << "\n";
+    O << "  most expensive functions:\n";
+    for (const auto &Cost : this->TopInstCosts) {
+      O << "    " << Cost.second << ": " << Cost.first << "\n";
+    }
+  }
 }
 
 bool CollectStats::doInitialization(Module &M) {
@@ -71,30 +108,70 @@ bool CollectStats::doInitialization(Module &M) {
   this->NumOfTaggedAllocs = 0;
   this->NumOfInstrumentedDerefs = 0;
   this->NumOfHeapifiedAllocas = 0;
+  this->TotalInstCost = 0;
 
   return false;
 }
 
 bool CollectStats::runOnModule(Module &M) {
-  for (const auto &F : M.functions()) {
-    for (auto &BB : F) {
-      this->NumOfBasicBlocks++;
+  // Resolve the metadata kind IDs up front: getMDKindID may mutate the
+  // context, so it must not be called from the worker threads
+  unsigned TaggedAllocMD = M.getMDKindID("fuzzalloc.tagged_alloc");
+  unsigned InstrumentedDerefMD = M.getMDKindID("fuzzalloc.instrumented_deref");
+  unsigned HeapifiedAllocaMD = M.getMDKindID("fuzzalloc.heapified_alloca");
 
-      for (auto &I : BB) {
-        if (isa<AllocaInst>(I)) {
-          this->NumOfAllocas++;
-        }
+  SmallVector<const Function *, 64> Funcs;
+  for (const auto &F : M.functions()) {
+    Funcs.push_back(&F);
+  }
 
-        if (I.getMetadata(M.getMDKindID("fuzzalloc.tagged_alloc"))) {
-          this->NumOfTaggedAllocs++;
-        } else if (I.getMetadata(
-                       M.getMDKindID("fuzzalloc.instrumented_deref"))) {
-          this->NumOfInstrumentedDerefs++;
-        } else if (I.getMetadata(M.getMDKindID("fuzzalloc.heapified_alloca"))) {
-          this->NumOfHeapifiedAllocas++;
+  // Count functions in parallel, one result set per worker, merged below.
+  // The traversal is read-only, so the workers never touch shared state
+  struct Counts {
+    unsigned long BasicBlocks = 0;
+    unsigned long Allocas = 0;
+    unsigned long TaggedAllocs = 0;
+    unsigned long InstrumentedDerefs = 0;
+    unsigned long HeapifiedAllocas = 0;
+  };
+
+  ThreadPool Pool(hardware_concurrency());
+  unsigned NumShards = Pool.getThreadCount();
+  std::vector<Counts> ShardCounts(NumShards);
+
+  for (unsigned Shard = 0; Shard < NumShards; Shard++) {
+    Pool.async([&, Shard] {
+      Counts &C = ShardCounts[Shard];
+
+      for (size_t Idx = Shard; Idx < Funcs.size(); Idx += NumShards) {
+        for (auto &BB : *Funcs[Idx]) {
+          C.BasicBlocks++;
+
+          for (auto &I : BB) {
+            if (isa<AllocaInst>(I)) {
+              C.Allocas++;
+            }
+
+            if (I.getMetadata(TaggedAllocMD)) {
+              C.TaggedAllocs++;
+            } else if (I.getMetadata(InstrumentedDerefMD)) {
+              C.InstrumentedDerefs++;
+            } else if (I.getMetadata(HeapifiedAllocaMD)) {
+              C.HeapifiedAllocas++;
+            }
+          }
         }
       }
-    }
+    });
+  }
+  Pool.wait();
+
+  for (const auto &C : ShardCounts) {
+    this->NumOfBasicBlocks += C.BasicBlocks;
+    this->NumOfAllocas += C.Allocas;
+    this->NumOfTaggedAllocs += C.TaggedAllocs;
+    this->NumOfInstrumentedDerefs += C.InstrumentedDerefs;
+    this->NumOfHeapifiedAllocas += C.HeapifiedAllocas;
   }
 
   for (const auto &G : M.globals()) {
@@ -105,6 +182,56 @@ bool CollectStats::runOnModule(Module &M) {
     }
   }
 
+  if (ClCostReport) {
+    // Weigh every load/store by how often its block is expected to execute
+    // per function entry - the same estimate the instrumentation pass uses to
+    // spend its -fuzzalloc-cost-budget. This loop stays serial: getAnalysis
+    // must not be called from the worker threads above
+    SmallVector<std::pair<uint64_t, const Function *>, 32> FuncCosts;
+
+    for (auto &F : M.functions()) {
+      if (F.isDeclaration()) {
+        continue;
+      }
+
+      const BlockFrequencyInfo &BFI =
+          getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+      uint64_t FuncCost = 0;
+
+      for (const auto &BB : F) {
+        unsigned NumAccesses = 0;
+        for (const auto &I : BB) {
+          if (isa<LoadInst>(I) || isa<StoreInst>(I)) {
+            NumAccesses++;
+          }
+        }
+        if (NumAccesses) {
+          uint64_t BlockFreq =
+              std::max<uint64_t>(1, BFI.getBlockFreq(&BB).getFrequency() /
+                                        std::max<uint64_t>(
+                                            1, BFI.getEntryFreq()));
+          FuncCost += BlockFreq * NumAccesses;
+        }
+      }
+
+      this->TotalInstCost += FuncCost;
+      FuncCosts.push_back({FuncCost, &F});
+    }
+
+    llvm::stable_sort(FuncCosts,
+                      [](const std::pair<uint64_t, const Function *> &A,
+                         const std::pair<uint64_t, const Function *> &B) {
+                        return A.first > B.first;
+                      });
+
+    this->TopInstCosts.clear();
+    for (unsigned Idx = 0;
+         Idx < FuncCosts.size() && Idx < kNumCostReportFuncs; Idx++) {
+      this->TopInstCosts.push_back(
+          {FuncCosts[Idx].first, FuncCosts[Idx].second->getName().str()});
+    }
+  }
+
   return false;
 }
 
@@ -14,6 +14,8 @@
 //===----------------------------------------------------------------------===//
 
 #include <map>
+#include <unistd.h>
+#include <vector>
 
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
@@ -27,10 +29,13 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/SpecialCaseList.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/VirtualFileSystem.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "Utils/FuzzallocUtils.h"
+#include "Utils/TagSiteDB.h"
 #include "debug.h" // from afl
 
 using namespace llvm;
@@ -40,14 +45,26 @@ using namespace llvm::sys::fs;
 
 static cl::opt<std::string>
     ClLogPath("fuzzalloc-tag-log",
-              cl::desc("Path to log file containing values to tag"),
-              cl::Required);
+              cl::desc("Path to log file containing values to tag"));
+
+static cl::opt<std::string>
+    ClDBPath("fuzzalloc-tag-db",
+             cl::desc("Path to the binary tag-site database (used instead of "
+                      "the text tag log)"));
 
 static cl::opt<std::string> ClMemFuncs(
     "fuzzalloc-mem-funcs",
     cl::desc("Path to file listing custom memory allocation functions"));
 
+static cl::opt<bool> ClAutoMemFuncs(
+    "fuzzalloc-auto-mem-funcs",
+    cl::desc("Automatically detect allocation wrapper functions (whose "
+             "return value derives from a malloc-family call) and tag them"),
+    cl::init(true));
+
 STATISTIC(NumOfFunctions, "Number of functions to tag.");
+STATISTIC(NumOfAllocWrappers,
+          "Number of automatically-detected allocation wrapper functions.");
 STATISTIC(NumOfGlobalVariables, "Number of global variables to tag.");
 STATISTIC(NumOfGlobalAliases, "Number of global aliases to tag.");
 STATISTIC(NumOfStructOffsets, "Number of struct offsets to tag.");
@@ -85,6 +102,7 @@ private:
 
   void tagUser(const User *, const Function *, const TargetLibraryInfo *);
   void saveTagSites() const;
+  void saveTagSiteDB() const;
 
 public:
   static char ID;
@@ -116,6 +134,64 @@ static FuzzallocMemFuncList getMemFunclist() {
       SpecialCaseList::createOrDie({ClMemFuncs}, *vfs::getRealFileSystem()));
 }
 
+/// Returns \c true if \p V is directly derived from a call to one of
+/// \p Allocators - i.e., it is such a call's result, possibly routed through
+/// pointer casts, GEPs, PHI nodes, or selects
+static bool
+derivesFromAllocCall(const Value *V,
+                     const SmallPtrSetImpl<const Function *> &Allocators) {
+  SmallPtrSet<const Value *, 16> Visited;
+  SmallVector<const Value *, 8> Worklist({V});
+
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val()->stripPointerCasts();
+    if (!Visited.insert(V).second) {
+      continue;
+    }
+
+    if (auto *CB = dyn_cast<CallBase>(V)) {
+      auto *Callee =
+          dyn_cast<Function>(CB->getCalledOperand()->stripPointerCasts());
+      if (Callee && Allocators.count(Callee)) {
+        return true;
+      }
+    } else if (auto *PHI = dyn_cast<PHINode>(V)) {
+      for (const auto &In : PHI->incoming_values()) {
+        Worklist.push_back(In.get());
+      }
+    } else if (auto *Select = dyn_cast<SelectInst>(V)) {
+      Worklist.push_back(Select->getTrueValue());
+      Worklist.push_back(Select->getFalseValue());
+    } else if (auto *GEP = dyn_cast<GEPOperator>(V)) {
+      Worklist.push_back(GEP->getPointerOperand());
+    }
+  }
+
+  return false;
+}
+
+/// Returns \c true if \p F looks like a dynamic memory allocation wrapper: a
+/// pointer-returning function with at least one return path whose value is
+/// directly derived from a call to a known allocator (xmalloc-style wrappers
+/// forwarding their size parameter, fixed-size object constructors, etc.)
+static bool
+isAllocWrapper(const Function &F,
+               const SmallPtrSetImpl<const Function *> &Allocators) {
+  if (F.isDeclaration() || !F.getReturnType()->isPointerTy()) {
+    return false;
+  }
+
+  for (const auto &BB : F) {
+    if (auto *Ret = dyn_cast<ReturnInst>(BB.getTerminator())) {
+      if (derivesFromAllocCall(Ret->getReturnValue(), Allocators)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
 void CollectTagSites::tagUser(const User *U, const Function *F,
                               const TargetLibraryInfo *TLI) {
   LLVM_DEBUG(dbgs() << "recording user " << *U << " of tagged function "
@@ -273,11 +349,85 @@ void CollectTagSites::saveTagSites() const {
   }
 }
 
+void CollectTagSites::saveTagSiteDB() const {
+  SmallVector<char, 4096> Buf;
+
+  for (auto *F : this->FunctionsToTag) {
+    if (!F) {
+      continue;
+    }
+
+    std::string TypeStr;
+    raw_string_ostream TypeOS(TypeStr);
+    TypeOS << *F->getFunctionType();
+    appendTagSiteRecord(Buf, TagSiteKind::Function, F->getName(), /* Aux */ 0,
+                        /* FuncName */ "", TypeOS.str());
+  }
+
+  for (auto *GV : this->GlobalVariablesToTag) {
+    appendTagSiteRecord(Buf, TagSiteKind::GlobalVariable, GV->getName());
+  }
+
+  for (auto *GA : this->GlobalAliasesToTag) {
+    appendTagSiteRecord(Buf, TagSiteKind::GlobalAlias, GA->getName());
+  }
+
+  for (const auto &StructWithFunc : this->StructOffsetsToTag) {
+    auto *StructTy = StructWithFunc.first.first;
+    unsigned Offset = StructWithFunc.first.second;
+    auto *F = StructWithFunc.second;
+
+    if (!StructTy->hasName()) {
+      continue;
+    }
+
+    std::string TypeStr;
+    raw_string_ostream TypeOS(TypeStr);
+    TypeOS << *F->getFunctionType();
+    appendTagSiteRecord(Buf, TagSiteKind::StructOffset, StructTy->getName(),
+                        Offset, F->getName(), TypeOS.str());
+  }
+
+  for (auto *Arg : this->FunctionArgsToTag) {
+    appendTagSiteRecord(Buf, TagSiteKind::FunctionArg,
+                        Arg->getParent()->getName(), Arg->getArgNo());
+  }
+
+  if (Buf.empty()) {
+    return;
+  }
+
+  // The whole module's records must land in one O_APPEND write so that
+  // parallel compile jobs don't interleave records. Use the file descriptor
+  // directly - a buffered stream may split the buffer across several writes
+  int FD;
+  std::error_code EC =
+      openFileForWrite(ClDBPath, FD, CD_OpenAlways, OpenFlags::OF_Append);
+  if (EC) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "unable to open fuzzalloc tag-site database at " << ClDBPath << ": "
+       << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  if (write(FD, Buf.data(), Buf.size()) != (ssize_t)Buf.size()) {
+    report_fatal_error("unable to write fuzzalloc tag-site database");
+  }
+  close(FD);
+}
+
 void CollectTagSites::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<TargetLibraryInfoWrapperPass>();
 }
 
 bool CollectTagSites::doInitialization(Module &M) {
+  if (ClLogPath.empty() && ClDBPath.empty()) {
+    report_fatal_error("either -fuzzalloc-tag-log or -fuzzalloc-tag-db must "
+                       "be specified");
+  }
+
   this->Mod = &M;
   this->MemFuncs = getMemFunclist();
 
@@ -297,10 +447,62 @@ bool CollectTagSites::runOnModule(Module &M) {
     this->FunctionsToTag.insert(ReallocF);
   }
 
-  for (const auto &F : M.functions()) {
-    if (this->MemFuncs.isIn(F)) {
-      this->FunctionsToTag.insert(&F);
-      NumOfFunctions++;
+  // Match every function against the memory-function list in parallel. The
+  // SpecialCaseList lookup is read-only, so each worker fills its own result
+  // vector and the matches are merged (and counted) serially below
+  if (!ClMemFuncs.empty()) {
+    SmallVector<const Function *, 64> Funcs;
+    for (const auto &F : M.functions()) {
+      Funcs.push_back(&F);
+    }
+
+    ThreadPool Pool(hardware_concurrency());
+    unsigned NumShards = Pool.getThreadCount();
+    std::vector<SmallVector<const Function *, 8>> ShardMatches(NumShards);
+
+    for (unsigned Shard = 0; Shard < NumShards; Shard++) {
+      Pool.async([&, Shard] {
+        for (size_t Idx = Shard; Idx < Funcs.size(); Idx += NumShards) {
+          if (this->MemFuncs.isIn(*Funcs[Idx])) {
+            ShardMatches[Shard].push_back(Funcs[Idx]);
+          }
+        }
+      });
+    }
+    Pool.wait();
+
+    for (const auto &Matches : ShardMatches) {
+      for (auto *F : Matches) {
+        this->FunctionsToTag.insert(F);
+        NumOfFunctions++;
+      }
+    }
+  }
+
+  // Automatically detect allocation wrappers: functions whose returned
+  // pointer is directly derived from a call to a malloc-family function or
+  // to another wrapper. The detection iterates to a fixpoint, so chains like
+  // xmalloc -> pool_alloc are promoted level by level. This covers the
+  // common wrapper shapes without a hand-maintained FUZZALLOC_MEM_FUNCS
+  // list; the list remains available for wrappers the data-flow test cannot
+  // see (e.g. those returning memory through an out-parameter)
+  if (ClAutoMemFuncs) {
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+
+      for (const auto &F : M.functions()) {
+        if (this->FunctionsToTag.count(&F)) {
+          continue;
+        }
+        if (isAllocWrapper(F, this->FunctionsToTag)) {
+          LLVM_DEBUG(dbgs() << "detected allocation wrapper " << F.getName()
+                            << '\n');
+          this->FunctionsToTag.insert(&F);
+          NumOfAllocWrappers++;
+          Changed = true;
+        }
+      }
     }
   }
 
@@ -317,9 +519,14 @@ bool CollectTagSites::runOnModule(Module &M) {
   }
 
   // Save the collected values
-  saveTagSites();
+  if (!ClDBPath.empty()) {
+    saveTagSiteDB();
+  } else {
+    saveTagSites();
+  }
 
   printStatistic(M, NumOfFunctions);
+  printStatistic(M, NumOfAllocWrappers);
   printStatistic(M, NumOfFunctionArgs);
   printStatistic(M, NumOfGlobalVariables);
   printStatistic(M, NumOfGlobalAliases);
@@ -15,12 +15,18 @@
 #include <unordered_set>
 
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueMap.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "WPA/WPAPass.h" // from SVF
@@ -29,6 +35,92 @@ using namespace llvm;
 
 #define DEBUG_TYPE "fuzzalloc-svf-analysis"
 
+static cl::opt<std::string> ClDerefFilterPath(
+    "fuzzalloc-deref-filter",
+    cl::desc("Path to write instrumented dereferences that can never alias "
+             "a tagged allocation site"));
+
+static cl::opt<std::string> ClHeapifyFilterPath(
+    "fuzzalloc-heapify-filter",
+    cl::desc("Path to write heapified allocas whose allocation can never "
+             "flow to an instrumented dereference"));
+
+static cl::opt<std::string> ClAnalysisCachePath(
+    "fuzzalloc-analysis-cache",
+    cl::desc("Path to a binary sidecar file caching the analysis results, "
+             "keyed on per-function content hashes of the bitcode. When "
+             "every hash matches, the (expensive) whole-program pointer "
+             "analysis is skipped entirely"));
+
+/// Magic number identifying (this version of) the analysis cache format
+static const char *const CacheMagic = "FZSVFAC1";
+
+namespace {
+
+/// Bounds-checked reader over the memory-mapped analysis cache
+class CacheReader {
+  const char *Ptr;
+  const char *End;
+
+public:
+  CacheReader(StringRef Buffer) : Ptr(Buffer.begin()), End(Buffer.end()) {}
+
+  bool readU64(uint64_t &V) {
+    if (End - Ptr < (ptrdiff_t)sizeof(V)) {
+      return false;
+    }
+    memcpy(&V, Ptr, sizeof(V));
+    Ptr += sizeof(V);
+    return true;
+  }
+
+  bool readString(StringRef &S) {
+    uint64_t Len;
+    if (!readU64(Len) || (uint64_t)(End - Ptr) < Len) {
+      return false;
+    }
+    S = StringRef(Ptr, Len);
+    Ptr += Len;
+    return true;
+  }
+};
+
+} // anonymous namespace
+
+static void writeU64(raw_ostream &OS, uint64_t V) {
+  OS.write(reinterpret_cast<const char *>(&V), sizeof(V));
+}
+
+static void writeString(raw_ostream &OS, StringRef S) {
+  writeU64(OS, S.size());
+  OS.write(S.data(), S.size());
+}
+
+/// Content hash of a function's IR
+static uint64_t hashFunction(const Function &F) {
+  std::string Text;
+  raw_string_ostream OS(Text);
+  F.print(OS, /* AAW */ nullptr, /* ShouldPreserveUseListOrder */ false,
+          /* IsForDebug */ false);
+  return xxHash64(OS.str());
+}
+
+/// Stable identifier for an instruction across analysis runs: the enclosing
+/// function plus the instruction's debug location. Empty if the instruction
+/// has no debug location
+static std::string instructionKey(const Instruction *I) {
+  DILocation *Loc = I->getDebugLoc();
+  if (!Loc) {
+    return "";
+  }
+
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << I->getFunction()->getName() << ':' << Loc->getFilename() << ':'
+     << Loc->getLine() << ':' << Loc->getColumn();
+  return OS.str();
+}
+
 namespace {
 
 struct FuzzallocAlias {
@@ -48,9 +140,15 @@ private:
   unsigned long NumAllocs;
   unsigned long NumDerefs;
   AliasResults Aliases;
+  ValueSet AliasingDerefs;
+  ValueSet AliasingAllocs;
 
   ValueSet collectTaggedAllocs(Module &M) const;
   ValueSet collectInstrumentedDereferences(Module &M) const;
+  void saveDerefFilter(Module &M) const;
+  void saveHeapifyFilter(Module &M) const;
+  bool loadAnalysisCache(Module &M, const ValueSet &TaggedAllocs);
+  void saveAnalysisCache(Module &M, const ValueSet &TaggedAllocs) const;
 
 public:
   static char ID;
@@ -113,8 +211,197 @@ SVFAnalysis::collectInstrumentedDereferences(Module &M) const {
   return InstrumentedDerefs;
 }
 
+/// Pointer operand of an instrumented memory access
+static const Value *getAccessPointer(const Instruction *I) {
+  if (auto *Load = dyn_cast<LoadInst>(I)) {
+    return Load->getPointerOperand();
+  } else if (auto *Store = dyn_cast<StoreInst>(I)) {
+    return Store->getPointerOperand();
+  } else if (auto *RMW = dyn_cast<AtomicRMWInst>(I)) {
+    return RMW->getPointerOperand();
+  } else if (auto *XCHG = dyn_cast<AtomicCmpXchgInst>(I)) {
+    return XCHG->getPointerOperand();
+  }
+
+  return nullptr;
+}
+
+/// Attempt to reuse a previous run's analysis results. The cache is valid
+/// only if every function definition in the module hashes to the same value
+/// it had when the cache was written: whole-program points-to facts are not
+/// soundly decomposable per function, so any mismatch discards the entire
+/// cache. Returns \c true (with the aliasing sets populated) on a hit
+bool SVFAnalysis::loadAnalysisCache(Module &M, const ValueSet &TaggedAllocs) {
+  auto InputOrErr = MemoryBuffer::getFile(ClAnalysisCachePath);
+  if (InputOrErr.getError()) {
+    // No cache yet
+    return false;
+  }
+
+  CacheReader Reader(InputOrErr.get()->getBuffer());
+
+  StringRef Magic;
+  if (!Reader.readString(Magic) || Magic != CacheMagic) {
+    return false;
+  }
+
+  // Hash every function definition in the module and compare against the
+  // hashes recorded when the cache was written
+  StringMap<uint64_t> Hashes;
+  for (auto &F : M) {
+    if (!F.isDeclaration()) {
+      Hashes[F.getName()] = hashFunction(F);
+    }
+  }
+
+  uint64_t NumFuncs;
+  if (!Reader.readU64(NumFuncs) || NumFuncs != Hashes.size()) {
+    return false;
+  }
+  for (uint64_t I = 0; I < NumFuncs; I++) {
+    StringRef Name;
+    uint64_t Hash;
+    if (!Reader.readString(Name) || !Reader.readU64(Hash)) {
+      return false;
+    }
+    auto It = Hashes.find(Name);
+    if (It == Hashes.end() || It->second != Hash) {
+      return false;
+    }
+  }
+
+  StringSet<> DerefKeys;
+  StringSet<> AllocKeys;
+
+  uint64_t NumKeys;
+  if (!Reader.readU64(NumKeys)) {
+    return false;
+  }
+  for (uint64_t I = 0; I < NumKeys; I++) {
+    StringRef Key;
+    if (!Reader.readString(Key)) {
+      return false;
+    }
+    DerefKeys.insert(Key);
+  }
+
+  if (!Reader.readU64(NumKeys)) {
+    return false;
+  }
+  for (uint64_t I = 0; I < NumKeys; I++) {
+    StringRef Key;
+    if (!Reader.readString(Key)) {
+      return false;
+    }
+    AllocKeys.insert(Key);
+  }
+
+  // Map the cached keys back onto this run's values
+  for (auto &F : M) {
+    for (auto I = inst_begin(F); I != inst_end(F); ++I) {
+      if (!I->getMetadata(M.getMDKindID("fuzzalloc.instrumented_deref"))) {
+        continue;
+      }
+
+      const Value *Ptr = getAccessPointer(&*I);
+      if (Ptr && DerefKeys.count(instructionKey(&*I))) {
+        this->AliasingDerefs.insert(Ptr);
+      }
+    }
+  }
+
+  for (auto *Alloc : TaggedAllocs) {
+    if (AllocKeys.count(instructionKey(cast<Instruction>(Alloc)))) {
+      this->AliasingAllocs.insert(Alloc);
+    }
+  }
+
+  return true;
+}
+
+void SVFAnalysis::saveAnalysisCache(Module &M,
+                                    const ValueSet &TaggedAllocs) const {
+  // Collect the keys first: an aliasing access or allocation without a debug
+  // location cannot be re-identified on a later run, and a partial cache
+  // would silently drop instrumentation - better to write no cache at all
+  std::vector<std::string> DerefKeys;
+  std::vector<std::string> AllocKeys;
+
+  for (auto &F : M) {
+    for (auto I = inst_begin(F); I != inst_end(F); ++I) {
+      if (!I->getMetadata(M.getMDKindID("fuzzalloc.instrumented_deref"))) {
+        continue;
+      }
+
+      const Value *Ptr = getAccessPointer(&*I);
+      if (!Ptr || !this->AliasingDerefs.count(Ptr)) {
+        continue;
+      }
+
+      auto Key = instructionKey(&*I);
+      if (Key.empty()) {
+        errs() << "warning: not writing fuzzalloc analysis cache: aliasing "
+                  "access without a debug location in "
+               << F.getName() << '\n';
+        return;
+      }
+      DerefKeys.push_back(Key);
+    }
+  }
+
+  for (auto *Alloc : TaggedAllocs) {
+    if (!this->AliasingAllocs.count(Alloc)) {
+      continue;
+    }
+
+    auto Key = instructionKey(cast<Instruction>(Alloc));
+    if (Key.empty()) {
+      errs() << "warning: not writing fuzzalloc analysis cache: aliasing "
+                "allocation without a debug location\n";
+      return;
+    }
+    AllocKeys.push_back(Key);
+  }
+
+  std::error_code EC;
+  raw_fd_ostream Output(ClAnalysisCachePath, EC, sys::fs::OpenFlags::OF_None);
+  if (EC) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "unable to open fuzzalloc analysis cache at " << ClAnalysisCachePath
+       << ": " << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  writeString(Output, CacheMagic);
+
+  uint64_t NumFuncs = 0;
+  for (auto &F : M) {
+    if (!F.isDeclaration()) {
+      NumFuncs++;
+    }
+  }
+  writeU64(Output, NumFuncs);
+  for (auto &F : M) {
+    if (!F.isDeclaration()) {
+      writeString(Output, F.getName());
+      writeU64(Output, hashFunction(F));
+    }
+  }
+
+  writeU64(Output, DerefKeys.size());
+  for (auto &Key : DerefKeys) {
+    writeString(Output, Key);
+  }
+
+  writeU64(Output, AllocKeys.size());
+  for (auto &Key : AllocKeys) {
+    writeString(Output, Key);
+  }
+}
+
 void SVFAnalysis::getAnalysisUsage(AnalysisUsage &AU) const {
-  AU.addRequired<WPAPass>();
   AU.setPreservesAll();
 }
 
@@ -158,6 +445,115 @@ void SVFAnalysis::print(raw_ostream &O, const Module *M) const {
   }
 }
 
+/// Write the dereferences that alias nothing in the tagged allocation set to
+/// the filter file, keyed on their debug location. The second build phase
+/// (`InstrumentMemAccesses`) consumes this file and skips instrumenting them:
+/// they can only ever see the default tag, so no def-use coverage is lost
+void SVFAnalysis::saveDerefFilter(Module &M) const {
+  std::error_code EC;
+  raw_fd_ostream Output(ClDerefFilterPath, EC, sys::fs::OpenFlags::OF_Text);
+  if (EC) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "unable to open fuzzalloc dereference filter at "
+       << ClDerefFilterPath << ": " << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  Output << "# " << M.getName() << '\n';
+
+  for (auto &F : M) {
+    for (auto I = inst_begin(F); I != inst_end(F); ++I) {
+      if (!I->getMetadata(M.getMDKindID("fuzzalloc.instrumented_deref"))) {
+        continue;
+      }
+
+      const Value *Ptr = nullptr;
+      if (auto *Load = dyn_cast<LoadInst>(&*I)) {
+        Ptr = Load->getPointerOperand();
+      } else if (auto *Store = dyn_cast<StoreInst>(&*I)) {
+        Ptr = Store->getPointerOperand();
+      } else if (auto *RMW = dyn_cast<AtomicRMWInst>(&*I)) {
+        Ptr = RMW->getPointerOperand();
+      } else if (auto *XCHG = dyn_cast<AtomicCmpXchgInst>(&*I)) {
+        Ptr = XCHG->getPointerOperand();
+      }
+      if (!Ptr || this->AliasingDerefs.count(Ptr)) {
+        continue;
+      }
+
+      // Without a debug location there is no stable way to identify the
+      // access in the second build phase - leave it instrumented
+      DILocation *Loc = I->getDebugLoc();
+      if (!Loc) {
+        continue;
+      }
+
+      Output << F.getName() << ':' << Loc->getFilename() << ':'
+             << Loc->getLine() << ':' << Loc->getColumn() << '\n';
+    }
+  }
+}
+
+/// Write the heapified allocas whose allocation aliases nothing in the
+/// instrumented dereference set to the filter file, keyed on the enclosing
+/// function and the alloca's name. The second build phase (`HeapifyAllocas`)
+/// consumes this file and leaves them on the real stack: no instrumented
+/// access can ever observe them, so the malloc/free round trip (and the
+/// mspace page touches) buys no def-use coverage
+void SVFAnalysis::saveHeapifyFilter(Module &M) const {
+  std::error_code EC;
+  raw_fd_ostream Output(ClHeapifyFilterPath, EC, sys::fs::OpenFlags::OF_Text);
+  if (EC) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "unable to open fuzzalloc heapify filter at " << ClHeapifyFilterPath
+       << ": " << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  Output << "# " << M.getName() << '\n';
+
+  for (auto &F : M) {
+    for (auto I = inst_begin(F); I != inst_end(F); ++I) {
+      auto *Alloca = dyn_cast<AllocaInst>(&*I);
+      if (!Alloca ||
+          !Alloca->getMetadata(M.getMDKindID("fuzzalloc.heapified_alloca"))) {
+        continue;
+      }
+
+      // An unnamed alloca cannot be identified in the second build phase -
+      // leave it heapified
+      if (!Alloca->hasName()) {
+        continue;
+      }
+
+      // Find the tagged allocation(s) stored into the heapified alloca. If
+      // any of them aliases an instrumented dereference, the heapification
+      // is earning its keep
+      bool Aliases = false;
+      for (auto *U : Alloca->users()) {
+        auto *Store = dyn_cast<StoreInst>(U);
+        if (!Store || Store->getPointerOperand() != Alloca) {
+          continue;
+        }
+
+        auto *StoredValue = Store->getValueOperand()->stripPointerCasts();
+        if (this->AliasingAllocs.count(StoredValue)) {
+          Aliases = true;
+          break;
+        }
+      }
+
+      if (!Aliases) {
+        Output << F.getName() << ':' << Alloca->getName() << '\n';
+      }
+    }
+  }
+}
+
 bool SVFAnalysis::runOnModule(Module &M) {
   auto TaggedAllocs = collectTaggedAllocs(M);
   auto InstrumentedDerefs = collectInstrumentedDereferences(M);
@@ -165,16 +561,41 @@ bool SVFAnalysis::runOnModule(Module &M) {
   this->NumAllocs = TaggedAllocs.size();
   this->NumDerefs = InstrumentedDerefs.size();
 
-  auto &WPAAnalysis = getAnalysis<WPAPass>();
-
-  for (auto TaggedAlloc : TaggedAllocs) {
-    for (auto InstrumentedDeref : InstrumentedDerefs) {
-      AliasResult Res = WPAAnalysis.alias(TaggedAlloc, InstrumentedDeref);
-      if (Res) {
-        this->Aliases.emplace(
-            new FuzzallocAlias(TaggedAlloc, InstrumentedDeref, Res));
+  // With a valid cache the aliasing sets (and hence the filter files) are
+  // reconstructed without running the pointer analysis at all. Note that
+  // the individual alias pairs are not cached, so `print` has nothing to
+  // report on a cache hit
+  bool CacheHit =
+      !ClAnalysisCachePath.empty() && loadAnalysisCache(M, TaggedAllocs);
+
+  if (!CacheHit) {
+    // The expensive part: SVF's whole-program pointer analysis
+    WPAPass WPAAnalysis;
+    WPAAnalysis.runOnModule(M);
+
+    for (auto TaggedAlloc : TaggedAllocs) {
+      for (auto InstrumentedDeref : InstrumentedDerefs) {
+        AliasResult Res = WPAAnalysis.alias(TaggedAlloc, InstrumentedDeref);
+        if (Res) {
+          this->Aliases.emplace(
+              new FuzzallocAlias(TaggedAlloc, InstrumentedDeref, Res));
+          this->AliasingDerefs.insert(InstrumentedDeref);
+          this->AliasingAllocs.insert(TaggedAlloc);
+        }
       }
     }
+
+    if (!ClAnalysisCachePath.empty()) {
+      saveAnalysisCache(M, TaggedAllocs);
+    }
+  }
+
+  if (!ClDerefFilterPath.empty()) {
+    saveDerefFilter(M);
+  }
+
+  if (!ClHeapifyFilterPath.empty()) {
+    saveHeapifyFilter(M);
   }
 
   return false;
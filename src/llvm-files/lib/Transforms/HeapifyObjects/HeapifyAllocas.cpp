@@ -13,8 +13,10 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
@@ -24,6 +26,8 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "HeapifyUtils.h"
@@ -38,13 +42,34 @@ static cl::opt<int> ClMinArraySize(
     cl::desc("The minimum size of a static alloca array to heapify to malloc"),
     cl::init(1));
 
+static cl::opt<bool> ClCacheAllocas(
+    "fuzzalloc-cache-allocas",
+    cl::desc("Heapify allocas to the per-site caching allocator "
+             "(__cached_alloc), which reuses the allocation across calls "
+             "instead of malloc/free-ing it on every entry/exit"),
+    cl::init(false));
+
+static cl::opt<bool> ClStackAllocRuntime(
+    "fuzzalloc-stack-alloc",
+    cl::desc("Heapify allocas to the frame-scoped bump allocator "
+             "(__stack_alloc) instead of malloc"),
+    cl::init(false));
+
 static cl::opt<bool> ClHeapifyStructs(
     "fuzzalloc-heapify-structs",
     cl::desc("Heapify alloca structs that have their address taken"),
     cl::init(false), cl::Hidden);
 
+static cl::opt<std::string> ClHeapifyFilterPath(
+    "fuzzalloc-heapify-filter",
+    cl::desc("Path to a file (produced by the SVF analysis) listing allocas "
+             "whose allocation can never flow to an instrumented dereference. "
+             "These allocas are left on the stack"));
+
 STATISTIC(NumOfAllocaHeapification, "Number of alloca heapifications.");
 STATISTIC(NumOfFreeInsert, "Number of calls to free inserted.");
+STATISTIC(NumOfFilteredAllocas,
+          "Number of allocas not heapified due to the heapify filter.");
 
 namespace {
 
@@ -56,13 +81,19 @@ private:
   DataLayout *DL;
   DIBuilder *DBuilder;
 
-  Instruction *insertMalloc(const AllocaInst *, AllocaInst *,
-                            Instruction *) const;
+  /// `function:alloca` keys of allocas that the whole-program pointer
+  /// analysis proved can never flow to an instrumented dereference
+  StringSet<> HeapifyFilter;
+
+  /// Cache slots for the per-site caching allocator, keyed on the heapified
+  /// (i.e., new) alloca
+  DenseMap<const AllocaInst *, GlobalVariable *> AllocaCacheSlots;
+
+  Instruction *insertMalloc(const AllocaInst *, AllocaInst *, Instruction *);
 
   void copyDebugInfo(const AllocaInst *, AllocaInst *) const;
 
-  AllocaInst *heapifyAlloca(AllocaInst *,
-                            const ArrayRef<IntrinsicInst *> &) const;
+  AllocaInst *heapifyAlloca(AllocaInst *, const ArrayRef<IntrinsicInst *> &);
 
 public:
   static char ID;
@@ -127,7 +158,7 @@ static bool isHeapifiableAlloca(AllocaInst *Alloca) {
 /// the `malloc` call is stored in `NewAlloca`.
 Instruction *HeapifyAllocas::insertMalloc(const AllocaInst *OrigAlloca,
                                           AllocaInst *NewAlloca,
-                                          Instruction *InsertPt) const {
+                                          Instruction *InsertPt) {
   const Module *M = OrigAlloca->getModule();
   LLVMContext &C = M->getContext();
   Type *AllocatedTy = OrigAlloca->getAllocatedType();
@@ -135,17 +166,50 @@ Instruction *HeapifyAllocas::insertMalloc(const AllocaInst *OrigAlloca,
 
   IRBuilder<> IRB(InsertPt);
 
+  GlobalVariable *CacheSlot = nullptr;
+  if (ClCacheAllocas) {
+    // One cache slot per site, shared between the allocation and release
+    // calls (and between multiple lifetime.start intrinsics)
+    auto It = this->AllocaCacheSlots.find(NewAlloca);
+    if (It != this->AllocaCacheSlots.end()) {
+      CacheSlot = It->second;
+    } else {
+      CacheSlot = createAllocCacheSlot(
+          *NewAlloca->getModule(), *this->DL,
+          "fuzzalloc.alloc_cache." + NewAlloca->getName());
+      this->AllocaCacheSlots.insert({NewAlloca, CacheSlot});
+    }
+  }
+
   if (auto *ArrayTy = dyn_cast<ArrayType>(AllocatedTy)) {
     // Insert array malloc call
     Type *ElemTy = ArrayTy->getArrayElementType();
     uint64_t ArrayNumElems = ArrayTy->getNumElements();
 
-    MallocCall = createArrayMalloc(C, *this->DL, IRB, ElemTy, ArrayNumElems,
-                                   NewAlloca->getName() + "_malloccall");
+    if (ClCacheAllocas) {
+      MallocCall =
+          createCachedAlloc(C, *this->DL, IRB, ElemTy, ArrayNumElems,
+                            CacheSlot, NewAlloca->getName() + "_cachedalloc");
+    } else if (ClStackAllocRuntime) {
+      MallocCall = createStackAlloc(C, *this->DL, IRB, ElemTy, ArrayNumElems,
+                                    NewAlloca->getName() + "_stackalloc");
+    } else {
+      MallocCall = createArrayMalloc(C, *this->DL, IRB, ElemTy, ArrayNumElems,
+                                     NewAlloca->getName() + "_malloccall");
+    }
   } else {
     // Insert non-array malloc call
-    MallocCall = createMalloc(C, *this->DL, IRB, AllocatedTy,
-                              NewAlloca->getName() + "_malloccall");
+    if (ClCacheAllocas) {
+      MallocCall =
+          createCachedAlloc(C, *this->DL, IRB, AllocatedTy, 1, CacheSlot,
+                            NewAlloca->getName() + "_cachedalloc");
+    } else if (ClStackAllocRuntime) {
+      MallocCall = createStackAlloc(C, *this->DL, IRB, AllocatedTy, 1,
+                                    NewAlloca->getName() + "_stackalloc");
+    } else {
+      MallocCall = createMalloc(C, *this->DL, IRB, AllocatedTy,
+                                NewAlloca->getName() + "_malloccall");
+    }
   }
 
   assert(MallocCall && "malloc call should have been created");
@@ -173,7 +237,7 @@ void HeapifyAllocas::copyDebugInfo(const AllocaInst *OrigAlloca,
 }
 
 AllocaInst *HeapifyAllocas::heapifyAlloca(
-    AllocaInst *Alloca, const ArrayRef<IntrinsicInst *> &LifetimeStarts) const {
+    AllocaInst *Alloca, const ArrayRef<IntrinsicInst *> &LifetimeStarts) {
   LLVM_DEBUG(dbgs() << "heapifying " << *Alloca << " in function "
                     << Alloca->getFunction()->getName() << "\n");
 
@@ -297,6 +361,27 @@ bool HeapifyAllocas::doFinalization(Module &) {
 }
 
 bool HeapifyAllocas::runOnModule(Module &M) {
+  if (!ClHeapifyFilterPath.empty()) {
+    auto InputOrErr = MemoryBuffer::getFile(ClHeapifyFilterPath);
+    if (auto EC = InputOrErr.getError()) {
+      std::string Err;
+      raw_string_ostream OS(Err);
+      OS << "unable to open fuzzalloc heapify filter at "
+         << ClHeapifyFilterPath << ": " << EC.message();
+      OS.flush();
+      report_fatal_error(Err);
+    }
+
+    SmallVector<StringRef, 64> Lines;
+    InputOrErr.get()->getBuffer().split(Lines, '\n', /* MaxSplit */ -1,
+                                        /* KeepEmpty */ false);
+    for (auto Line : Lines) {
+      if (!Line.startswith("#")) {
+        this->HeapifyFilter.insert(Line);
+      }
+    }
+  }
+
   // Static array allocations to heapify
   SmallVector<AllocaInst *, 8> AllocasToHeapify;
 
@@ -323,6 +408,16 @@ bool HeapifyAllocas::runOnModule(Module &M) {
       // Collect heapifaible allocas
       if (auto *Alloca = dyn_cast<AllocaInst>(&*I)) {
         if (isHeapifiableAlloca(Alloca)) {
+          // Skip allocas that the whole-program pointer analysis proved can
+          // never flow to an instrumented dereference: heapifying them costs
+          // a malloc/free pair per call and buys no def-use coverage
+          if (!this->HeapifyFilter.empty() && Alloca->hasName() &&
+              this->HeapifyFilter.count(
+                  (F.getName() + ":" + Alloca->getName()).str())) {
+            NumOfFilteredAllocas++;
+            continue;
+          }
+
           AllocasToHeapify.push_back(Alloca);
         }
         // Lifetime start/end intrinsics are required for placing mallocs/frees
@@ -354,7 +449,16 @@ bool HeapifyAllocas::runOnModule(Module &M) {
         // If no lifetime.end intrinsics were found, just free the allocation
         // when the function returns
         for (auto *Return : Returns) {
-          insertFree(NewAlloca->getAllocatedType(), NewAlloca, Return);
+          if (ClCacheAllocas) {
+            insertCachedRelease(NewAlloca->getAllocatedType(), NewAlloca,
+                                this->AllocaCacheSlots.lookup(NewAlloca),
+                                Return);
+          } else if (ClStackAllocRuntime) {
+            insertStackRestore(NewAlloca->getAllocatedType(), NewAlloca,
+                               Return);
+          } else {
+            insertFree(NewAlloca->getAllocatedType(), NewAlloca, Return);
+          }
           NumOfFreeInsert++;
         }
       } else {
@@ -362,7 +466,17 @@ bool HeapifyAllocas::runOnModule(Module &M) {
         for (auto *LifetimeEnd : LifetimeEnds) {
           if (GetUnderlyingObjectThroughLoads(LifetimeEnd->getOperand(1),
                                               *this->DL) == NewAlloca) {
-            insertFree(NewAlloca->getAllocatedType(), NewAlloca, LifetimeEnd);
+            if (ClCacheAllocas) {
+              insertCachedRelease(NewAlloca->getAllocatedType(), NewAlloca,
+                                  this->AllocaCacheSlots.lookup(NewAlloca),
+                                  LifetimeEnd);
+            } else if (ClStackAllocRuntime) {
+              insertStackRestore(NewAlloca->getAllocatedType(), NewAlloca,
+                                 LifetimeEnd);
+            } else {
+              insertFree(NewAlloca->getAllocatedType(), NewAlloca,
+                         LifetimeEnd);
+            }
             NumOfFreeInsert++;
           }
         }
@@ -374,6 +488,7 @@ bool HeapifyAllocas::runOnModule(Module &M) {
 
   printStatistic(M, NumOfAllocaHeapification);
   printStatistic(M, NumOfFreeInsert);
+  printStatistic(M, NumOfFilteredAllocas);
 
   return NumOfAllocaHeapification > 0;
 }
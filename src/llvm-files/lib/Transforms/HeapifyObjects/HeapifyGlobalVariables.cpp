@@ -13,8 +13,10 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -49,6 +51,15 @@ namespace {
 /// \p malloc.
 class HeapifyGlobalVariables : public ModulePass {
 private:
+  /// A single read-only image packing the static initializers of every
+  /// heapified global variable in the module, and each global's byte offset
+  /// into it. The heapify constructors bulk-copy their slice of the image
+  /// instead of replaying the initializer store-by-store
+  GlobalVariable *InitImage = nullptr;
+  DenseMap<const GlobalVariable *, uint64_t> InitImageOffsets;
+
+  void createInitializerImage(Module &,
+                              const SmallPtrSetImpl<GlobalVariable *> &);
   void initializeHeapifiedGlobalVariable(const GlobalVariable *,
                                          GlobalVariable *);
   void expandConstantExpression(ConstantExpr *);
@@ -175,6 +186,49 @@ static void createHeapifyDtor(GlobalVariable *GV, IRBuilder<> &IRB) {
   }
 }
 
+/// Pack the static initializers of the global variables that are about to be
+/// heapified into a single read-only image.
+///
+/// Only constant data array initializers are packed: zeroinitializers become a
+/// \p memset, and constant arrays (which may reference other globals) are
+/// expanded by the ExpandGVInitializers pass.
+void HeapifyGlobalVariables::createInitializerImage(
+    Module &M, const SmallPtrSetImpl<GlobalVariable *> &GVsToHeapify) {
+  const DataLayout &DL = M.getDataLayout();
+
+  SmallVector<GlobalVariable *, 8> ImageGVs;
+  SmallVector<Constant *, 8> ImageInits;
+
+  for (auto *GV : GVsToHeapify) {
+    if (!GV->hasInitializer()) {
+      continue;
+    }
+
+    if (auto *Initializer = dyn_cast<ConstantDataArray>(GV->getInitializer())) {
+      ImageGVs.push_back(GV);
+      ImageInits.push_back(Initializer);
+    }
+  }
+
+  if (ImageGVs.empty()) {
+    return;
+  }
+
+  // An unpacked struct, so each initializer keeps its natural alignment and
+  // the struct layout gives us the byte offsets
+  auto *ImageInit = ConstantStruct::getAnon(ImageInits);
+  this->InitImage = new GlobalVariable(
+      M, ImageInit->getType(), /* isConstant */ true,
+      GlobalValue::PrivateLinkage, ImageInit, "fuzzalloc.init_image");
+  this->InitImage->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  const StructLayout *SL =
+      DL.getStructLayout(cast<StructType>(ImageInit->getType()));
+  for (unsigned I = 0; I < ImageGVs.size(); ++I) {
+    this->InitImageOffsets.insert({ImageGVs[I], SL->getElementOffset(I)});
+  }
+}
+
 /// Initialize the heapified global variable in the given constructor function.
 ///
 /// The initialization is based off the original global variable's static
@@ -219,17 +273,26 @@ void HeapifyGlobalVariables::initializeHeapifiedGlobalVariable(
                        MaybeAlign(NewGV->getAlignment()));
     } else if (auto *Initializer =
                    dyn_cast<ConstantDataArray>(OrigGV->getInitializer())) {
-      // If the initializer is a constant data array, we store the data into the
-      // dynamically allocated array element-by-element. Hopefully the optimizer
-      // can improve this code
-      for (unsigned I = 0; I < Initializer->getNumElements(); ++I) {
-        auto *StoreToNewGV = IRB.CreateStore(
-            Initializer->getElementAsConstant(I),
-            IRB.CreateConstInBoundsGEP1_32(nullptr, MallocCall, I));
-        StoreToNewGV->setMetadata(M->getMDKindID("fuzzalloc.noinstrument"),
-                                  MDNode::get(C, None));
-        setNoSanitizeMetadata(StoreToNewGV);
-      }
+      // If the initializer is a constant data array, bulk-copy its slice of
+      // the packed read-only initializer image into the dynamically allocated
+      // array. One memcpy is much cheaper at startup (and in every forked
+      // child) than replaying the initializer store-by-store
+      assert(this->InitImage && "Initializer image should have been created");
+      auto OffsetIt = this->InitImageOffsets.find(OrigGV);
+      assert(OffsetIt != this->InitImageOffsets.end() &&
+             "Heapified global variable not in the initializer image");
+
+      auto *ImageBytes =
+          IRB.CreateBitCast(this->InitImage, IRB.getInt8PtrTy());
+      auto *ImageSlice = IRB.CreateConstInBoundsGEP1_64(
+          IRB.getInt8Ty(), ImageBytes, OffsetIt->second);
+
+      auto *MemCpy = IRB.CreateMemCpy(
+          MallocCall, MaybeAlign(NewGV->getAlignment()), ImageSlice,
+          MaybeAlign(), DL.getTypeAllocSize(Initializer->getType()));
+      MemCpy->setMetadata(M->getMDKindID("fuzzalloc.noinstrument"),
+                          MDNode::get(C, None));
+      setNoSanitizeMetadata(MemCpy);
     } else if (isa<ConstantArray>(OrigGV->getInitializer())) {
       assert(false && "Constant array initializers should already be expanded");
     } else {
@@ -420,6 +483,8 @@ bool HeapifyGlobalVariables::runOnModule(Module &M) {
   // Heapify non-constant global static arrays in a module constructor and free
   // them in a destructor
   if (!GVsToHeapify.empty()) {
+    createInitializerImage(M, GVsToHeapify);
+
     for (auto *GV : GVsToHeapify) {
       auto *HeapifiedGV = heapifyGlobalVariable(GV);
       HeapifiedGVs.insert(HeapifiedGV);
@@ -15,6 +15,7 @@
 #include <cxxabi.h>
 
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
 
 #include "HeapifyUtils.h"
 
@@ -102,3 +103,88 @@ void insertFree(Type *MallocPtrTy, Value *MallocPtr, Instruction *Inst) {
   auto *LoadMalloc = new LoadInst(MallocPtrTy, MallocPtr, "", Inst);
   CallInst::CreateFree(LoadMalloc, Inst);
 }
+
+Instruction *createStackAlloc(LLVMContext &C, const DataLayout &DL,
+                              IRBuilder<> &IRB, Type *AllocTy,
+                              uint64_t ArrayNumElems, const Twine &Name) {
+  Module *M = IRB.GetInsertBlock()->getModule();
+  IntegerType *IntPtrTy = DL.getIntPtrType(C);
+  uint64_t AllocSize = DL.getTypeAllocSize(AllocTy) * ArrayNumElems;
+
+  auto StackAllocF = M->getOrInsertFunction(StackAllocFuncName,
+                                            Type::getInt8PtrTy(C), IntPtrTy);
+
+  auto *StackAllocCall =
+      IRB.CreateCall(StackAllocF, ConstantInt::get(IntPtrTy, AllocSize));
+
+  return cast<Instruction>(
+      IRB.CreateBitCast(StackAllocCall, AllocTy->getPointerTo(), Name));
+}
+
+GlobalVariable *createAllocCacheSlot(Module &M, const DataLayout &DL,
+                                     const Twine &Name) {
+  LLVMContext &C = M.getContext();
+
+  // Must match `struct alloc_cache` in the runtime (cache_alloc.c)
+  auto *SlotTy = StructType::get(Type::getInt8PtrTy(C), DL.getIntPtrType(C),
+                                 DL.getIntPtrType(C));
+
+  return new GlobalVariable(M, SlotTy, /* isConstant */ false,
+                            GlobalValue::InternalLinkage,
+                            Constant::getNullValue(SlotTy), Name);
+}
+
+Instruction *createCachedAlloc(LLVMContext &C, const DataLayout &DL,
+                               IRBuilder<> &IRB, Type *AllocTy,
+                               uint64_t ArrayNumElems,
+                               GlobalVariable *CacheSlot, const Twine &Name) {
+  Module *M = IRB.GetInsertBlock()->getModule();
+  IntegerType *IntPtrTy = DL.getIntPtrType(C);
+  PointerType *Int8PtrTy = Type::getInt8PtrTy(C);
+  uint64_t AllocSize = DL.getTypeAllocSize(AllocTy) * ArrayNumElems;
+
+  auto CachedAllocF = M->getOrInsertFunction(CachedAllocFuncName, Int8PtrTy,
+                                             IntPtrTy, Int8PtrTy);
+
+  auto *CachedAllocCall = IRB.CreateCall(
+      CachedAllocF, {ConstantInt::get(IntPtrTy, AllocSize),
+                     ConstantExpr::getBitCast(CacheSlot, Int8PtrTy)});
+
+  return cast<Instruction>(
+      IRB.CreateBitCast(CachedAllocCall, AllocTy->getPointerTo(), Name));
+}
+
+void insertCachedRelease(Type *MallocPtrTy, Value *MallocPtr,
+                         GlobalVariable *CacheSlot, Instruction *Inst) {
+  Module *M = Inst->getModule();
+  LLVMContext &C = M->getContext();
+  PointerType *Int8PtrTy = Type::getInt8PtrTy(C);
+
+  auto CachedReleaseF = M->getOrInsertFunction(
+      CachedReleaseFuncName, Type::getVoidTy(C), Int8PtrTy, Int8PtrTy);
+
+  // Load the pointer to the dynamically allocated memory and pass it (and its
+  // cache slot) to the release function
+  auto *LoadMalloc = new LoadInst(MallocPtrTy, MallocPtr, "", Inst);
+  auto *CastMalloc =
+      CastInst::CreatePointerCast(LoadMalloc, Int8PtrTy, "", Inst);
+  CallInst::Create(CachedReleaseF,
+                   {CastMalloc, ConstantExpr::getBitCast(CacheSlot, Int8PtrTy)},
+                   "", Inst);
+}
+
+void insertStackRestore(Type *MallocPtrTy, Value *MallocPtr,
+                        Instruction *Inst) {
+  Module *M = Inst->getModule();
+  LLVMContext &C = M->getContext();
+
+  auto StackRestoreF = M->getOrInsertFunction(
+      StackRestoreFuncName, Type::getVoidTy(C), Type::getInt8PtrTy(C));
+
+  // Load the pointer to the dynamically allocated memory and pass it to the
+  // stack restore function (which pops the bump region back to it)
+  auto *LoadMalloc = new LoadInst(MallocPtrTy, MallocPtr, "", Inst);
+  auto *CastMalloc = CastInst::CreatePointerCast(
+      LoadMalloc, Type::getInt8PtrTy(C), "", Inst);
+  CallInst::Create(StackRestoreF, CastMalloc, "", Inst);
+}
@@ -15,13 +15,17 @@
 #ifndef FUZZALLOC_HEAPIFY_UTILS_H
 #define FUZZALLOC_HEAPIFY_UTILS_H
 
+#include <string>
+
 #include "llvm/IR/IRBuilder.h"
 
 namespace llvm {
 class DataLayout;
 class GetElementPtrInst;
+class GlobalVariable;
 class Instruction;
 class LLVMContext;
+class Module;
 class StructType;
 class Type;
 class Twine;
@@ -31,6 +35,21 @@ class Value;
 /// Priority for heapified global variable constructor
 const unsigned kHeapifyGVCtorAndDtorPriority = 0;
 
+/// Name of the frame-scoped bump allocator entry point. Calls to this function
+/// are rewritten to the tagged version by the TagDynamicAllocs pass
+const std::string StackAllocFuncName = "__stack_alloc";
+
+/// Name of the frame-scoped bump allocator release function. It derives the
+/// def site tag from the pointer, so it needs no tag rewriting
+const std::string StackRestoreFuncName = "__tagged_stack_restore";
+
+/// Name of the per-site caching allocator entry point. Calls to this function
+/// are rewritten to the tagged version by the TagDynamicAllocs pass
+const std::string CachedAllocFuncName = "__cached_alloc";
+
+/// Name of the per-site caching allocator release function
+const std::string CachedReleaseFuncName = "__cached_release";
+
 /// Update a GEP instruction to use the given value
 llvm::Value *updateGEP(llvm::GetElementPtrInst *, llvm::Value *, llvm::Type *);
 
@@ -56,4 +75,36 @@ llvm::Instruction *createMalloc(llvm::LLVMContext &, const llvm::DataLayout &,
 /// Insert a call to \c free for the given alloca (with the given type)
 void insertFree(llvm::Type *, llvm::Value *, llvm::Instruction *);
 
+/// Create a call to the frame-scoped bump allocator (\c __stack_alloc) that
+/// will create an array on the heap. `ArrayNumElems` is \c 1 for non-array
+/// allocations
+llvm::Instruction *createStackAlloc(llvm::LLVMContext &,
+                                    const llvm::DataLayout &,
+                                    llvm::IRBuilder<> &, llvm::Type *, uint64_t,
+                                    const llvm::Twine & = "");
+
+/// Insert a call to \c __tagged_stack_restore for the given alloca (with the
+/// given type)
+void insertStackRestore(llvm::Type *, llvm::Value *, llvm::Instruction *);
+
+/// Create the per-allocation-site cache slot global used by the caching
+/// allocator (matching `struct alloc_cache` in the runtime)
+llvm::GlobalVariable *createAllocCacheSlot(llvm::Module &,
+                                           const llvm::DataLayout &,
+                                           const llvm::Twine &);
+
+/// Create a call to the per-site caching allocator (\c __cached_alloc) that
+/// will create an array on the heap. `ArrayNumElems` is \c 1 for non-array
+/// allocations
+llvm::Instruction *createCachedAlloc(llvm::LLVMContext &,
+                                     const llvm::DataLayout &,
+                                     llvm::IRBuilder<> &, llvm::Type *,
+                                     uint64_t, llvm::GlobalVariable *,
+                                     const llvm::Twine & = "");
+
+/// Insert a call to \c __cached_release for the given alloca (with the given
+/// type) and its cache slot
+void insertCachedRelease(llvm::Type *, llvm::Value *, llvm::GlobalVariable *,
+                         llvm::Instruction *);
+
 #endif // FUZZALLOC_HEAPIFY_UTILS_H
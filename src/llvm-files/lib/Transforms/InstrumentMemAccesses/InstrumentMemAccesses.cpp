@@ -15,19 +15,31 @@
 
 #include <set>
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/Utils/Local.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Utils/PromoteMemToReg.h"
 
@@ -47,6 +59,8 @@ enum Sensitivity {
   MemReadOffset,
   MemWriteOffset,
   MemAccessOffset,
+
+  MemAccessSampled,
 };
 
 enum Fuzzer {
@@ -69,9 +83,79 @@ static cl::opt<Sensitivity> ClSensitivity(
         clEnumValN(Sensitivity::MemWriteOffset, "mem-write-offset",
                    "Instrument write instructions with offset"),
         clEnumValN(Sensitivity::MemAccessOffset, "mem-access-offset",
-                   "Instrument read and write instructions with offset")),
+                   "Instrument read and write instructions with offset"),
+        clEnumValN(Sensitivity::MemAccessSampled, "mem-access-sampled",
+                   "Instrument read and write instructions, sampling each "
+                   "site every Nth execution")),
     cl::init(MemAccess));
 
+static cl::opt<bool> ClBranchlessDefSite(
+    "fuzzalloc-branchless-def-site",
+    cl::desc("Extract def site tags with just a shift and mask, without "
+             "clamping out-of-range tags to the default tag"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<std::string> ClDerefFilterPath(
+    "fuzzalloc-deref-filter",
+    cl::desc("Path to the dereference filter produced by dataflow-wpa. "
+             "Listed accesses can never alias a tagged allocation site and "
+             "are not instrumented"));
+
+static cl::opt<unsigned> ClSampleInterval(
+    "fuzzalloc-sample-interval",
+    cl::desc("Sampling interval (a power of two) for the mem-access-sampled "
+             "sensitivity: each site fires its map update every Nth "
+             "execution"),
+    cl::init(16), cl::Hidden);
+
+static cl::opt<bool> ClElideRedundantAccesses(
+    "fuzzalloc-elide-redundant-accesses",
+    cl::desc("Elide instrumentation on accesses covered by a dominating "
+             "access to the same pointer in the same loop"),
+    cl::init(true), cl::Hidden);
+
+static cl::opt<bool> ClUseDataFlowMap(
+    "fuzzalloc-dataflow-map",
+    cl::desc("Record def-use features in a dedicated shared-memory map "
+             "(__dataflow_area_ptr) instead of AFL's edge map"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> ClDataFlowMapSize(
+    "fuzzalloc-dataflow-map-size",
+    cl::desc("Size (in bytes, a power of two) of the dataflow map. Must "
+             "match the size the fuzzer allocates at run time"),
+    cl::init(0x10000), cl::Hidden);
+
+static cl::opt<bool> ClInlineDataFlow(
+    "fuzzalloc-inline-dataflow",
+    cl::desc("In libFuzzer mode, update a thread-local dataflow counter "
+             "array inline instead of calling "
+             "__sanitizer_cov_trace_dataflow"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<bool> ClNeverZero(
+    "fuzzalloc-neverzero",
+    cl::desc("Carry-add (NEVERZERO) map updates: a def-use feature's hit "
+             "counter skips zero on wrap-around, so hot features cannot "
+             "become invisible within a single execution"),
+    cl::init(true), cl::Hidden);
+
+static cl::opt<bool> ClCRC32Hash(
+    "fuzzalloc-crc32-hash",
+    cl::desc("Combine def and use sites with the SSE4.2 crc32 instruction "
+             "instead of the multiplicative hash: lower latency and better "
+             "dispersion over small offsets, but requires an SSE4.2 host"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned long long> ClCostBudget(
+    "fuzzalloc-cost-budget",
+    cl::desc("Total instrumentation cost budget for the module, in estimated "
+             "block executions per function entry (BlockFrequencyInfo). The "
+             "cheapest sites are fully instrumented until the budget is "
+             "spent; the remaining (hottest) sites are degraded to sampled "
+             "probes. Zero disables the budget"),
+    cl::init(0), cl::Hidden);
+
 static cl::opt<Fuzzer> ClFuzzerInstrument(
     cl::desc("Fuzzer instrumentation:"),
     cl::values(clEnumValN(Fuzzer::DebugLog, "debug-log", "Debug log"),
@@ -81,15 +165,34 @@ static cl::opt<Fuzzer> ClFuzzerInstrument(
 
 STATISTIC(NumOfInstrumentedMemAccesses,
           "Number of memory accesses instrumented.");
+STATISTIC(NumOfElidedMemAccesses,
+          "Number of redundant memory accesses not instrumented.");
+STATISTIC(NumOfStaticUseSiteOffsets,
+          "Number of use site offsets folded at compile time.");
+STATISTIC(NumOfFilteredMemAccesses,
+          "Number of memory accesses filtered by the pointer analysis.");
+STATISTIC(NumOfBudgetSampledAccesses,
+          "Number of memory accesses degraded to sampled probes by the cost "
+          "budget.");
 
 // Debug logging
 static const char *const DbgMemAccessName = "__mem_access";
 
 // AFL-style fuzzing
 static const char *const AFLMapName = "__afl_area_ptr";
+static const char *const DFMapName = "__dataflow_area_ptr";
+static const char *const DFMapCompiledSizeName = "__dataflow_map_compiled_size";
 
 // libFuzzer-style fuzzing
 static const char *const SanCovTraceDataFlow = "__sanitizer_cov_trace_dataflow";
+static const char *const DFCountersName = "__dataflow_counters";
+
+/// Size of the thread-local dataflow counter array. Must match
+/// `kDataFlowCountersSize` in FuzzerTracePC.h
+static const unsigned kDFCountersSize = 1 << 16;
+
+/// Size of AFL's shared-memory edge map (`MAP_SIZE` in AFL's config.h)
+static const unsigned kAFLMapSize = 1 << 16;
 
 namespace {
 
@@ -99,8 +202,11 @@ struct InstrumentFlags {
   bool InstrumentWrites;
   bool InstrumentAtomics;
   bool UseOffset;
+  bool Sample;
 
   InstrumentFlags(Sensitivity S) {
+    Sample = false;
+
     switch (S) {
     case MemRead:
       InstrumentReads = true;
@@ -138,6 +244,13 @@ struct InstrumentFlags {
       InstrumentAtomics = false;
       UseOffset = true;
       break;
+    case MemAccessSampled:
+      InstrumentReads = true;
+      InstrumentWrites = true;
+      InstrumentAtomics = false;
+      UseOffset = false;
+      Sample = true;
+      break;
     }
   }
 };
@@ -157,13 +270,28 @@ private:
   ConstantInt *MinTag;
   ConstantInt *MaxTag;
   ConstantInt *AFLInc;
-  ConstantInt *HashMul;
 
   InstrumentFlags *InstFlags;
 
-  Value *getDefSite(Value *, IRBuilder<> &) const;
+  /// Per-function cache of def site values, keyed on the underlying object.
+  /// The def site only depends on the upper bits of the pointer, which every
+  /// interior pointer derived from the same object shares, so it is computed
+  /// once at the object's definition (hoisting it out of any loops)
+  DenseMap<Value *, Value *> DefSiteCache;
+
+  /// Debug-location keys of accesses that the whole-program pointer analysis
+  /// proved can never alias a tagged allocation site
+  StringSet<> DerefFilter;
+
+  Value *getUseSiteOffset(Value *, IRBuilder<> &) const;
+  Value *emitDefSite(Value *, IRBuilder<> &) const;
+  Value *getDefSite(Value *, Value *, IRBuilder<> &);
   Value *isInterestingMemoryAccess(Instruction *, bool *, uint64_t *,
                                    unsigned *, Value **) const;
+  void emitSampleGate(Instruction *, Value *, IRBuilder<> &);
+  void instrumentSite(Instruction *, bool);
+  Value *emitDefUseHash(Value *, Value *, IntegerType *, const Twine &,
+                        IRBuilder<> &) const;
 
 public:
   static char ID;
@@ -179,7 +307,7 @@ private:
   //
 
   Function *DbgMemAccessFn;
-  void doDebugInstrument(Instruction *, Value *) const;
+  void doDebugInstrument(Instruction *, Value *, Value *);
 
   //
   // AFL-style fuzzing
@@ -187,16 +315,19 @@ private:
 
   FunctionCallee ReadPCAsm;
   GlobalVariable *AFLMapPtr;
+  GlobalVariable *DFMapPtr;
+  ConstantInt *DFMapSizeMask;
 
-  void doAFLInstrument(Instruction *, Value *) const;
+  void doAFLInstrument(Instruction *, Value *, Value *, bool);
 
   //
   // libFuzzer-style fuzzing
   //
 
   Function *SanCovTraceDataFlowFn;
+  GlobalVariable *DFCounters;
 
-  void doLibFuzzerInstrument(Instruction *, Value *) const;
+  void doLibFuzzerInstrument(Instruction *, Value *, Value *, bool);
 };
 
 } // anonymous namespace
@@ -305,7 +436,30 @@ static GEPOperator *getUseSiteGEP(Value *V, DataLayout &DL,
   return nullptr;
 }
 
-Value *InstrumentMemAccesses::getDefSite(Value *Ptr, IRBuilder<> &IRB) const {
+/// Compute the use site offset for `Ptr`, or zero if it cannot be determined.
+/// GEPs with all-constant indices - the common case for fixed struct field
+/// accesses - are folded to a single immediate at compile time; only GEPs
+/// with run-time indices pay for the EmitGEPOffset multiply/add chain
+Value *InstrumentMemAccesses::getUseSiteOffset(Value *Ptr,
+                                               IRBuilder<> &IRB) const {
+  auto *UseSiteGEP = getUseSiteGEP(Ptr, *this->DL);
+  if (!UseSiteGEP) {
+    return Constant::getNullValue(this->Int64Ty);
+  }
+
+  APInt ConstOffset(this->DL->getIndexSizeInBits(
+                        UseSiteGEP->getPointerAddressSpace()),
+                    0);
+  if (UseSiteGEP->accumulateConstantOffset(*this->DL, ConstOffset)) {
+    NumOfStaticUseSiteOffsets++;
+    return ConstantInt::get(this->Int64Ty, ConstOffset.getSExtValue());
+  }
+
+  return EmitGEPOffset(&IRB, *this->DL, UseSiteGEP);
+}
+
+Value *InstrumentMemAccesses::emitDefSite(Value *Ptr,
+                                          IRBuilder<> &IRB) const {
   // Cast the memory access pointer to an integer and mask out the mspace tag
   // from the pointer by right-shifting by 32 bits
   auto *PtrAsInt = IRB.CreatePtrToInt(Ptr, this->Int64Ty);
@@ -319,6 +473,13 @@ Value *InstrumentMemAccesses::getDefSite(Value *Ptr, IRBuilder<> &IRB) const {
       IRB.CreateIntCast(MSpaceTag, this->TagTy, /* isSigned */ false,
                         Ptr->getName() + ".def_site");
 
+  // The def site only ever feeds map index arithmetic - an out-of-range tag
+  // just lands in a different map slot - so the clamp below can be dropped,
+  // saving two compares, an and, and a select per instrumented access
+  if (ClBranchlessDefSite) {
+    return DefSite;
+  }
+
   // Ensure that the def site is within the valid range of allowed def sites.
   // Otherwise assign it the default tag
   auto *SelectComp = IRB.CreateAnd(IRB.CreateICmpUGE(DefSite, this->MinTag),
@@ -327,6 +488,53 @@ Value *InstrumentMemAccesses::getDefSite(Value *Ptr, IRBuilder<> &IRB) const {
                           DefSite->getName() + "_in_range");
 }
 
+/// Get the def site for the memory access at `Ptr`, whose underlying object
+/// is `Obj`. Where possible, the def site is computed once per underlying
+/// object - immediately after the object's definition - and reused for every
+/// access derived from it, so that loops over an object pay the shift/mask/
+/// select sequence once instead of per iteration
+Value *InstrumentMemAccesses::getDefSite(Value *Ptr, Value *Obj,
+                                         IRBuilder<> &IRB) {
+  if (Obj) {
+    auto It = this->DefSiteCache.find(Obj);
+    if (It != this->DefSiteCache.end()) {
+      return It->second;
+    }
+
+    Instruction *InsertPt = nullptr;
+    if (auto *ObjInst = dyn_cast<Instruction>(Obj)) {
+      if (auto *Invoke = dyn_cast<InvokeInst>(ObjInst)) {
+        // An invoke's result is only available in its normal destination
+        BasicBlock *NormalDest = Invoke->getNormalDest();
+        if (NormalDest->getSinglePredecessor()) {
+          InsertPt = &*NormalDest->getFirstInsertionPt();
+        }
+      } else if (isa<PHINode>(ObjInst)) {
+        InsertPt = &*ObjInst->getParent()->getFirstInsertionPt();
+      } else {
+        InsertPt = ObjInst->getNextNode();
+      }
+    } else if (isa<Argument>(Obj) || isa<GlobalValue>(Obj)) {
+      // The object is live on function entry
+      InsertPt = &*IRB.GetInsertBlock()
+                       ->getParent()
+                       ->getEntryBlock()
+                       .getFirstInsertionPt();
+    }
+
+    if (InsertPt) {
+      IRBuilder<> ObjIRB(InsertPt);
+      Value *DefSite = emitDefSite(Obj, ObjIRB);
+      this->DefSiteCache.insert({Obj, DefSite});
+      return DefSite;
+    }
+  }
+
+  // Couldn't find a single insertion point for the object - compute the def
+  // site at the access itself
+  return emitDefSite(Ptr, IRB);
+}
+
 // Adapted from llvm::AddressSanitizer::isInterestingMemoryAccess
 Value *InstrumentMemAccesses::isInterestingMemoryAccess(
     Instruction *I, bool *IsWrite, uint64_t *TypeSize, unsigned *Alignment,
@@ -437,6 +645,9 @@ Value *InstrumentMemAccesses::isInterestingMemoryAccess(
 
 void InstrumentMemAccesses::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<TargetLibraryInfoWrapperPass>();
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<BlockFrequencyInfoWrapperPass>();
 }
 
 bool InstrumentMemAccesses::doInitialization(Module &M) {
@@ -456,7 +667,6 @@ bool InstrumentMemAccesses::doInitialization(Module &M) {
   this->MinTag = ConstantInt::get(this->TagTy, ClDefSiteTagMin);
   this->MaxTag = ConstantInt::get(this->TagTy, ClDefSiteTagMax);
   this->AFLInc = ConstantInt::get(this->Int8Ty, 1);
-  this->HashMul = ConstantInt::get(this->TagTy, 3);
 
   this->InstFlags = new InstrumentFlags(ClSensitivity);
 
@@ -467,6 +677,32 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
   LLVMContext &C = M.getContext();
   Type *VoidTy = Type::getVoidTy(C);
 
+  if ((this->InstFlags->Sample || ClCostBudget) &&
+      !isPowerOf2_32(ClSampleInterval)) {
+    report_fatal_error("-fuzzalloc-sample-interval must be a power of two");
+  }
+
+  if (!ClDerefFilterPath.empty()) {
+    auto InputOrErr = MemoryBuffer::getFile(ClDerefFilterPath);
+    if (auto EC = InputOrErr.getError()) {
+      std::string Err;
+      raw_string_ostream OS(Err);
+      OS << "unable to open fuzzalloc dereference filter at "
+         << ClDerefFilterPath << ": " << EC.message();
+      OS.flush();
+      report_fatal_error(Err);
+    }
+
+    SmallVector<StringRef, 64> Lines;
+    InputOrErr.get()->getBuffer().split(Lines, '\n', /* MaxSplit */ -1,
+                                        /* KeepEmpty */ false);
+    for (auto Line : Lines) {
+      if (!Line.startswith("#")) {
+        this->DerefFilter.insert(Line);
+      }
+    }
+  }
+
   if (ClFuzzerInstrument == Fuzzer::DebugLog) {
     //
     // Debug logging
@@ -489,6 +725,26 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
     this->AFLMapPtr = new GlobalVariable(
         M, PointerType::getUnqual(this->Int8Ty), /* isConstant */ false,
         GlobalValue::ExternalLinkage, /* Initializer */ nullptr, AFLMapName);
+
+    if (ClUseDataFlowMap) {
+      if (!isPowerOf2_32(ClDataFlowMapSize)) {
+        report_fatal_error("-fuzzalloc-dataflow-map-size must be a power of "
+                           "two");
+      }
+      this->DFMapPtr = new GlobalVariable(
+          M, PointerType::getUnqual(this->Int8Ty), /* isConstant */ false,
+          GlobalValue::ExternalLinkage, /* Initializer */ nullptr, DFMapName);
+      this->DFMapSizeMask =
+          ConstantInt::get(Type::getInt32Ty(C), ClDataFlowMapSize - 1);
+
+      // Record the compiled-in map size in the binary so the runtime can
+      // size its fallback map to match and refuse a smaller negotiated map
+      // (see dataflow_map.c). Weak, so TUs instrumented together don't clash
+      new GlobalVariable(M, this->Int64Ty, /* isConstant */ true,
+                         GlobalValue::WeakAnyLinkage,
+                         ConstantInt::get(this->Int64Ty, ClDataFlowMapSize),
+                         DFMapCompiledSizeName);
+    }
   } else if (ClFuzzerInstrument == Fuzzer::LibFuzzer) {
     //
     // libFuzzer-style fuzzing
@@ -499,12 +755,34 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
             SanCovTraceDataFlow, VoidTy, this->TagTy, this->Int64Ty));
     this->SanCovTraceDataFlowFn->addParamAttr(0, Attribute::ZExt);
     this->SanCovTraceDataFlowFn->addParamAttr(1, Attribute::SExt);
+
+    if (ClInlineDataFlow) {
+      auto *ReadPCAsmTy = FunctionType::get(this->Int64Ty, /*isVarArg=*/false);
+      this->ReadPCAsm = FunctionCallee(
+          ReadPCAsmTy,
+          InlineAsm::get(ReadPCAsmTy, "leaq (%rip), $0",
+                         /* Constraints */ "=r", /* hasSideEffects */ false));
+
+      // Thread-local counter array harvested by TracePC::CollectFeatures
+      this->DFCounters = new GlobalVariable(
+          M, ArrayType::get(this->Int8Ty, kDFCountersSize),
+          /* isConstant */ false, GlobalValue::ExternalLinkage,
+          /* Initializer */ nullptr, DFCountersName, /* InsertBefore */ nullptr,
+          GlobalValue::InitialExecTLSModel);
+    }
   }
 
   // For determining whether to instrument a memory dereference
   ObjectSizeOpts ObjSizeOpts;
   ObjSizeOpts.RoundToAlign = true;
 
+  // With a cost budget the full-versus-sampled decision is global, so sites
+  // are collected (with their estimated cost) across the whole module first
+  // and only instrumented once every function has been seen
+  SmallVector<std::pair<Function *, SmallVector<Instruction *, 16>>, 0>
+      DeferredSites;
+  SmallVector<std::pair<uint64_t, Instruction *>, 0> SiteCosts;
+
   for (auto &F : M.functions()) {
     // Don't instrument our own constructors/destructors
     if (F.getName().startswith("fuzzalloc.init_") ||
@@ -526,6 +804,16 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
         &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F);
     ObjectSizeOffsetVisitor ObjSizeVis(*this->DL, TLI, C, ObjSizeOpts);
 
+    // For eliding accesses covered by a dominating access to the same pointer
+    const DominatorTree &DT =
+        getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+    const LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+    DenseMap<std::pair<Value *, bool>, SmallVector<Instruction *, 4>>
+        InstrumentedAccesses;
+
+    // Def sites are cached per underlying object within a function
+    this->DefSiteCache.clear();
+
     for (auto &BB : F) {
       TempsToInstrument.clear();
 
@@ -596,22 +884,192 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
           continue;
         }
 
+        // Skip accesses that the whole-program pointer analysis proved can
+        // never alias a tagged allocation site: they only ever see the
+        // default tag
+        if (!this->DerefFilter.empty()) {
+          if (DILocation *Loc = I->getDebugLoc()) {
+            SmallString<128> Key;
+            raw_svector_ostream KeyOS(Key);
+            KeyOS << F.getName() << ':' << Loc->getFilename() << ':'
+                  << Loc->getLine() << ':' << Loc->getColumn();
+            if (this->DerefFilter.count(Key)) {
+              NumOfFilteredMemAccesses++;
+              continue;
+            }
+          }
+        }
+
+        // An access to the same pointer that is dominated by an
+        // already-instrumented access of the same kind in the same loop
+        // records exactly the same def site and offset - drop it. Sampled
+        // sites (including budget-degraded ones) don't fire every execution,
+        // so nothing may be elided in their favour
+        if (ClElideRedundantAccesses && !this->InstFlags->Sample &&
+            !ClCostBudget) {
+          auto &PrevAccesses = InstrumentedAccesses[{Addr, IsWrite}];
+          bool Covered = llvm::any_of(PrevAccesses, [&](Instruction *Prev) {
+            return DT.dominates(Prev, I) &&
+                   LI.getLoopFor(Prev->getParent()) ==
+                       LI.getLoopFor(I->getParent());
+          });
+          if (Covered) {
+            NumOfElidedMemAccesses++;
+            continue;
+          }
+          PrevAccesses.push_back(I);
+        }
+
+        if (ClCostBudget) {
+          // Defer: the budget decides globally which sites stay full-rate.
+          // A site's cost is how often its block is expected to execute per
+          // function entry, which is what its map update will cost at run
+          // time (BFI's estimate already scales with loop depth)
+          const BlockFrequencyInfo &BFI =
+              getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+          uint64_t Cost = std::max<uint64_t>(
+              1, BFI.getBlockFreq(I->getParent()).getFrequency() /
+                     std::max<uint64_t>(1, BFI.getEntryFreq()));
+          if (DeferredSites.empty() || DeferredSites.back().first != &F) {
+            DeferredSites.emplace_back(&F, SmallVector<Instruction *, 16>());
+          }
+          DeferredSites.back().second.push_back(I);
+          SiteCosts.push_back({Cost, I});
+          continue;
+        }
+
         if (ClFuzzerInstrument == Fuzzer::DebugLog) {
-          doDebugInstrument(I, Addr);
+          doDebugInstrument(I, Addr, Obj);
         } else if (ClFuzzerInstrument == Fuzzer::AFL) {
-          doAFLInstrument(I, Addr);
+          doAFLInstrument(I, Addr, Obj, this->InstFlags->Sample);
         } else if (ClFuzzerInstrument == Fuzzer::LibFuzzer) {
-          doLibFuzzerInstrument(I, Addr);
+          doLibFuzzerInstrument(I, Addr, Obj, this->InstFlags->Sample);
         }
       }
     }
   }
 
+  if (ClCostBudget) {
+    // Spend the budget on the cheapest sites: that fully instruments as many
+    // sites as the budget allows and pushes only the hottest ones down to
+    // sampled probes
+    llvm::stable_sort(SiteCosts, [](const std::pair<uint64_t, Instruction *> &A,
+                                    const std::pair<uint64_t, Instruction *> &B) {
+      return A.first < B.first;
+    });
+
+    DenseSet<Instruction *> SampledSites;
+    uint64_t Spent = 0;
+    for (const auto &SiteCost : SiteCosts) {
+      Spent += SiteCost.first;
+      if (Spent > ClCostBudget) {
+        SampledSites.insert(SiteCost.second);
+      }
+    }
+
+    // Instrument function by function so the def site cache never crosses a
+    // function boundary
+    for (auto &FuncSites : DeferredSites) {
+      this->DefSiteCache.clear();
+      for (auto *I : FuncSites.second) {
+        bool Sampled = SampledSites.count(I);
+        if (Sampled) {
+          NumOfBudgetSampledAccesses++;
+        }
+        instrumentSite(I, this->InstFlags->Sample || Sampled);
+      }
+    }
+  }
+
   printStatistic(M, NumOfInstrumentedMemAccesses);
+  printStatistic(M, NumOfElidedMemAccesses);
+  printStatistic(M, NumOfStaticUseSiteOffsets);
+  printStatistic(M, NumOfFilteredMemAccesses);
+  printStatistic(M, NumOfBudgetSampledAccesses);
 
   return NumOfInstrumentedMemAccesses > 0;
 }
 
+/// Instrument the (deferred) memory access `I`, either at full rate or as a
+/// sampled probe. The address and underlying object are recomputed here: they
+/// are cheap to derive and holding them across the deferral would be fragile
+void InstrumentMemAccesses::instrumentSite(Instruction *I, bool Sampled) {
+  bool IsWrite;
+  uint64_t TypeSize;
+  unsigned Alignment;
+
+  Value *Addr = isInterestingMemoryAccess(I, &IsWrite, &TypeSize, &Alignment);
+  assert(Addr && "Deferred site is no longer an interesting memory access");
+
+  Value *Obj = getUnderlyingObject(Addr);
+
+  if (ClFuzzerInstrument == Fuzzer::DebugLog) {
+    doDebugInstrument(I, Addr, Obj);
+  } else if (ClFuzzerInstrument == Fuzzer::AFL) {
+    doAFLInstrument(I, Addr, Obj, Sampled);
+  } else if (ClFuzzerInstrument == Fuzzer::LibFuzzer) {
+    doLibFuzzerInstrument(I, Addr, Obj, Sampled);
+  }
+}
+
+/// Guard the map update for the access `I` with a per-site sampling counter:
+/// the counter is decremented and masked (branchless) and the update only
+/// fires every `ClSampleInterval`th execution, behind a highly-predictable
+/// branch. The counter starts at one so a site's first execution always
+/// reports. On return `IRB` points inside the guarded block
+void InstrumentMemAccesses::emitSampleGate(Instruction *I, Value *Ptr,
+                                           IRBuilder<> &IRB) {
+  auto *M = I->getModule();
+
+  auto *SiteCounter = new GlobalVariable(
+      *M, this->TagTy, /* isConstant */ false, GlobalValue::InternalLinkage,
+      ConstantInt::get(this->TagTy, 1), "__fuzzalloc_site_counter");
+
+  auto *CounterLoad = IRB.CreateLoad(SiteCounter);
+  auto *NextCounter = IRB.CreateAnd(
+      IRB.CreateSub(CounterLoad, ConstantInt::get(this->TagTy, 1)),
+      ConstantInt::get(this->TagTy, ClSampleInterval - 1));
+  auto *CounterStore = IRB.CreateStore(NextCounter, SiteCounter);
+
+  setNoSanitizeMetadata(CounterLoad);
+  setNoSanitizeMetadata(CounterStore);
+
+  auto *Fire = IRB.CreateICmpEQ(NextCounter, ConstantInt::get(this->TagTy, 0),
+                                Ptr->getName() + ".sample_fire");
+  auto *ProbeTerm = SplitBlockAndInsertIfThen(Fire, I, /* Unreachable */ false);
+  IRB.SetInsertPoint(ProbeTerm);
+}
+
+/// Combine the def site and use site into a `HashTy`-wide map index
+Value *InstrumentMemAccesses::emitDefUseHash(Value *DefSite, Value *UseSite,
+                                             IntegerType *HashTy,
+                                             const Twine &Name,
+                                             IRBuilder<> &IRB) const {
+  if (ClCRC32Hash) {
+    // A single crc32 instruction: one cycle of latency and far better
+    // dispersion over small offsets than the multiplicative hash below
+    auto *Int32Ty = IRB.getInt32Ty();
+    auto *CRC32Fn =
+        Intrinsic::getDeclaration(IRB.GetInsertBlock()->getModule(),
+                                  Intrinsic::x86_sse42_crc32_32_32);
+    auto *Hash = IRB.CreateCall(
+        CRC32Fn, {IRB.CreateIntCast(UseSite, Int32Ty, /* isSigned */ false),
+                  IRB.CreateIntCast(DefSite, Int32Ty, /* isSigned */ false)});
+    return IRB.CreateZExtOrTrunc(Hash, HashTy, Name);
+  }
+
+  // Hash algorithm: ((3 * (def_site - DEFAULT_TAG)) ^ use_site) - use_site
+  return IRB.CreateSub(
+      IRB.CreateXor(
+          IRB.CreateMul(ConstantInt::get(HashTy, 3),
+                        IRB.CreateSub(IRB.CreateIntCast(DefSite, HashTy,
+                                                        /* isSigned */ false),
+                                      ConstantInt::get(HashTy,
+                                                       FUZZALLOC_DEFAULT_TAG))),
+          UseSite),
+      UseSite, Name);
+}
+
 //===----------------------------------------------------------------------===//
 //
 // Debug logging
@@ -619,8 +1077,8 @@ bool InstrumentMemAccesses::runOnModule(Module &M) {
 //===----------------------------------------------------------------------===//
 
 /// Instrument the Instruction `I` that accesses the memory at `Ptr`.
-void InstrumentMemAccesses::doDebugInstrument(Instruction *I,
-                                              Value *Ptr) const {
+void InstrumentMemAccesses::doDebugInstrument(Instruction *I, Value *Ptr,
+                                              Value *Obj) {
   LLVM_DEBUG(dbgs() << "instrumenting " << *Ptr << " in " << *I << '\n');
 
   auto *M = I->getModule();
@@ -632,15 +1090,12 @@ void InstrumentMemAccesses::doDebugInstrument(Instruction *I,
                  MDNode::get(C, None));
 
   // Get the def site
-  auto *DefSite = getDefSite(Ptr, IRB);
+  auto *DefSite = getDefSite(Ptr, Obj, IRB);
 
   // Get the use site offset. Default to zero if we can't determine the offset
   Value *UseSiteOffset = Constant::getNullValue(this->Int64Ty);
   if (this->InstFlags->UseOffset) {
-    auto *UseSiteGEP = getUseSiteGEP(Ptr, *this->DL);
-    if (UseSiteGEP) {
-      UseSiteOffset = EmitGEPOffset(&IRB, *this->DL, UseSiteGEP);
-    }
+    UseSiteOffset = getUseSiteOffset(Ptr, IRB);
   }
   UseSiteOffset->setName(Ptr->getName() + ".offset");
   auto *UseSiteOffsetInt64 =
@@ -659,7 +1114,8 @@ void InstrumentMemAccesses::doDebugInstrument(Instruction *I,
 //===----------------------------------------------------------------------===//
 
 /// Instrument the Instruction `I` that accesses the memory at `Ptr`.
-void InstrumentMemAccesses::doAFLInstrument(Instruction *I, Value *Ptr) const {
+void InstrumentMemAccesses::doAFLInstrument(Instruction *I, Value *Ptr,
+                                            Value *Obj, bool Sampled) {
   LLVM_DEBUG(dbgs() << "instrumenting " << *Ptr << " in " << *I << '\n');
 
   auto *M = I->getModule();
@@ -671,51 +1127,76 @@ void InstrumentMemAccesses::doAFLInstrument(Instruction *I, Value *Ptr) const {
                  MDNode::get(C, None));
 
   // Get the def site
-  auto *DefSite = getDefSite(Ptr, IRB);
+  auto *DefSite = getDefSite(Ptr, Obj, IRB);
 
   // Get the use site offset. Default to zero if we can't determine the offset
   Value *UseSiteOffset = Constant::getNullValue(this->Int64Ty);
   if (this->InstFlags->UseOffset) {
-    auto *UseSiteGEP = getUseSiteGEP(Ptr, *this->DL);
-    if (UseSiteGEP) {
-      UseSiteOffset = EmitGEPOffset(&IRB, *this->DL, UseSiteGEP);
-    }
+    UseSiteOffset = getUseSiteOffset(Ptr, IRB);
   }
   UseSiteOffset->setName(Ptr->getName() + ".offset");
   auto *UseSiteOffsetInt64 =
       IRB.CreateSExtOrTrunc(UseSiteOffset, this->Int64Ty);
 
+  // With the dedicated dataflow map the hash is computed at map-index width,
+  // so maps larger than the 64 KB edge map actually spread features out
+  // rather than aliasing in the low 16 bits
+  IntegerType *HashTy = ClUseDataFlowMap ? IRB.getInt32Ty() : this->TagTy;
+
   // Use the PC as the use site identifier
   auto *UseSite =
-      IRB.CreateIntCast(IRB.CreateCall(this->ReadPCAsm), this->TagTy,
+      IRB.CreateIntCast(IRB.CreateCall(this->ReadPCAsm), HashTy,
                         /* isSigned */ false, Ptr->getName() + ".use_site");
 
   // Incorporate the memory access offset into the use site
   if (this->InstFlags->UseOffset) {
     UseSite = IRB.CreateAdd(UseSite,
-                            IRB.CreateIntCast(UseSiteOffsetInt64, this->TagTy,
+                            IRB.CreateIntCast(UseSiteOffsetInt64, HashTy,
                                               /* isSigned */ true));
   }
 
-  // Load the AFL bitmap
-  auto *AFLMap = IRB.CreateLoad(this->AFLMapPtr);
+  // Sampled sites (the mem-access-sampled sensitivity, or hot sites degraded
+  // by the cost budget) only fire their map update every Nth execution
+  if (Sampled) {
+    emitSampleGate(I, Ptr, IRB);
+  }
+
+  // Load the AFL bitmap (or the dedicated dataflow map)
+  auto *AFLMap = IRB.CreateLoad(ClUseDataFlowMap ? this->DFMapPtr
+                                                 : this->AFLMapPtr);
 
   // Hash the allocation site and use site to index into the bitmap
   //
   // zext is necessary otherwise we end up using signed indices
-  //
-  // Hash algorithm: ((3 * (def_site - DEFAULT_TAG)) ^ use_site) - use_site
-  auto *Hash = IRB.CreateSub(
-      IRB.CreateXor(IRB.CreateMul(this->HashMul,
-                                  IRB.CreateSub(DefSite, this->DefaultTag)),
-                    UseSite),
-      UseSite, Ptr->getName() + ".def_use_hash");
-  auto *AFLMapIdx = IRB.CreateGEP(
-      AFLMap, IRB.CreateZExt(Hash, IRB.getInt32Ty()), "__afl_area_ptr_idx");
+  auto *Hash = emitDefUseHash(DefSite, UseSite, HashTy,
+                              Ptr->getName() + ".def_use_hash", IRB);
+
+  Value *MapIdx = IRB.CreateZExt(Hash, IRB.getInt32Ty());
+  if (ClUseDataFlowMap) {
+    MapIdx = IRB.CreateAnd(MapIdx, this->DFMapSizeMask);
+  } else if (NUM_TAG_BITS > 16) {
+    // Widened tags hash at tag width - clamp the index to AFL's 64 KB edge
+    // map so a plain-AFL build never writes past the shared-memory mapping
+    MapIdx = IRB.CreateAnd(MapIdx,
+                           ConstantInt::get(IRB.getInt32Ty(), kAFLMapSize - 1));
+  }
+  auto *AFLMapIdx =
+      IRB.CreateGEP(AFLMap, MapIdx,
+                    ClUseDataFlowMap ? "__dataflow_area_ptr_idx"
+                                     : "__afl_area_ptr_idx");
 
   // Update the bitmap only if the def site is not the default tag
   auto *CounterLoad = IRB.CreateLoad(AFLMapIdx);
-  auto *Incr = IRB.CreateAdd(CounterLoad, this->AFLInc);
+  Value *Incr = IRB.CreateAdd(CounterLoad, this->AFLInc);
+  if (ClNeverZero) {
+    // NEVERZERO: fold the wrap-around carry back into the counter so it
+    // lands on 1 instead of 0. Costs one flag-register add over the plain
+    // increment and keeps hot features visible no matter how often they fire
+    auto *Carry = IRB.CreateZExt(
+        IRB.CreateICmpEQ(Incr, Constant::getNullValue(this->Int8Ty)),
+        this->Int8Ty);
+    Incr = IRB.CreateAdd(Incr, Carry);
+  }
   auto *CounterStore = IRB.CreateStore(Incr, AFLMapIdx);
 
   setNoSanitizeMetadata(AFLMap);
@@ -732,8 +1213,8 @@ void InstrumentMemAccesses::doAFLInstrument(Instruction *I, Value *Ptr) const {
 //===----------------------------------------------------------------------===//
 
 // Adapted from llvm::SanitizerCoverageModule::InjectTraceForCmp
-void InstrumentMemAccesses::doLibFuzzerInstrument(Instruction *I,
-                                                  Value *Ptr) const {
+void InstrumentMemAccesses::doLibFuzzerInstrument(Instruction *I, Value *Ptr,
+                                                  Value *Obj, bool Sampled) {
   LLVM_DEBUG(dbgs() << "instrumenting " << *Ptr << " in " << *I << '\n');
 
   auto *M = I->getModule();
@@ -744,18 +1225,57 @@ void InstrumentMemAccesses::doLibFuzzerInstrument(Instruction *I,
   I->setMetadata(M->getMDKindID("fuzzalloc.instrumented_deref"),
                  MDNode::get(C, None));
 
-  auto *DefSite = getDefSite(Ptr, IRB);
+  auto *DefSite = getDefSite(Ptr, Obj, IRB);
   Value *UseSiteOffset = Constant::getNullValue(this->Int64Ty);
 
   if (this->InstFlags->UseOffset) {
-    auto *UseSiteGEP = getUseSiteGEP(Ptr, *this->DL);
-    if (UseSiteGEP) {
-      UseSiteOffset = EmitGEPOffset(&IRB, *this->DL, UseSiteGEP);
-    }
+    UseSiteOffset = getUseSiteOffset(Ptr, IRB);
   }
   UseSiteOffset->setName(Ptr->getName() + ".offset");
 
-  IRB.CreateCall(this->SanCovTraceDataFlowFn, {DefSite, UseSiteOffset});
+  // Sampled sites (the mem-access-sampled sensitivity, or hot sites degraded
+  // by the cost budget) only fire their counter update every Nth execution
+  if (Sampled) {
+    emitSampleGate(I, Ptr, IRB);
+  }
+
+  if (ClInlineDataFlow) {
+    // Update the thread-local counter array inline, saving the call/return
+    // and argument setup of __sanitizer_cov_trace_dataflow on every access
+    IntegerType *HashTy = IRB.getInt32Ty();
+
+    auto *UseSite =
+        IRB.CreateIntCast(IRB.CreateCall(this->ReadPCAsm), HashTy,
+                          /* isSigned */ false, Ptr->getName() + ".use_site");
+    if (this->InstFlags->UseOffset) {
+      UseSite = IRB.CreateAdd(
+          UseSite, IRB.CreateIntCast(IRB.CreateSExtOrTrunc(UseSiteOffset,
+                                                           this->Int64Ty),
+                                     HashTy, /* isSigned */ true));
+    }
+
+    // Same hash as the AFL-map instrumentation
+    auto *Hash = emitDefUseHash(DefSite, UseSite, HashTy,
+                                Ptr->getName() + ".def_use_hash", IRB);
+    auto *Idx =
+        IRB.CreateAnd(Hash, ConstantInt::get(HashTy, kDFCountersSize - 1));
+
+    auto *CounterPtr = IRB.CreateInBoundsGEP(
+        this->DFCounters, {IRB.getInt32(0), Idx}, "__dataflow_counter_idx");
+
+    // 8-bit saturating increment: stick at 255 rather than wrapping to zero
+    auto *CounterLoad = IRB.CreateLoad(CounterPtr);
+    auto *Incr = IRB.CreateAdd(CounterLoad, ConstantInt::get(this->Int8Ty, 1));
+    auto *Saturated = IRB.CreateSelect(
+        IRB.CreateICmpEQ(Incr, ConstantInt::get(this->Int8Ty, 0)),
+        ConstantInt::get(this->Int8Ty, 0xff), Incr);
+    auto *CounterStore = IRB.CreateStore(Saturated, CounterPtr);
+
+    setNoSanitizeMetadata(CounterLoad);
+    setNoSanitizeMetadata(CounterStore);
+  } else {
+    IRB.CreateCall(this->SanCovTraceDataFlowFn, {DefSite, UseSiteOffset});
+  }
 
   NumOfInstrumentedMemAccesses++;
 }
@@ -8,36 +8,160 @@
 //===----------------------------------------------------------------------===//
 ///
 /// \file
-/// Wrapper around LLVM's LowerAtomic pass.
+/// Wrapper around LLVM's LowerAtomic pass. Optionally also elides pthread
+/// synchronization calls when the target is guaranteed to run single-threaded
+/// (as it is under the fork server).
 ///
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Scalar/LowerAtomic.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "Utils/FuzzallocUtils.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "fuzzalloc-lower-atomics"
 
+static cl::opt<bool> ClSingleThreaded(
+    "fuzzalloc-single-threaded",
+    cl::desc("Elide pthread synchronization calls (the target is guaranteed "
+             "to run single-threaded)"),
+    cl::init(false));
+
+STATISTIC(NumOfElidedLockCalls, "Number of pthread lock calls elided.");
+STATISTIC(NumOfLoweredOnceCalls, "Number of pthread_once calls lowered.");
+
 class LowerAtomics : public llvm::FunctionPass {
 public:
   static char ID;
   LowerAtomics() : llvm::FunctionPass(ID) {}
   virtual bool runOnFunction(llvm::Function &) override;
+  virtual bool doFinalization(llvm::Module &) override;
 
 private:
+  bool elidePthreadCalls(llvm::Function &);
+
   llvm::LowerAtomicPass Impl;
 };
 
 char LowerAtomics::ID = 0;
 
+/// Returns \c true if the given function is a pthread lock/unlock call that
+/// can simply be removed (its success return value is 0) when the target is
+/// single-threaded
+static bool isElidableLockFn(StringRef Name) {
+  return StringSwitch<bool>(Name)
+      .Cases("pthread_mutex_lock", "pthread_mutex_trylock",
+             "pthread_mutex_unlock", true)
+      .Cases("pthread_spin_lock", "pthread_spin_trylock",
+             "pthread_spin_unlock", true)
+      .Cases("pthread_rwlock_rdlock", "pthread_rwlock_tryrdlock",
+             "pthread_rwlock_wrlock", "pthread_rwlock_trywrlock",
+             "pthread_rwlock_unlock", true)
+      .Default(false);
+}
+
+/// Lower `pthread_once(ctrl, fn)` to a plain (non-atomic) check of the once
+/// control word: `if (*ctrl == 0) { *ctrl = 1; fn(); }`. PTHREAD_ONCE_INIT is
+/// zero, so a non-zero control word means the init routine has already run
+static void lowerPthreadOnce(CallInst *Call) {
+  LLVMContext &C = Call->getContext();
+  IntegerType *Int32Ty = Type::getInt32Ty(C);
+
+  Value *Ctrl = Call->getArgOperand(0);
+  Value *InitRoutine = Call->getArgOperand(1);
+
+  IRBuilder<> IRB(Call);
+  auto *CtrlWord = IRB.CreatePointerCast(Ctrl, Int32Ty->getPointerTo());
+  auto *NotDone = IRB.CreateICmpEQ(IRB.CreateLoad(Int32Ty, CtrlWord),
+                                   Constant::getNullValue(Int32Ty));
+
+  auto *InitTerm = SplitBlockAndInsertIfThen(NotDone, Call,
+                                             /* Unreachable */ false);
+  IRB.SetInsertPoint(InitTerm);
+  IRB.CreateStore(ConstantInt::get(Int32Ty, 1), CtrlWord);
+
+  auto *InitFnTy = FunctionType::get(Type::getVoidTy(C), /* isVarArg */ false);
+  IRB.CreateCall(InitFnTy,
+                 IRB.CreateBitCast(InitRoutine, InitFnTy->getPointerTo()));
+
+  // pthread_once always succeeds
+  if (!Call->getType()->isVoidTy()) {
+    Call->replaceAllUsesWith(Constant::getNullValue(Call->getType()));
+  }
+  Call->eraseFromParent();
+
+  NumOfLoweredOnceCalls++;
+}
+
+bool LowerAtomics::elidePthreadCalls(Function &F) {
+  SmallVector<CallInst *, 8> LockCalls;
+  SmallVector<CallInst *, 4> OnceCalls;
+
+  for (auto I = inst_begin(F); I != inst_end(F); ++I) {
+    if (auto *Call = dyn_cast<CallInst>(&*I)) {
+      const Function *CalledF = Call->getCalledFunction();
+      if (!CalledF) {
+        continue;
+      }
+
+      if (isElidableLockFn(CalledF->getName())) {
+        LockCalls.push_back(Call);
+      } else if (CalledF->getName() == "pthread_once" &&
+                 Call->getNumArgOperands() == 2) {
+        OnceCalls.push_back(Call);
+      }
+    }
+  }
+
+  for (auto *Call : LockCalls) {
+    // Lock and unlock calls return 0 on success
+    if (!Call->getType()->isVoidTy()) {
+      Call->replaceAllUsesWith(Constant::getNullValue(Call->getType()));
+    }
+    Call->eraseFromParent();
+    NumOfElidedLockCalls++;
+  }
+
+  for (auto *Call : OnceCalls) {
+    lowerPthreadOnce(Call);
+  }
+
+  return !LockCalls.empty() || !OnceCalls.empty();
+}
+
 // Adapted from `LowerAtomicLegacyPass`
 bool LowerAtomics::runOnFunction(Function &F) {
   FunctionAnalysisManager DummyFAM;
   auto PA = Impl.run(F, DummyFAM);
-  return !PA.areAllPreserved();
+  bool Changed = !PA.areAllPreserved();
+
+  if (ClSingleThreaded) {
+    Changed |= elidePthreadCalls(F);
+  }
+
+  return Changed;
+}
+
+bool LowerAtomics::doFinalization(Module &M) {
+  // Print once per module, after every function has been visited
+  if (ClSingleThreaded) {
+    printStatistic(M, NumOfElidedLockCalls);
+    printStatistic(M, NumOfLoweredOnceCalls);
+  }
+
+  return false;
 }
 
 //===----------------------------------------------------------------------===//
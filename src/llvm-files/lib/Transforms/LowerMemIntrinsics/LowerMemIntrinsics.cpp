@@ -28,6 +28,22 @@ using namespace llvm;
 
 #define DEBUG_TYPE "fuzzalloc-lower-mem-intrinsics"
 
+static cl::opt<bool> ClBlockedExpansion(
+    "fuzzalloc-blocked-mem-intrinsics",
+    cl::desc("Expand memory intrinsics in vector-width blocks (one "
+             "instrumented access per block) instead of per element"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> ClBlockedExpansionThreshold(
+    "fuzzalloc-blocked-mem-intrinsics-threshold",
+    cl::desc("Known-size memory intrinsics smaller than this many bytes keep "
+             "the precise element-at-a-time expansion"),
+    cl::init(64), cl::Hidden);
+
+/// Width (in bytes) of one block in the blocked expansion. Matches the SSE
+/// register width so the backend can keep each block as a single SIMD op
+static const unsigned BlockedExpansionWidth = 16;
+
 STATISTIC(NumOfMemCpyExpanded, "Number of memcpy expansions");
 STATISTIC(NumOfMemMoveExpanded, "Number of memmove expansions");
 STATISTIC(NumOfMemSetExpanded, "Number of memset expansions");
@@ -56,6 +72,14 @@ static void createMemCpyLoopKnownSize(Instruction *InsertBefore, Value *SrcAddr,
   Type *LoopOpType = TTI.getMemcpyLoopLoweringType(
       Ctx, CopyLen, SrcAS, DstAS, SrcAlign.value(), DstAlign.value());
 
+  // Copy in vector-width blocks, paying one instrumented load/store pair per
+  // block instead of per element. Small copies keep the precise expansion
+  if (ClBlockedExpansion &&
+      CopyLen->getZExtValue() >= ClBlockedExpansionThreshold) {
+    LoopOpType = FixedVectorType::get(Type::getInt8Ty(Ctx),
+                                      BlockedExpansionWidth);
+  }
+
   unsigned LoopOpSize = DL.getTypeStoreSize(LoopOpType);
   uint64_t LoopEndCount = CopyLen->getZExtValue() / LoopOpSize;
 
@@ -168,6 +192,14 @@ static void createMemCpyLoopUnknownSize(Instruction *InsertBefore,
 
   Type *LoopOpType = TTI.getMemcpyLoopLoweringType(
       Ctx, CopyLen, SrcAS, DstAS, SrcAlign.value(), DstAlign.value());
+
+  // Unknown lengths always take the blocked loop when it is enabled - the
+  // existing residual loop mops up both short copies and the tail
+  if (ClBlockedExpansion) {
+    LoopOpType = FixedVectorType::get(Type::getInt8Ty(Ctx),
+                                      BlockedExpansionWidth);
+  }
+
   unsigned LoopOpSize = DL.getTypeStoreSize(LoopOpType);
 
   IRBuilder<> PLBuilder(PreLoopBB->getTerminator());
@@ -392,6 +424,94 @@ static void createMemMoveLoop(Instruction *InsertBefore, Value *SrcAddr,
   ElseTerm->eraseFromParent();
 }
 
+// Blocked variant of createMemSetLoop: store the set value in vector-width
+// blocks (one instrumented store per block), with a byte loop for the residual
+static void createBlockedMemSetLoop(Instruction *InsertBefore, Value *DstAddr,
+                                    Value *CopyLen, Value *SetValue,
+                                    Align DstAlign, bool IsVolatile) {
+  BasicBlock *PreLoopBB = InsertBefore->getParent();
+  BasicBlock *PostLoopBB =
+      PreLoopBB->splitBasicBlock(InsertBefore, "post-loop-memset-expansion");
+  Function *ParentFunc = PreLoopBB->getParent();
+  LLVMContext &Ctx = PreLoopBB->getContext();
+
+  Type *TypeOfCopyLen = CopyLen->getType();
+  IntegerType *ILengthType = dyn_cast<IntegerType>(TypeOfCopyLen);
+  assert(ILengthType &&
+         "expected size argument to memset to be an integer type!");
+  Type *Int8Type = Type::getInt8Ty(Ctx);
+  auto *BlockOpType = FixedVectorType::get(Int8Type, BlockedExpansionWidth);
+  unsigned DstAS = cast<PointerType>(DstAddr->getType())->getAddressSpace();
+
+  IRBuilder<> PLBuilder(PreLoopBB->getTerminator());
+
+  Value *DstAsInt8 =
+      PLBuilder.CreateBitCast(DstAddr, PointerType::get(Int8Type, DstAS));
+  Value *DstAsBlock =
+      PLBuilder.CreateBitCast(DstAddr, PointerType::get(BlockOpType, DstAS));
+  Value *BlockValue =
+      PLBuilder.CreateVectorSplat(BlockedExpansionWidth, SetValue);
+
+  ConstantInt *CIBlockSize =
+      ConstantInt::get(ILengthType, BlockedExpansionWidth);
+  Value *RuntimeBlockCount = PLBuilder.CreateUDiv(CopyLen, CIBlockSize);
+  Value *RuntimeResidual = PLBuilder.CreateURem(CopyLen, CIBlockSize);
+  Value *RuntimeBytesSet = PLBuilder.CreateSub(CopyLen, RuntimeResidual);
+
+  BasicBlock *LoopBB =
+      BasicBlock::Create(Ctx, "loop-memset-expansion", ParentFunc, PostLoopBB);
+  BasicBlock *ResLoopBB = BasicBlock::Create(Ctx, "loop-memset-residual",
+                                             ParentFunc, PostLoopBB);
+  BasicBlock *ResHeaderBB = BasicBlock::Create(
+      Ctx, "loop-memset-residual-header", ParentFunc, nullptr);
+
+  ConstantInt *Zero = ConstantInt::get(ILengthType, 0U);
+  PLBuilder.CreateCondBr(PLBuilder.CreateICmpNE(RuntimeBlockCount, Zero),
+                         LoopBB, ResHeaderBB);
+  PreLoopBB->getTerminator()->eraseFromParent();
+
+  Align PartDstAlign(commonAlignment(DstAlign, BlockedExpansionWidth));
+
+  IRBuilder<> LoopBuilder(LoopBB);
+  PHINode *LoopIndex = LoopBuilder.CreatePHI(TypeOfCopyLen, 2, "loop-index");
+  LoopIndex->addIncoming(Zero, PreLoopBB);
+
+  Value *DstGEP =
+      LoopBuilder.CreateInBoundsGEP(BlockOpType, DstAsBlock, LoopIndex);
+  LoopBuilder.CreateAlignedStore(BlockValue, DstGEP, PartDstAlign, IsVolatile);
+
+  Value *NewIndex =
+      LoopBuilder.CreateAdd(LoopIndex, ConstantInt::get(TypeOfCopyLen, 1U));
+  LoopIndex->addIncoming(NewIndex, LoopBB);
+  LoopBuilder.CreateCondBr(
+      LoopBuilder.CreateICmpULT(NewIndex, RuntimeBlockCount), LoopBB,
+      ResHeaderBB);
+
+  // Determine if we need to branch to the residual loop or bypass it
+  IRBuilder<> RHBuilder(ResHeaderBB);
+  RHBuilder.CreateCondBr(RHBuilder.CreateICmpNE(RuntimeResidual, Zero),
+                         ResLoopBB, PostLoopBB);
+
+  // Set the residual with a single byte store loop
+  IRBuilder<> ResBuilder(ResLoopBB);
+  PHINode *ResidualIndex =
+      ResBuilder.CreatePHI(TypeOfCopyLen, 2, "residual-loop-index");
+  ResidualIndex->addIncoming(Zero, ResHeaderBB);
+
+  Value *FullOffset = ResBuilder.CreateAdd(RuntimeBytesSet, ResidualIndex);
+  Value *ResDstGEP =
+      ResBuilder.CreateInBoundsGEP(Int8Type, DstAsInt8, FullOffset);
+  ResBuilder.CreateAlignedStore(SetValue, ResDstGEP, Align(1), IsVolatile);
+
+  Value *ResNewIndex =
+      ResBuilder.CreateAdd(ResidualIndex, ConstantInt::get(TypeOfCopyLen, 1U));
+  ResidualIndex->addIncoming(ResNewIndex, ResLoopBB);
+
+  ResBuilder.CreateCondBr(
+      ResBuilder.CreateICmpULT(ResNewIndex, RuntimeResidual), ResLoopBB,
+      PostLoopBB);
+}
+
 static void createMemSetLoop(Instruction *InsertBefore, Value *DstAddr,
                              Value *CopyLen, Value *SetValue, Align DstAlign,
                              bool IsVolatile) {
@@ -474,6 +594,18 @@ static void expandMemMoveAsLoop(MemMoveInst *Memmove) {
 }
 
 static void expandMemSetAsLoop(MemSetInst *Memset) {
+  auto *CI = dyn_cast<ConstantInt>(Memset->getLength());
+  if (ClBlockedExpansion &&
+      (!CI || CI->getZExtValue() >= ClBlockedExpansionThreshold)) {
+    createBlockedMemSetLoop(/* InsertBefore */ Memset,
+                            /* DstAddr */ Memset->getRawDest(),
+                            /* CopyLen */ Memset->getLength(),
+                            /* SetValue */ Memset->getValue(),
+                            /* Alignment */ Memset->getDestAlign().valueOrOne(),
+                            Memset->isVolatile());
+    return;
+  }
+
   createMemSetLoop(/* InsertBefore */ Memset,
                    /* DstAddr */ Memset->getRawDest(),
                    /* CopyLen */ Memset->getLength(),
@@ -36,6 +36,10 @@ using namespace llvm;
 STATISTIC(NumOfNewRewrites, "Number of news rewritten.");
 STATISTIC(NumOfDeleteRewrites, "Number of deletes rewritten.");
 
+/// Runtime free that takes the allocation size (as recorded in a sized
+/// `delete`) so that the allocator can skip reading the chunk header
+static const char *const SizedFreeFuncName = "__sized_free";
+
 namespace {
 
 /// RewriteNews: Rewrites calls to the `new` operator and replaces them with
@@ -68,13 +72,26 @@ static bool isNewFn(const Value *V, const TargetLibraryInfo *TLI) {
   if (TLIFn == LibFunc_Znwj || TLIFn == LibFunc_ZnwjRKSt9nothrow_t ||
       TLIFn == LibFunc_Znwm || TLIFn == LibFunc_ZnwmRKSt9nothrow_t ||
       TLIFn == LibFunc_Znaj || TLIFn == LibFunc_ZnajRKSt9nothrow_t ||
-      TLIFn == LibFunc_Znam || TLIFn == LibFunc_ZnamRKSt9nothrow_t) {
+      TLIFn == LibFunc_Znam || TLIFn == LibFunc_ZnamRKSt9nothrow_t ||
+      TLIFn == LibFunc_ZnwmSt11align_val_t ||
+      TLIFn == LibFunc_ZnwmSt11align_val_tRKSt9nothrow_t ||
+      TLIFn == LibFunc_ZnamSt11align_val_t ||
+      TLIFn == LibFunc_ZnamSt11align_val_tRKSt9nothrow_t) {
     return true;
   }
 
   return false;
 }
 
+/// Returns \c true if the given (aligned) `new` operator takes an
+/// `align_val_t` as its second argument
+static bool isAlignedNewFn(LibFunc TLIFn) {
+  return TLIFn == LibFunc_ZnwmSt11align_val_t ||
+         TLIFn == LibFunc_ZnwmSt11align_val_tRKSt9nothrow_t ||
+         TLIFn == LibFunc_ZnamSt11align_val_t ||
+         TLIFn == LibFunc_ZnamSt11align_val_tRKSt9nothrow_t;
+}
+
 static bool isDeleteFn(const Value *V, const TargetLibraryInfo *TLI) {
   if (!isa<Function>(V)) {
     return false;
@@ -87,21 +104,58 @@ static bool isDeleteFn(const Value *V, const TargetLibraryInfo *TLI) {
     return false;
   }
 
-  if (TLIFn == LibFunc_ZdlPv || TLIFn == LibFunc_ZdaPv) {
+  if (TLIFn == LibFunc_ZdlPv || TLIFn == LibFunc_ZdaPv ||
+      TLIFn == LibFunc_ZdlPvRKSt9nothrow_t ||
+      TLIFn == LibFunc_ZdaPvRKSt9nothrow_t || TLIFn == LibFunc_ZdlPvj ||
+      TLIFn == LibFunc_ZdlPvm || TLIFn == LibFunc_ZdaPvj ||
+      TLIFn == LibFunc_ZdaPvm || TLIFn == LibFunc_ZdlPvSt11align_val_t ||
+      TLIFn == LibFunc_ZdaPvSt11align_val_t ||
+      TLIFn == LibFunc_ZdlPvSt11align_val_tRKSt9nothrow_t ||
+      TLIFn == LibFunc_ZdaPvSt11align_val_tRKSt9nothrow_t ||
+      TLIFn == LibFunc_ZdlPvmSt11align_val_t ||
+      TLIFn == LibFunc_ZdaPvmSt11align_val_t) {
     return true;
   }
 
   return false;
 }
 
-static Instruction *rewriteNew(CallBase *CB) {
+/// Returns \c true if the given `delete` operator takes the allocation size
+/// as its second argument
+static bool isSizedDeleteFn(LibFunc TLIFn) {
+  return TLIFn == LibFunc_ZdlPvj || TLIFn == LibFunc_ZdlPvm ||
+         TLIFn == LibFunc_ZdaPvj || TLIFn == LibFunc_ZdaPvm ||
+         TLIFn == LibFunc_ZdlPvmSt11align_val_t ||
+         TLIFn == LibFunc_ZdaPvmSt11align_val_t;
+}
+
+static Instruction *rewriteNew(CallBase *CB, const TargetLibraryInfo *TLI) {
   LLVM_DEBUG(dbgs() << "rewriting new call " << *CB << '\n');
 
   Value *AllocSize = CB->getArgOperand(0);
 
-  auto *MallocCall = CallInst::CreateMalloc(
-      CB, AllocSize->getType(), CB->getType()->getPointerElementType(),
-      AllocSize, nullptr, nullptr, "rewrite_new");
+  LibFunc TLIFn;
+  TLI->getLibFunc(*cast<Function>(CB->getCalledOperand()), TLIFn);
+
+  Instruction *MallocCall = nullptr;
+  if (isAlignedNewFn(TLIFn)) {
+    // Aligned news carry their alignment as a second argument. Rewrite them to
+    // memalign, which preserves the alignment and is tagged by the same later
+    // pass as malloc
+    Module *M = CB->getModule();
+    Value *Alignment = CB->getArgOperand(1);
+
+    auto MemalignF =
+        M->getOrInsertFunction("memalign", CB->getType(), Alignment->getType(),
+                               AllocSize->getType());
+
+    MallocCall = CallInst::Create(MemalignF, {Alignment, AllocSize},
+                                  "rewrite_new", CB);
+  } else {
+    MallocCall = CallInst::CreateMalloc(
+        CB, AllocSize->getType(), CB->getType()->getPointerElementType(),
+        AllocSize, nullptr, nullptr, "rewrite_new");
+  }
 
   // If new was invoke-d, rather than call-ed, we must branch to the invoke's
   // normal destination.
@@ -139,12 +193,31 @@ static Instruction *rewriteNew(CallBase *CB) {
   return MallocCall;
 }
 
-static Instruction *rewriteDelete(CallBase *CB) {
+static Instruction *rewriteDelete(CallBase *CB, const TargetLibraryInfo *TLI) {
   LLVM_DEBUG(dbgs() << "rewriting delete call " << *CB << '\n');
 
-  Value *Ptr = CB->getArgOperand(CB->getNumArgOperands() - 1);
+  Value *Ptr = CB->getArgOperand(0);
+
+  LibFunc TLIFn;
+  TLI->getLibFunc(*cast<Function>(CB->getCalledOperand()), TLIFn);
+
+  Instruction *FreeCall = nullptr;
+  if (isSizedDeleteFn(TLIFn)) {
+    // Sized deletes know the allocation size statically. Forward it to the
+    // runtime so that the allocator doesn't have to read the chunk header to
+    // recover it
+    Module *M = CB->getModule();
+    LLVMContext &C = M->getContext();
+    Value *Size = CB->getArgOperand(1);
+
+    auto SizedFreeF = M->getOrInsertFunction(
+        SizedFreeFuncName, Type::getVoidTy(C), Ptr->getType(), Size->getType());
+
+    FreeCall = CallInst::Create(SizedFreeF, {Ptr, Size}, "", CB);
+  } else {
+    FreeCall = CallInst::CreateFree(Ptr, CB);
+  }
 
-  auto *FreeCall = CallInst::CreateFree(Ptr, CB);
   CB->replaceAllUsesWith(FreeCall);
   CB->eraseFromParent();
 
@@ -189,7 +262,7 @@ bool RewriteNews::runOnFunction(Function &F) {
 
   // Rewrite new calls
   for (auto &NewCall : NewCalls) {
-    auto *MallocCall = rewriteNew(NewCall);
+    auto *MallocCall = rewriteNew(NewCall, TLI);
 
     for (auto *MemI : MemIntrinsics) {
       if (GetUnderlyingObjectThroughLoads(MemI->getDest(), DL) == MallocCall) {
@@ -200,7 +273,7 @@ bool RewriteNews::runOnFunction(Function &F) {
 
   // Rewrite delete calls
   for (auto &DeleteCall : DeleteCalls) {
-    rewriteDelete(DeleteCall);
+    rewriteDelete(DeleteCall, TLI);
   }
 
   // Finished!
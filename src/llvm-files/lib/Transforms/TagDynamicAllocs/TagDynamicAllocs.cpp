@@ -21,12 +21,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Analysis/IndirectCallVisitor.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
@@ -34,11 +38,15 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include "Utils/FuzzallocUtils.h"
+#include "Utils/TagSiteDB.h"
 #include "debug.h"     // from afl
 #include "fuzzalloc.h" // from fuzzalloc
 
@@ -53,6 +61,25 @@ static cl::opt<std::string>
     ClLogPath("fuzzalloc-tag-log",
               cl::desc("Path to log file containing values to tag"));
 
+static cl::opt<std::string>
+    ClDBPath("fuzzalloc-tag-db",
+             cl::desc("Path to the binary tag-site database (used instead of "
+                      "the text tag log)"));
+
+static cl::opt<std::string> ClTagProfilePath(
+    "fuzzalloc-tag-profile",
+    cl::desc("Path to an allocation-site frequency profile "
+             "(`function:file:line:col count` lines). The hottest sites are "
+             "assigned maximally-spread tags, and all assignment becomes "
+             "deterministic per build"));
+
+static cl::opt<bool> ClDeterministicTags(
+    "fuzzalloc-deterministic-tags",
+    cl::desc("Derive def site tags from a hash of the call site's debug "
+             "location instead of the PRNG, so tag assignment is "
+             "reproducible across builds"),
+    cl::init(false));
+
 static cl::opt<bool> ClEnableIndirectCallTag(
     "enable-indirect-call-tagging",
     cl::desc("Enable static tagging of indirect call sites when possible"),
@@ -65,6 +92,7 @@ STATISTIC(NumOfTaggedFunctions, "Number of tagged functions.");
 STATISTIC(NumOfTaggedGlobalVariables, "Number of tagged global variables.");
 STATISTIC(NumOfTaggedGlobalAliases, "Number of tagged global aliases.");
 STATISTIC(NumOfTrampolines, "Number of trampoline functions inserted.");
+STATISTIC(NumOfManifestTags, "Number of def site tags in the tag manifest.");
 
 namespace {
 
@@ -77,11 +105,15 @@ private:
 
   Module *Mod;
 
-  Function *ReturnAddrF;
   Function *AbortF;
   Function *FuzzallocMallocF;
   Function *FuzzallocCallocF;
   Function *FuzzallocReallocF;
+  Function *FuzzallocPosixMemalignF;
+  Function *FuzzallocAlignedAllocF;
+  Function *FuzzallocMemalignF;
+  Function *FuzzallocStackAllocF;
+  Function *FuzzallocCachedAllocF;
 
   IntegerType *TagTy;
   IntegerType *SizeTTy;
@@ -93,11 +125,24 @@ private:
   std::map<StructOffset, FuncTypeString> StructOffsetsToTag;
   SmallPtrSet<Argument *, 8> FunctionArgsToTag;
 
+  /// Tags assigned up front from the site-frequency profile, keyed on the
+  /// call site's `function:file:line:col` debug location
+  StringMap<tag_t> ProfiledTags;
+
+  /// Every tag this module hands out, collected for the link-time tag
+  /// manifest. Mutable because tags are also assigned from the const
+  /// `generateTag`
+  mutable std::set<tag_t> AssignedTags;
+
   Constant *castAbort(Type *) const;
   Function *createTrampoline(Function *);
 
-  ConstantInt *generateTag() const;
+  std::string tagSiteKey(const CallBase *) const;
+  void loadTagProfile();
+  ConstantInt *generateTag(const CallBase *) const;
+  void emitTagManifest();
   void getTagSites();
+  void getTagSitesFromDB();
 
   bool isTaggableFunction(const Function *) const;
   bool isCustomAllocationFunction(const Function *) const;
@@ -128,6 +173,21 @@ static const char *const AbortFuncName = "abort";
 static const char *const FuzzallocMallocFuncName = "__tagged_malloc";
 static const char *const FuzzallocCallocFuncName = "__tagged_calloc";
 static const char *const FuzzallocReallocFuncName = "__tagged_realloc";
+static const char *const FuzzallocPosixMemalignFuncName =
+    "__tagged_posix_memalign";
+static const char *const FuzzallocAlignedAllocFuncName =
+    "__tagged_aligned_alloc";
+static const char *const FuzzallocMemalignFuncName = "__tagged_memalign";
+static const char *const FuzzallocStackAllocFuncName = "__tagged_stack_alloc";
+static const char *const FuzzallocCachedAllocFuncName = "__tagged_cached_alloc";
+
+/// The untagged frame-scoped bump and per-site caching allocators inserted by
+/// the HeapifyAllocas pass (see HeapifyUtils.h)
+static const char *const StackAllocFuncName = "__stack_alloc";
+static const char *const CachedAllocFuncName = "__cached_alloc";
+
+/// Section holding the link-time tag manifest (see emitTagManifest)
+static const char *const TagManifestSectionName = "fuzzalloc_tags";
 
 char TagDynamicAllocs::ID = 0;
 
@@ -168,25 +228,32 @@ Function *TagDynamicAllocs::createTrampoline(Function *OrigF) {
 
   IRBuilder<> IRB(TrampolineBB);
 
-  // Use the trampoline's return address (modulo the max tag) as the allocation
-  // site tag
-  auto *RetAddr = IRB.CreateCall(this->ReturnAddrF, IRB.getInt32(0));
-
-  // XXX I have no idea why I need to cast the return address pointer to a large
-  // integer, then mask off the MSBs before casting to the correct type (tag_t).
-  // However, if I don't do this, the LLVM backend generates the wrong mov
-  // instruction and everything breaks :(
-  Value *Tag = IRB.CreatePtrToInt(RetAddr, this->SizeTTy);
-  Value *CastTag =
-      IRB.CreateIntCast(IRB.CreateAnd(Tag, FUZZALLOC_TAG_MASK), this->TagTy,
-                        /* isSigned */ false);
-  Value *ModTag =
-      IRB.CreateURem(CastTag, ConstantInt::get(this->TagTy, ClDefSiteTagMax));
+  // Each trampoline owns a static slot holding its assigned tag, so tagging
+  // an indirect allocation call is a single load from a link-time-resolved
+  // address instead of per-call return-address arithmetic - and the tag is
+  // deterministic across runs, where the return address changed with ASLR.
+  // The slot is a weak global so duplicate trampolines emitted into other
+  // translation units resolve to a single slot at link time
+  const auto TagSlotName =
+      "fuzzalloc.__trampoline_tag_" + OrigF->getName().str();
+  GlobalVariable *TagSlot = this->Mod->getGlobalVariable(TagSlotName);
+  if (!TagSlot) {
+    // Hash the slot name into the tag range so the assignment is stable
+    // across builds (the same idiom generateTag uses for unprofiled sites)
+    const uint64_t Range = ClDefSiteTagMax - ClDefSiteTagMin + 1;
+    auto *SlotTag = ConstantInt::get(
+        this->TagTy, ClDefSiteTagMin + xxHash64(TagSlotName) % Range);
+    TagSlot =
+        new GlobalVariable(*this->Mod, this->TagTy, /* isConstant */ false,
+                           GlobalValue::WeakAnyLinkage, SlotTag, TagSlotName);
+    this->AssignedTags.insert((tag_t)SlotTag->getZExtValue());
+  }
+  Value *Tag = IRB.CreateLoad(TagSlot);
 
   // Call a tagged version of the dynamic memory allocation function and return
   // its result
   Function *TaggedF = translateTaggedFunction(OrigF);
-  SmallVector<Value *, 4> TaggedCallArgs = {ModTag};
+  SmallVector<Value *, 4> TaggedCallArgs = {Tag};
   for (auto &Arg : TrampolineF->args()) {
     TaggedCallArgs.push_back(&Arg);
   }
@@ -198,8 +265,145 @@ Function *TagDynamicAllocs::createTrampoline(Function *OrigF) {
 }
 
 /// Generate a random tag
-ConstantInt *TagDynamicAllocs::generateTag() const {
-  return ConstantInt::get(this->TagTy, RAND(ClDefSiteTagMin, ClDefSiteTagMax));
+/// Build the stable identifier of an allocation call site. Returns an empty
+/// string when the call site has no debug location
+std::string TagDynamicAllocs::tagSiteKey(const CallBase *CB) const {
+  DILocation *Loc = CB->getDebugLoc();
+  if (!Loc) {
+    return "";
+  }
+
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << CB->getFunction()->getName() << ':' << Loc->getFilename() << ':'
+     << Loc->getLine() << ':' << Loc->getColumn();
+  return OS.str();
+}
+
+/// Load the allocation-site frequency profile and assign the hottest sites
+/// maximally-spread tags.
+///
+/// Sites are sorted by descending count (ties broken on the key, so the
+/// result is deterministic) and tag `i` is `ClDefSiteTagMin + i * Stride`,
+/// where `Stride` spreads the sites evenly across the tag range. Spreading
+/// the hottest sites far apart keeps their hashed def-use features in
+/// distinct map cache lines and avoids collisions between the sites that
+/// produce most of the feedback
+void TagDynamicAllocs::loadTagProfile() {
+  auto InputOrErr = MemoryBuffer::getFile(ClTagProfilePath);
+  if (auto EC = InputOrErr.getError()) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "unable to open fuzzalloc tag profile at " << ClTagProfilePath
+       << ": " << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  SmallVector<StringRef, 64> Lines;
+  InputOrErr.get()->getBuffer().split(Lines, '\n', /* MaxSplit */ -1,
+                                      /* KeepEmpty */ false);
+
+  SmallVector<std::pair<uint64_t, StringRef>, 64> Sites;
+  for (auto Line : Lines) {
+    if (Line.startswith("#")) {
+      continue;
+    }
+
+    StringRef Key, CountStr;
+    std::tie(Key, CountStr) = Line.rsplit(' ');
+
+    uint64_t Count;
+    if (Key.empty() || CountStr.getAsInteger(0, Count)) {
+      continue;
+    }
+
+    Sites.emplace_back(Count, Key);
+  }
+
+  if (Sites.empty()) {
+    return;
+  }
+
+  llvm::sort(Sites, [](const std::pair<uint64_t, StringRef> &LHS,
+                       const std::pair<uint64_t, StringRef> &RHS) {
+    if (LHS.first != RHS.first) {
+      return LHS.first > RHS.first;
+    }
+    return LHS.second < RHS.second;
+  });
+
+  const uint64_t Range = ClDefSiteTagMax - ClDefSiteTagMin + 1;
+  const uint64_t Stride = std::max(Range / Sites.size(), UINT64_C(1));
+
+  for (uint64_t I = 0; I < Sites.size(); ++I) {
+    this->ProfiledTags.insert(
+        {Sites[I].second, (tag_t)(ClDefSiteTagMin + (I * Stride) % Range)});
+  }
+}
+
+ConstantInt *TagDynamicAllocs::generateTag(const CallBase *CB) const {
+  ConstantInt *Tag = nullptr;
+
+  if (CB && (!ClTagProfilePath.empty() || ClDeterministicTags)) {
+    const auto Key = tagSiteKey(CB);
+    if (!Key.empty()) {
+      auto It = this->ProfiledTags.find(Key);
+      if (It != this->ProfiledTags.end()) {
+        Tag = ConstantInt::get(this->TagTy, It->second);
+      } else {
+        // Unprofiled site - hash the key so the assignment is still
+        // deterministic across builds
+        const uint64_t Range = ClDefSiteTagMax - ClDefSiteTagMin + 1;
+        Tag = ConstantInt::get(this->TagTy,
+                               ClDefSiteTagMin + xxHash64(Key) % Range);
+      }
+    }
+  }
+
+  if (!Tag) {
+    Tag = ConstantInt::get(this->TagTy, RAND(ClDefSiteTagMin, ClDefSiteTagMax));
+  }
+
+  this->AssignedTags.insert((tag_t)Tag->getZExtValue());
+
+  return Tag;
+}
+
+/// Emit one entry per assigned def site tag into the `fuzzalloc_tags`
+/// section. The linker concatenates the entries from every translation unit
+/// and provides `__start`/`__stop` symbols for the section, giving the
+/// runtime a manifest of every tag this binary can allocate with - it
+/// eagerly creates their mspaces at startup (see malloc.c) so the
+/// first-allocation slow path never fires mid-run
+void TagDynamicAllocs::emitTagManifest() {
+  if (this->AssignedTags.empty()) {
+    return;
+  }
+
+  // Entries must pack into the contiguous `tag_t` array the runtime walks,
+  // so use the runtime's tag_t width (i16 up to 16 tag bits, i32 beyond) and
+  // alignment - NUM_TAG_BITS itself need not be a byte multiple, let alone a
+  // power of two
+  auto *ManifestTy =
+      Type::getIntNTy(this->Mod->getContext(), 8 * sizeof(tag_t));
+
+  SmallVector<GlobalValue *, 16> Entries;
+  for (tag_t Tag : this->AssignedTags) {
+    auto *GV = new GlobalVariable(*this->Mod, ManifestTy,
+                                  /* isConstant */ true,
+                                  GlobalValue::PrivateLinkage,
+                                  ConstantInt::get(ManifestTy, Tag),
+                                  "fuzzalloc.tag_manifest");
+    GV->setSection(TagManifestSectionName);
+    GV->setAlignment(Align(sizeof(tag_t)));
+
+    Entries.push_back(GV);
+    NumOfManifestTags++;
+  }
+
+  // The entries have no IR users - pin them so they survive into the binary
+  appendToUsed(*this->Mod, Entries);
 }
 
 void TagDynamicAllocs::getTagSites() {
@@ -217,6 +421,28 @@ void TagDynamicAllocs::getTagSites() {
     this->FunctionsToTag.insert(ReallocF);
   }
 
+  // Likewise for the aligned allocation family, so that targets using
+  // posix_memalign/aligned_alloc/memalign stay on the tagged path
+  for (const auto *Name : {"posix_memalign", "aligned_alloc", "memalign"}) {
+    if (auto *AlignedF = this->Mod->getFunction(Name)) {
+      this->FunctionsToTag.insert(AlignedF);
+    }
+  }
+
+  // And for the frame-scoped bump and per-site caching allocators inserted
+  // by HeapifyAllocas
+  if (auto *StackAllocF = this->Mod->getFunction(StackAllocFuncName)) {
+    this->FunctionsToTag.insert(StackAllocF);
+  }
+  if (auto *CachedAllocF = this->Mod->getFunction(CachedAllocFuncName)) {
+    this->FunctionsToTag.insert(CachedAllocF);
+  }
+
+  if (!ClDBPath.empty()) {
+    getTagSitesFromDB();
+    return;
+  }
+
   if (ClLogPath.empty()) {
     return;
   }
@@ -315,17 +541,91 @@ void TagDynamicAllocs::getTagSites() {
   }
 }
 
-bool TagDynamicAllocs::isTaggableFunction(const Function *F) const {
+/// Read the tag sites from the binary database. Unlike the text log, records
+/// are consumed in place from the mmap-ed file - no line splitting or type
+/// string parsing - and the per-record hash makes deduplicating the appends
+/// from every translation unit cheap
+void TagDynamicAllocs::getTagSitesFromDB() {
+  LLVMContext &C = this->Mod->getContext();
+
+  auto InputOrErr = MemoryBuffer::getFile(ClDBPath);
+  std::error_code EC = InputOrErr.getError();
+  if (EC) {
+    std::string Err;
+    raw_string_ostream OS(Err);
+    OS << "Unable to read fuzzalloc tag-site database at " << ClDBPath << ": "
+       << EC.message();
+    OS.flush();
+    report_fatal_error(Err);
+  }
+
+  // Records already handled, keyed on (kind, aux, name hash). The database
+  // contains one append per translation unit, so most records are duplicates
+  DenseSet<std::pair<uint64_t, uint64_t>> SeenRecords;
+
+  TagSiteDBReader Reader(InputOrErr.get()->getBuffer());
+  StringRef Name, FuncName, TypeStr;
+  while (const TagSiteRecord *Record = Reader.next(Name, FuncName, TypeStr)) {
+    uint64_t KindAndAux = ((uint64_t)Record->Kind << 32) | Record->Aux;
+    if (!SeenRecords.insert({KindAndAux, Record->Hash}).second) {
+      continue;
+    }
+
+    switch (static_cast<TagSiteKind>(Record->Kind)) {
+    case TagSiteKind::Function: {
+      // XXX ignore the type (for now), as with the text log
+      if (auto *F = this->Mod->getFunction(Name)) {
+        this->FunctionsToTag.insert(F);
+      }
+      break;
+    }
+    case TagSiteKind::GlobalVariable: {
+      if (auto *GV = this->Mod->getGlobalVariable(Name)) {
+        this->GlobalVariablesToTag.insert(GV);
+      }
+      break;
+    }
+    case TagSiteKind::GlobalAlias: {
+      if (auto *GA = this->Mod->getNamedAlias(Name)) {
+        this->GlobalAliasesToTag.insert(GA);
+      }
+      break;
+    }
+    case TagSiteKind::StructOffset: {
+      if (auto *StructTy = StructType::getTypeByName(C, Name)) {
+        this->StructOffsetsToTag.emplace(
+            std::make_pair(StructTy, Record->Aux),
+            std::make_pair(FuncName.str(), TypeStr.str()));
+      }
+      break;
+    }
+    case TagSiteKind::FunctionArg: {
+      if (auto *F = this->Mod->getFunction(Name)) {
+        this->FunctionArgsToTag.insert(F->arg_begin() + Record->Aux);
+      }
+      break;
+    }
+    }
+  }
+}
+
+/// Returns \c true if the given function is a standard allocation function
+/// with a corresponding fuzzalloc implementation
+static bool isStandardAllocationFunction(const Function *F) {
   StringRef Name = F->getName();
 
   return Name == "malloc" || Name == "calloc" || Name == "realloc" ||
+         Name == "posix_memalign" || Name == "aligned_alloc" ||
+         Name == "memalign";
+}
+
+bool TagDynamicAllocs::isTaggableFunction(const Function *F) const {
+  return isStandardAllocationFunction(F) ||
          this->FunctionsToTag.count(F) > 0;
 }
 
 bool TagDynamicAllocs::isCustomAllocationFunction(const Function *F) const {
-  StringRef Name = F->getName();
-
-  return Name != "malloc" && Name != "calloc" && Name != "realloc" &&
+  return !isStandardAllocationFunction(F) &&
          this->FunctionsToTag.count(F) > 0;
 }
 
@@ -402,7 +702,22 @@ void TagDynamicAllocs::tagUser(User *U, Function *F,
     // function with
     Function *NewF = nullptr;
 
-    if (isMallocLikeFn(U, TLI, /*LookThroughBitCast=*/true)) {
+    // Check the aligned allocation family by name first - some versions of
+    // MemoryBuiltins classify aligned_alloc as malloc-like, which would drop
+    // the alignment argument
+    StringRef CalledName = CalledValue->getName();
+
+    if (CalledName == "posix_memalign") {
+      NewF = this->FuzzallocPosixMemalignF;
+    } else if (CalledName == "aligned_alloc") {
+      NewF = this->FuzzallocAlignedAllocF;
+    } else if (CalledName == "memalign") {
+      NewF = this->FuzzallocMemalignF;
+    } else if (CalledName == StackAllocFuncName) {
+      NewF = this->FuzzallocStackAllocF;
+    } else if (CalledName == CachedAllocFuncName) {
+      NewF = this->FuzzallocCachedAllocF;
+    } else if (isMallocLikeFn(U, TLI, /*LookThroughBitCast=*/true)) {
       NewF = this->FuzzallocMallocF;
     } else if (isCallocLikeFn(U, TLI, /*LookThroughBitCast=*/true)) {
       NewF = this->FuzzallocCallocF;
@@ -480,7 +795,7 @@ Instruction *TagDynamicAllocs::tagCall(CallBase *CB, Value *NewCallee) const {
   auto *ParentF = CB->getFunction();
   Value *Tag = this->TaggedFunctions.count(ParentF) > 0
                    ? ParentF->arg_begin()
-                   : static_cast<Value *>(generateTag());
+                   : static_cast<Value *>(generateTag(CB));
 
   // Copy the original allocation function call's arguments so that the tag is
   // the first argument passed to the tagged function
@@ -880,7 +1195,6 @@ bool TagDynamicAllocs::runOnModule(Module &M) {
   PointerType *Int8PtrTy = Type::getInt8PtrTy(C);
   Type *VoidTy = Type::getVoidTy(C);
 
-  this->ReturnAddrF = Intrinsic::getDeclaration(&M, Intrinsic::returnaddress);
   this->AbortF =
       checkFuzzallocFunc(M.getOrInsertFunction(AbortFuncName, VoidTy));
   this->AbortF->setDoesNotReturn();
@@ -906,6 +1220,39 @@ bool TagDynamicAllocs::runOnModule(Module &M) {
   this->FuzzallocReallocF->addFnAttr(
       Attribute::getWithAllocSizeArgs(C, 2, None));
 
+  this->FuzzallocPosixMemalignF = checkFuzzallocFunc(M.getOrInsertFunction(
+      FuzzallocPosixMemalignFuncName, Type::getInt32Ty(C), this->TagTy,
+      Int8PtrTy->getPointerTo(), this->SizeTTy, this->SizeTTy));
+
+  this->FuzzallocAlignedAllocF = checkFuzzallocFunc(
+      M.getOrInsertFunction(FuzzallocAlignedAllocFuncName, Int8PtrTy,
+                            this->TagTy, this->SizeTTy, this->SizeTTy));
+  this->FuzzallocAlignedAllocF->addFnAttr(
+      Attribute::getWithAllocSizeArgs(C, 2, None));
+
+  this->FuzzallocMemalignF = checkFuzzallocFunc(
+      M.getOrInsertFunction(FuzzallocMemalignFuncName, Int8PtrTy, this->TagTy,
+                            this->SizeTTy, this->SizeTTy));
+  this->FuzzallocMemalignF->addFnAttr(
+      Attribute::getWithAllocSizeArgs(C, 2, None));
+
+  this->FuzzallocStackAllocF = checkFuzzallocFunc(M.getOrInsertFunction(
+      FuzzallocStackAllocFuncName, Int8PtrTy, this->TagTy, this->SizeTTy));
+  this->FuzzallocStackAllocF->addFnAttr(
+      Attribute::getWithAllocSizeArgs(C, 1, None));
+
+  this->FuzzallocCachedAllocF = checkFuzzallocFunc(
+      M.getOrInsertFunction(FuzzallocCachedAllocFuncName, Int8PtrTy,
+                            this->TagTy, this->SizeTTy, Int8PtrTy));
+  this->FuzzallocCachedAllocF->addFnAttr(
+      Attribute::getWithAllocSizeArgs(C, 1, None));
+
+  // Load the site-frequency profile (if any) so the hottest allocation sites
+  // get their spread tags
+  if (!ClTagProfilePath.empty()) {
+    loadTagProfile();
+  }
+
   // Figure out what we need to tag
   getTagSites();
 
@@ -963,6 +1310,10 @@ bool TagDynamicAllocs::runOnModule(Module &M) {
     F->eraseFromParent();
   }
 
+  // Record every tag handed out above so the runtime can create their
+  // mspaces eagerly at startup
+  emitTagManifest();
+
   // Finished!
 
   printStatistic(M, NumOfTaggedDirectCalls);
@@ -971,6 +1322,7 @@ bool TagDynamicAllocs::runOnModule(Module &M) {
   printStatistic(M, NumOfTaggedGlobalVariables);
   printStatistic(M, NumOfTaggedGlobalAliases);
   printStatistic(M, NumOfTrampolines);
+  printStatistic(M, NumOfManifestTags);
 
   return true;
 }
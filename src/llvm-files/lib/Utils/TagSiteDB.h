@@ -0,0 +1,121 @@
+//===-- TagSiteDB.h - Binary tag-site database ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Compact binary database of allocation sites to tag, shared between the
+/// \c CollectTagSites and \c TagDynamicAllocs passes. Producers append all of
+/// a translation unit's records with a single `O_APPEND` write, so parallel
+/// compile jobs do not interleave records and need no file locking. Consumers
+/// read the records in place from an mmap-ed buffer with no text parsing.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef FUZZALLOC_TAG_SITE_DB_H
+#define FUZZALLOC_TAG_SITE_DB_H
+
+#include <cstdint>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/xxhash.h"
+
+/// Record kinds, mirroring the text tag log prefixes
+enum class TagSiteKind : uint8_t {
+  Function = 0,
+  GlobalVariable,
+  GlobalAlias,
+  StructOffset,
+  FunctionArg,
+};
+
+/// On-disk record header. All fields are stored in host byte order: the
+/// database only lives for the duration of a single (native) two-phase build
+struct TagSiteRecord {
+  /// Record kind (a \c TagSiteKind)
+  uint8_t Kind;
+  uint8_t Unused[3];
+  /// Total record size, including this header and the trailing strings.
+  /// Always a multiple of eight so that successive headers stay naturally
+  /// aligned in the mmap-ed buffer
+  uint32_t Size;
+  /// xxHash64 of the primary name. Lets consumers index or deduplicate
+  /// records without touching the string data
+  uint64_t Hash;
+  /// Struct offset (\c StructOffset records) or argument index
+  /// (\c FunctionArg records); zero otherwise
+  uint32_t Aux;
+  uint32_t Unused2;
+  // Three NUL-terminated strings follow: the primary name, a function name
+  // (StructOffset records only, else empty), and a function type string
+  // (Function and StructOffset records, else empty)
+};
+
+static_assert(sizeof(TagSiteRecord) == 24, "Unexpected record header size");
+
+/// Append one record to an in-memory database buffer
+inline void appendTagSiteRecord(llvm::SmallVectorImpl<char> &Buf,
+                                TagSiteKind Kind, llvm::StringRef Name,
+                                uint32_t Aux = 0, llvm::StringRef FuncName = "",
+                                llvm::StringRef TypeStr = "") {
+  TagSiteRecord Record = {};
+  Record.Kind = static_cast<uint8_t>(Kind);
+  Record.Size =
+      (sizeof(TagSiteRecord) + Name.size() + FuncName.size() + TypeStr.size() +
+       3 /* NULs */ + 7) &
+      ~7U;
+  Record.Hash = llvm::xxHash64(Name);
+  Record.Aux = Aux;
+
+  size_t Start = Buf.size();
+  const char *RecordBytes = reinterpret_cast<const char *>(&Record);
+  Buf.append(RecordBytes, RecordBytes + sizeof(TagSiteRecord));
+  for (auto Str : {Name, FuncName, TypeStr}) {
+    Buf.append(Str.begin(), Str.end());
+    Buf.push_back('\0');
+  }
+  while (Buf.size() - Start < Record.Size) {
+    Buf.push_back('\0');
+  }
+}
+
+/// Iterates over the records of an mmap-ed database buffer
+class TagSiteDBReader {
+private:
+  const char *Cur;
+  const char *End;
+
+public:
+  TagSiteDBReader(llvm::StringRef Buf) : Cur(Buf.begin()), End(Buf.end()) {}
+
+  /// Get the next record (and its strings), or \c nullptr at the end of the
+  /// database (or at a truncated trailing record)
+  const TagSiteRecord *next(llvm::StringRef &Name, llvm::StringRef &FuncName,
+                            llvm::StringRef &TypeStr) {
+    if (Cur + sizeof(TagSiteRecord) > End) {
+      return nullptr;
+    }
+
+    const auto *Record = reinterpret_cast<const TagSiteRecord *>(Cur);
+    if (Record->Size < sizeof(TagSiteRecord) || Cur + Record->Size > End) {
+      return nullptr;
+    }
+
+    const char *Str = Cur + sizeof(TagSiteRecord);
+    Name = llvm::StringRef(Str);
+    Str += Name.size() + 1;
+    FuncName = llvm::StringRef(Str);
+    Str += FuncName.size() + 1;
+    TypeStr = llvm::StringRef(Str);
+
+    Cur += Record->Size;
+    return Record;
+  }
+};
+
+#endif // FUZZALLOC_TAG_SITE_DB_H
@@ -0,0 +1,59 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+// Shared-memory per-tag allocation statistics. Unlike the DEBUG_MSG prints
+// (which are compiled out in release builds), these counters are always
+// compiled in and enabled at runtime by pointing FUZZALLOC_ALLOC_STATS at a
+// SysV shared memory key, so a running campaign can be inspected with
+// `fuzzalloc-stat` without an instrumented-debug rebuild
+//
+
+#include <stdlib.h>  // for getenv, strtol
+#include <string.h>  // for memset
+#include <sys/shm.h> // for shmget, shmat
+#include <unistd.h>  // for _exit
+
+#include "alloc_stats.h"
+#include "debug.h"
+
+/// Fallback so that the update paths always have somewhere valid to write
+static alloc_stats_t dummy_alloc_stats[FUZZALLOC_TAG_MAX + 1];
+
+alloc_stats_t *__alloc_stats_ptr = dummy_alloc_stats;
+int __alloc_stats_enabled = 0;
+
+/// Create (or attach to) the shared-memory statistics segment. Runs before
+/// main, like the dataflow map handshake in dataflow_map.c
+__attribute__((constructor)) static void __alloc_stats_shm(void) {
+  char *key_str = getenv(ALLOC_STATS_KEY_ENV_VAR);
+  if (!key_str) {
+    // Statistics not requested
+    return;
+  }
+
+  key_t key = (key_t)strtol(key_str, NULL, 0);
+
+  int shm_id = shmget(key, ALLOC_STATS_SIZE, IPC_CREAT | 0600);
+  if (shm_id < 0) {
+    // Same behaviour as AFL when the shared memory handshake fails
+    _exit(1);
+  }
+
+  void *stats = shmat(shm_id, NULL, 0);
+  if (stats == (void *)(-1)) {
+    _exit(1);
+  }
+
+  // The segment may be left over from a previous run - don't let stale
+  // counters leak into this one
+  memset(stats, 0, ALLOC_STATS_SIZE);
+
+  DEBUG_MSG("allocation statistics (key %#x, size %lu bytes) attached at "
+            "%p\n",
+            key, ALLOC_STATS_SIZE, stats);
+  __alloc_stats_ptr = stats;
+  __alloc_stats_enabled = 1;
+}
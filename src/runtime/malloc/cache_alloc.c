@@ -0,0 +1,105 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#include <stdlib.h> // for free
+
+#include "debug.h"
+#include "malloc_internal.h"
+
+/// A per-allocation-site cache slot. The HeapifyAllocas pass emits one
+/// internal global of this layout per heapified alloca (see
+/// `createAllocCacheSlot`): the first call allocates, later calls reuse the
+/// same buffer, and the buffer is only reallocated when the requested size
+/// grows. A heapified buffer in a function called in a tight loop then costs
+/// a pointer load and a size check per call instead of a malloc/free pair.
+///
+/// `depth` is non-zero while the cached buffer is handed out, so re-entrant
+/// calls (recursion) fall back to a fresh allocation instead of sharing the
+/// buffer between live frames
+struct alloc_cache {
+  void *ptr;
+  size_t size;
+  size_t depth;
+};
+
+#if defined(FUZZALLOC_USE_LOCKS)
+static pthread_mutex_t cache_alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ACQUIRE_CACHE_ALLOC_LOCK() (pthread_mutex_lock(&cache_alloc_mutex))
+#define RELEASE_CACHE_ALLOC_LOCK() (pthread_mutex_unlock(&cache_alloc_mutex))
+#else // No locking
+#define ACQUIRE_CACHE_ALLOC_LOCK()
+#define RELEASE_CACHE_ALLOC_LOCK()
+#endif // defined(FUZZALLOC_USE_LOCKS)
+
+extern void *__tagged_malloc(tag_t def_site_tag, size_t size);
+
+void *__tagged_cached_alloc(tag_t def_site_tag, size_t size, void *cache) {
+  DEBUG_MSG("__tagged_cached_alloc(%#x, %lu, %p) called from %p\n",
+            def_site_tag, size, cache, __builtin_return_address(0));
+
+  struct alloc_cache *slot = cache;
+
+  ACQUIRE_CACHE_ALLOC_LOCK();
+
+  if (slot->depth == 0) {
+    // Reallocate only when the requested size outgrows the cached buffer
+    if (slot->ptr && slot->size < size) {
+      free(slot->ptr);
+      slot->ptr = NULL;
+    }
+
+    if (!slot->ptr) {
+      slot->ptr = __tagged_malloc(def_site_tag, size);
+      if (!slot->ptr) {
+        RELEASE_CACHE_ALLOC_LOCK();
+        return NULL;
+      }
+      slot->size = size;
+    }
+
+    slot->depth = 1;
+
+    RELEASE_CACHE_ALLOC_LOCK();
+    return slot->ptr;
+  }
+
+  RELEASE_CACHE_ALLOC_LOCK();
+
+  // The slot is already handed out (recursion or another thread) - fall back
+  // to a fresh allocation; `__cached_release` frees pointers that are not the
+  // cached buffer
+  return __tagged_malloc(def_site_tag, size);
+}
+
+void __cached_release(void *ptr, void *cache) {
+  DEBUG_MSG("__cached_release(%p, %p) called from %p\n", ptr, cache,
+            __builtin_return_address(0));
+
+  if (!ptr) {
+    return;
+  }
+
+  struct alloc_cache *slot = cache;
+
+  ACQUIRE_CACHE_ALLOC_LOCK();
+
+  if (ptr == slot->ptr) {
+    // Keep the buffer for the next call
+    slot->depth = 0;
+    RELEASE_CACHE_ALLOC_LOCK();
+    return;
+  }
+
+  RELEASE_CACHE_ALLOC_LOCK();
+
+  free(ptr);
+}
+
+/// Untagged entry point, for code built without the TagDynamicAllocs pass
+void *__cached_alloc(size_t size, void *cache) {
+  return __tagged_cached_alloc(FUZZALLOC_DEFAULT_TAG, size, cache);
+}
@@ -0,0 +1,102 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+// Dedicated shared-memory dataflow map. Keeping def-use features out of
+// AFL's 64 KB edge map stops them colliding with edge coverage and lets the
+// map be sized to the tag space independently of the fuzzer
+//
+
+#include <stdlib.h>   // for getenv, strtoul, atoi
+#include <sys/mman.h> // for mmap
+#include <sys/shm.h>  // for shmat, shmctl
+#include <unistd.h>   // for _exit
+
+#include "dataflow_map.h"
+#include "debug.h"
+
+/// The map size the instrumentation was compiled with
+/// (`-fuzzalloc-dataflow-map-size`). Emitted as a weak constant by
+/// InstrumentMemAccesses; null when this binary was not built with the
+/// dedicated map
+extern const size_t __dataflow_map_compiled_size __attribute__((weak));
+
+/// Bootstrap map for instrumented code that runs before the constructor
+/// below. Replaced with a correctly-sized mapping there when the binary was
+/// compiled with a larger map
+static uint8_t dummy_dataflow_map[DATAFLOW_MAP_DEFAULT_SIZE];
+
+uint8_t *__dataflow_area_ptr = dummy_dataflow_map;
+size_t __dataflow_map_size = DATAFLOW_MAP_DEFAULT_SIZE;
+
+/// Attach to the shared-memory dataflow map set up by the fuzzer. Runs
+/// before main, like AFL's own shared memory handshake
+__attribute__((constructor)) static void __dataflow_map_shm(void) {
+  // The instrumentation masks map indices with the compiled size, so that is
+  // the hard lower bound on every map this process can safely write to
+  const size_t compiled_size =
+      &__dataflow_map_compiled_size ? __dataflow_map_compiled_size : 0;
+  if (compiled_size > __dataflow_map_size) {
+    __dataflow_map_size = compiled_size;
+  }
+
+  char *map_size_str = getenv(DATAFLOW_MAP_SIZE_ENV_VAR);
+  if (map_size_str) {
+    char *endptr;
+    size_t map_size = strtoul(map_size_str, &endptr, 0);
+    if (map_size == 0 || (map_size & (map_size - 1)) != 0 ||
+        *endptr != '\0' || map_size_str == endptr) {
+      DEBUG_MSG("unable to read %s environment variable: %s\n",
+                DATAFLOW_MAP_SIZE_ENV_VAR, map_size_str);
+    } else if (map_size < compiled_size) {
+      // A smaller negotiated map would be written out of bounds on every
+      // map hit - fail the handshake instead
+      DEBUG_MSG("negotiated dataflow map size %lu is smaller than the "
+                "compiled size %lu\n",
+                map_size, compiled_size);
+      _exit(1);
+    } else {
+      __dataflow_map_size = map_size;
+    }
+  }
+
+  char *shm_id_str = getenv(DATAFLOW_SHM_ENV_VAR);
+  if (!shm_id_str) {
+    // Not running under the fuzzer (crash triage, manual repro). The static
+    // bootstrap map only covers the default size - binaries compiled with a
+    // larger map get an anonymous mapping of the full size
+    if (__dataflow_map_size > sizeof(dummy_dataflow_map)) {
+      void *map = mmap(NULL, __dataflow_map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (map == (void *)(-1)) {
+        DEBUG_MSG("unable to allocate fallback dataflow map\n");
+        _exit(1);
+      }
+      __dataflow_area_ptr = map;
+    }
+    return;
+  }
+
+  int shm_id = atoi(shm_id_str);
+  void *map = shmat(shm_id, NULL, 0);
+  if (map == (void *)(-1)) {
+    // Same behaviour as AFL when the shared memory handshake fails
+    _exit(1);
+  }
+
+  // Refuse a segment smaller than what the instrumentation will index
+  struct shmid_ds shm_info;
+  if (shmctl(shm_id, IPC_STAT, &shm_info) != 0 ||
+      shm_info.shm_segsz < __dataflow_map_size) {
+    DEBUG_MSG("dataflow map segment is smaller than the map size "
+              "(%lu bytes)\n",
+              __dataflow_map_size);
+    _exit(1);
+  }
+
+  DEBUG_MSG("dataflow map (size %lu bytes) attached at %p\n",
+            __dataflow_map_size, map);
+  __dataflow_area_ptr = map;
+}
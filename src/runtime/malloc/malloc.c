@@ -6,21 +6,50 @@
 //
 
 #include <errno.h>    // for errno, EINVAL, ENOMEM
+#include <signal.h>   // for sigaction
 #include <stddef.h>   // for ptrdiff_t
 #include <stdint.h>   // for uintptr_t
 #include <stdlib.h>   // for abort, getenv
 #include <string.h>   // for memcpy, memset
-#include <sys/mman.h> // for mmap
-#include <unistd.h>   // for getpagesize
+#include <sys/mman.h>    // for mmap, mprotect
+#include <sys/syscall.h> // for SYS_mbind, SYS_getcpu
+#include <unistd.h>      // for getpagesize, syscall
 
+#include "alloc_stats.h"
 #include "debug.h"
+#include "malloc-private.h" // for struct malloc_state
 #include "malloc_internal.h"
 
+// mbind is called through syscall(2) to avoid a libnuma dependency; only the
+// policy constant is needed
+#if !defined(MPOL_BIND)
+#define MPOL_BIND 2
+#endif
+
 //===-- Global variables --------------------------------------------------===//
 
 /// Maps malloc/calloc/realloc def site tags (inserted during compilation) to
-/// whether they have been mapped or not
-static uint8_t mapped_def_sites[FUZZALLOC_TAG_MAX + 1];
+/// their mspace. A non-NULL entry means the mspace has been created and fully
+/// initialized. Entries are published with a release store and read with a
+/// relaxed load, so the common "mspace already exists" path is a single atomic
+/// load with no lock and no pointer arithmetic
+static mspace def_site_mspaces[FUZZALLOC_TAG_MAX + 1];
+
+/// Read the published mspace for a def site tag (NULL if not yet created)
+#define LOAD_MSPACE(tag)                                                       \
+  (__atomic_load_n(&def_site_mspaces[(tag)], __ATOMIC_RELAXED))
+
+/// Publish a fully-initialized mspace for a def site tag. The release fence
+/// orders the mspace initialization before the pointer becomes visible to
+/// other threads
+#define STORE_MSPACE(tag, space)                                               \
+  (__atomic_store_n(&def_site_mspaces[(tag)], (space), __ATOMIC_RELEASE))
+
+/// One bit per def site tag, set (and never cleared) when the tag's mspace
+/// region is first reserved. Much denser than `def_site_mspaces` - one cache
+/// line answers ownership queries for 512 tags - so free's foreign-pointer
+/// check stays cheap even when it misses
+static uint64_t mspace_reserved[(FUZZALLOC_TAG_MAX + 64) / 64];
 
 /// Page size determined at runtime by `getpagesize`
 static int page_size = 0;
@@ -38,12 +67,95 @@ static ptrdiff_t mspace_overhead = -1;
 static pthread_mutex_t malloc_global_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/// Constant determined on first allocation. Whether mspaces are reserved
+/// sparsely (see `SPARSE_MSPACES_ENV_VAR`)
+static bool_t sparse_mspaces = FALSE;
+
+/// Constant determined on first allocation. Whether mspaces are mapped
+/// shared for the fork server (see `SHARED_MSPACES_ENV_VAR`)
+static bool_t shared_mspaces = FALSE;
+
+/// Constant determined on first allocation. Number of bytes of each new
+/// mspace to pre-fault (see `PREFAULT_MSPACES_ENV_VAR`)
+static size_t prefault_size = 0;
+
+/// Constant determined on first allocation. Whether drained mspaces have
+/// their pages reclaimed (see `RECLAIM_MSPACES_ENV_VAR`)
+static bool_t reclaim_mspaces = FALSE;
+
+/// Constant determined on first allocation. Whether mspaces grow on demand
+/// (see `GROW_MSPACES_ENV_VAR`)
+static bool_t grow_mspaces = FALSE;
+
+/// Constant determined on first allocation. Whether mspaces are backed by
+/// transparent huge pages (see `HUGEPAGE_MSPACES_ENV_VAR`)
+static bool_t hugepage_mspaces = FALSE;
+
+/// Maps def site tags to whether they opt out of hugepage backing (see
+/// `NOHUGEPAGE_TAGS_ENV_VAR`)
+static uint8_t nohugepage_tags[FUZZALLOC_TAG_MAX + 1];
+
+/// Constant determined on first allocation. Whether mspace pages are bound
+/// to a NUMA node (see `NUMA_MSPACES_ENV_VAR`)
+static bool_t numa_mspaces = FALSE;
+
+/// Constant determined on first allocation. The NUMA node mspace pages are
+/// bound to
+static unsigned long numa_node = 0;
+
+/// Per-tag committed mspace size. Equal to `mspace_size` until a growable
+/// mspace is extended
+static size_t mspace_commits[FUZZALLOC_TAG_MAX + 1];
+
+/// Per-tag count of live allocations. Only maintained when reclamation is
+/// enabled. Chunks cached in per-thread magazines count as live
+static size_t live_allocs[FUZZALLOC_TAG_MAX + 1];
+
+/// Maps def site tags to whether a sparse mspace reservation exists for them.
+/// Only consulted by the commit-on-demand fault handler
+static uint8_t sparse_reserved[FUZZALLOC_TAG_MAX + 1];
+
+/// The signal action in place before the commit-on-demand handler was
+/// installed, so that unrelated faults can be forwarded
+static struct sigaction prev_segv_action;
+
 //===-- Private helper functions ------------------------------------------===//
 
 static inline uintptr_t align(uintptr_t n, size_t alignment) {
   return (n + alignment - 1) & -alignment;
 }
 
+/// Largest single request a def site can ever satisfy: the mspace size, or
+/// the full per-tag reservation when mspaces are growable
+static inline size_t mspace_limit(void) {
+  return __builtin_expect(grow_mspaces, FALSE) ? MSPACE_ALIGNMENT : mspace_size;
+}
+
+/// glibc's uninterposed free, used to release chunks that did not come from
+/// one of our mspaces (the platform check in malloc_internal.h already
+/// restricts us to x86-64 Linux, so this symbol is always available)
+extern void __libc_free(void *ptr);
+
+/// Ownership check for the free family: TRUE iff \p ptr was carved out of one
+/// of our mspaces. Pointers allocated before libfuzzalloc was interposed, or
+/// by a `dlopen`-ed library with its own allocator, fail either the tag-range
+/// test or the reserved-region bitmap lookup - two predictable branches on
+/// the fast path - and are routed to the real libc `free`
+static inline bool_t owns_ptr(const void *ptr) {
+  const tag_t def_site_tag = GET_DEF_SITE_TAG(ptr);
+
+  if (__builtin_expect(def_site_tag < FUZZALLOC_DEFAULT_TAG ||
+                           def_site_tag > FUZZALLOC_TAG_MAX,
+                       FALSE)) {
+    return FALSE;
+  }
+
+  return (__atomic_load_n(&mspace_reserved[def_site_tag / 64],
+                          __ATOMIC_RELAXED) >>
+          (def_site_tag % 64)) &
+         1;
+}
+
 static size_t init_mspace_size(void) {
   size_t psize = MSPACE_DEFAULT_SIZE;
 
@@ -65,6 +177,44 @@ static size_t init_mspace_size(void) {
   return align(psize, page_size);
 }
 
+/// Commit-on-demand fault handler for sparsely-reserved mspaces. Commits the
+/// `SPARSE_COMMIT_SIZE` chunk around the faulting address if it falls inside
+/// a reserved mspace; forwards anything else to the previous handler
+static void sparse_segv_handler(int sig, siginfo_t *si, void *context) {
+  uintptr_t addr = (uintptr_t)si->si_addr;
+  tag_t def_site_tag = GET_DEF_SITE_TAG((void *)addr);
+
+  if (def_site_tag <= FUZZALLOC_TAG_MAX && sparse_reserved[def_site_tag]) {
+    uintptr_t base = (uintptr_t)GET_MSPACE(def_site_tag);
+
+    if (addr - base < mspace_size) {
+      // The mspace base is MSPACE_ALIGNMENT-aligned, so rounding the faulting
+      // address down to the commit granularity stays within the reservation
+      uintptr_t commit_base = addr & ~(SPARSE_COMMIT_SIZE - 1);
+      size_t commit_size = SPARSE_COMMIT_SIZE;
+      if (commit_base + commit_size > base + mspace_size) {
+        commit_size = base + mspace_size - commit_base;
+      }
+
+      if (mprotect((void *)commit_base, commit_size,
+                   PROT_READ | PROT_WRITE) == 0) {
+        return;
+      }
+    }
+  }
+
+  // Not ours - forward to whoever was installed before us
+  if (prev_segv_action.sa_flags & SA_SIGINFO) {
+    prev_segv_action.sa_sigaction(sig, si, context);
+  } else if (prev_segv_action.sa_handler != SIG_IGN &&
+             prev_segv_action.sa_handler != SIG_DFL) {
+    prev_segv_action.sa_handler(sig);
+  } else {
+    sigaction(SIGSEGV, &prev_segv_action, NULL);
+    raise(sig);
+  }
+}
+
 static mspace create_fuzzalloc_mspace(tag_t def_site_tag) {
   // Memory address is too low
   assert(def_site_tag != 0);
@@ -83,6 +233,109 @@ static mspace create_fuzzalloc_mspace(tag_t def_site_tag) {
     mspace_size = init_mspace_size();
     assert(mspace_size <= MSPACE_ALIGNMENT);
     DEBUG_MSG("using mspace size %lu bytes\n", mspace_size);
+
+    // Sparse reservation mode needs the commit-on-demand fault handler
+    if (getenv(SPARSE_MSPACES_ENV_VAR)) {
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_sigaction = sparse_segv_handler;
+      action.sa_flags = SA_SIGINFO;
+      sigemptyset(&action.sa_mask);
+      if (sigaction(SIGSEGV, &action, &prev_segv_action) != 0) {
+        DEBUG_MSG("sigaction failed: %s\n", strerror(errno));
+        abort();
+      }
+      sparse_mspaces = TRUE;
+      DEBUG_MSG("using sparse mspace reservation\n");
+    }
+
+    // Fork server copy-on-write mitigations
+    if (getenv(SHARED_MSPACES_ENV_VAR)) {
+      shared_mspaces = TRUE;
+      DEBUG_MSG("using shared mspace mappings\n");
+    }
+    if (getenv(RECLAIM_MSPACES_ENV_VAR)) {
+      reclaim_mspaces = TRUE;
+      DEBUG_MSG("reclaiming drained mspaces\n");
+    }
+    if (getenv(GROW_MSPACES_ENV_VAR)) {
+      grow_mspaces = TRUE;
+      if (!getenv(MSPACE_SIZE_ENV_VAR)) {
+        // The default mspace size is the whole per-tag reservation; when
+        // growing on demand, start small and let actual use decide
+        mspace_size = MSPACE_GROW_INITIAL_SIZE;
+      }
+      DEBUG_MSG("using growable mspaces (initial commit %lu bytes)\n",
+                mspace_size);
+    }
+    if (getenv(HUGEPAGE_MSPACES_ENV_VAR)) {
+      hugepage_mspaces = TRUE;
+
+      // Hugepage-sized commits keep every part of the mapping eligible for
+      // collapse by khugepaged
+      mspace_size = align(mspace_size, HUGEPAGE_SIZE);
+      DEBUG_MSG("using hugepage-backed mspaces\n");
+
+      char *nohugepage_str = getenv(NOHUGEPAGE_TAGS_ENV_VAR);
+      if (nohugepage_str) {
+        char *cur = nohugepage_str;
+        while (*cur) {
+          char *endptr;
+          unsigned long tag = strtoul(cur, &endptr, 0);
+          if (endptr == cur) {
+            DEBUG_MSG("unable to read %s environment variable: %s\n",
+                      NOHUGEPAGE_TAGS_ENV_VAR, nohugepage_str);
+            break;
+          }
+          if (tag <= FUZZALLOC_TAG_MAX) {
+            nohugepage_tags[tag] = TRUE;
+          }
+          if (*endptr != ',') {
+            break;
+          }
+          cur = endptr + 1;
+        }
+      }
+    }
+    if (getenv(NUMA_MSPACES_ENV_VAR) || getenv(NUMA_NODE_ENV_VAR)) {
+      char *numa_node_str = getenv(NUMA_NODE_ENV_VAR);
+      if (numa_node_str) {
+        char *endptr;
+        numa_node = strtoul(numa_node_str, &endptr, 0);
+        if (*endptr != '\0' || numa_node_str == endptr) {
+          DEBUG_MSG("unable to read %s environment variable: %s\n",
+                    NUMA_NODE_ENV_VAR, numa_node_str);
+          abort();
+        }
+        numa_mspaces = TRUE;
+      } else {
+        // Default to the node of the creating process, so allocator memory
+        // is local no matter where the scheduler later migrates us
+        unsigned cpu, node;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+          numa_node = node;
+          numa_mspaces = TRUE;
+        } else {
+          DEBUG_MSG("getcpu failed: %s\n", strerror(errno));
+        }
+      }
+      if (numa_mspaces) {
+        DEBUG_MSG("binding mspace pages to NUMA node %lu\n", numa_node);
+      }
+    }
+    char *prefault_str = getenv(PREFAULT_MSPACES_ENV_VAR);
+    if (prefault_str) {
+      char *endptr;
+      prefault_size = strtoul(prefault_str, &endptr, 0);
+      if (*endptr != '\0' || prefault_str == endptr) {
+        DEBUG_MSG("unable to read %s environment variable: %s\n",
+                  PREFAULT_MSPACES_ENV_VAR, prefault_str);
+        prefault_size = 0;
+      }
+      if (prefault_size > mspace_size) {
+        prefault_size = mspace_size;
+      }
+    }
   }
 
   // This def site has not been used before. Create a new mspace for this site
@@ -92,14 +345,79 @@ static mspace create_fuzzalloc_mspace(tag_t def_site_tag) {
   // of the mmap-ed memory match the def site tag
   void *mmap_base_addr = GET_MSPACE(def_site_tag);
 
-  DEBUG_MSG("mmap-ing %lu bytes of memory at %p...\n", mspace_size,
+  // A growable mspace reserves its full per-tag span up front, so it can be
+  // extended in place without ever colliding with a neighbouring tag. Only
+  // the initial `mspace_size` prefix is committed
+  size_t reserve_size = grow_mspaces ? MSPACE_ALIGNMENT : mspace_size;
+
+  DEBUG_MSG("mmap-ing %lu bytes of memory at %p...\n", reserve_size,
             mmap_base_addr);
-  void *mmap_base = mmap(mmap_base_addr, mspace_size, PROT_READ | PROT_WRITE,
-                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+  if (shared_mspaces) {
+    // Forked children write these pages in place instead of COW-faulting
+    // them on every execution. Requires __fuzzalloc_reset_all between
+    // executions, since heap writes now outlive the child
+    flags = MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED;
+  }
+  if (sparse_mspaces || grow_mspaces) {
+    // Reserve the address range only - pages are committed on demand (by
+    // sparse_segv_handler, or by mprotect below and in
+    // grow_fuzzalloc_mspace), so setup cost is a single VMA regardless of
+    // size
+    prot = PROT_NONE;
+    flags |= MAP_NORESERVE;
+  }
+  void *mmap_base = mmap(mmap_base_addr, reserve_size, prot, flags, -1, 0);
   if (mmap_base == (void *)(-1)) {
     DEBUG_MSG("mmap failed: %s\n", strerror(errno));
     abort();
   }
+  if (__builtin_expect(numa_mspaces, FALSE)) {
+    // Bind the whole reservation before any page is touched: the policy is a
+    // VMA property, so every page this mspace ever commits - including later
+    // growth, fault-time commits and pre-faulted pages - lands on the chosen
+    // node no matter which CPU the toucher is running on. Best-effort: on a
+    // single-node box the bind is a no-op
+    unsigned long nodemask = 1UL << numa_node;
+    if (syscall(SYS_mbind, mmap_base, reserve_size, MPOL_BIND, &nodemask,
+                sizeof(nodemask) * 8, 0) != 0) {
+      DEBUG_MSG("mbind to node %lu failed: %s\n", numa_node, strerror(errno));
+    }
+  }
+  if (grow_mspaces && !sparse_mspaces) {
+    // Commit the initial region (sparse mode instead commits on fault)
+    if (mprotect(mmap_base, mspace_size, PROT_READ | PROT_WRITE) != 0) {
+      DEBUG_MSG("mprotect failed: %s\n", strerror(errno));
+      abort();
+    }
+  }
+  if (hugepage_mspaces && !nohugepage_tags[def_site_tag]) {
+#if defined(MADV_HUGEPAGE)
+    // Advice, not a requirement: if THP is disabled on this system the
+    // kernel refuses and the mspace simply stays on 4 KB pages
+    if (madvise(mmap_base, reserve_size, MADV_HUGEPAGE) != 0) {
+      DEBUG_MSG("madvise(MADV_HUGEPAGE) failed (staying on 4 KB pages): %s\n",
+                strerror(errno));
+    }
+#else
+    DEBUG_MSG("MADV_HUGEPAGE not available - staying on 4 KB pages\n");
+#endif
+  }
+  if (sparse_mspaces) {
+    // Publish the reservation before dlmalloc writes its header into it -
+    // the very first header store will fault and commit on demand
+    sparse_reserved[def_site_tag] = TRUE;
+  }
+  if (prefault_size && !sparse_mspaces) {
+    // Touch the hot prefix of the mspace now, in the fork server parent, so
+    // every child inherits populated page tables for these pages. Storing
+    // zero leaves the (already zero-filled) contents unchanged
+    for (size_t off = 0; off < prefault_size; off += page_size) {
+      *(volatile char *)(mmap_base + off) = 0;
+    }
+    DEBUG_MSG("pre-faulted %lu bytes at %p\n", prefault_size, mmap_base);
+  }
   DEBUG_MSG("mmap base at %p\n", mmap_base);
 
   // Create the mspace on the mmap-ed memory
@@ -122,54 +440,609 @@ static mspace create_fuzzalloc_mspace(tag_t def_site_tag) {
     DEBUG_MSG("mspace overhead is %lu bytes\n", mspace_overhead);
   }
 
-  // This is the first memory allocation for this def site, so save the mspace
-  // tag into the mspace map (and likewise the def site tag into the def site
-  // map)
+  // This is the first memory allocation for this def site, so publish the
+  // mspace into the def site map. The release store ensures that the mspace is
+  // fully initialized before other threads can observe it
   DEBUG_MSG("mspace (size %lu bytes) created for def site %#x\n", mspace_size,
             def_site_tag);
-  mapped_def_sites[def_site_tag] = TRUE;
+  mspace_commits[def_site_tag] = mspace_size;
+  __atomic_fetch_or(&mspace_reserved[def_site_tag / 64],
+                    1UL << (def_site_tag % 64), __ATOMIC_RELAXED);
+  STORE_MSPACE(def_site_tag, space);
 
   return space;
 }
 
-//===-- tagged malloc interface -------------------------------------------===//
+/// Get the mspace for the given def site tag, creating it (under the global
+/// lock) if this is the first allocation for this def site
+static mspace get_fuzzalloc_mspace(tag_t def_site_tag) {
+  // Common case: the mspace has already been created and published. This is a
+  // single relaxed atomic load - no lock required
+  mspace space = LOAD_MSPACE(def_site_tag);
+  if (__builtin_expect(space != NULL, TRUE)) {
+    return space;
+  }
 
-void *__tagged_malloc(tag_t def_site_tag, size_t size) {
-  DEBUG_MSG("__tagged_malloc(%#x, %lu) called from %p\n", def_site_tag, size,
-            __builtin_return_address(0));
+  // Slow path: the mspace (probably) doesn't exist yet. Take the global lock
+  // and re-check so that two racing threads don't both create it
+  ACQUIRE_MALLOC_GLOBAL_LOCK();
+  space = LOAD_MSPACE(def_site_tag);
+  if (!space) {
+    space = create_fuzzalloc_mspace(def_site_tag);
+  }
+  RELEASE_MALLOC_GLOBAL_LOCK();
 
-  mspace space;
+  return space;
+}
+
+/// Bump the live allocation count for a def site (only when reclamation is
+/// enabled, so the common build pays nothing)
+static inline void note_alloc(tag_t def_site_tag, void *mem) {
+  if (__builtin_expect(reclaim_mspaces, FALSE) && mem) {
+    __atomic_fetch_add(&live_allocs[def_site_tag], 1, __ATOMIC_RELAXED);
+  }
+}
+
+/// Credit a successful allocation to a def site's shared-memory statistics
+/// (see alloc_stats.c). Disabled at runtime unless a statistics segment is
+/// attached, so the common case pays a single predicted branch
+static inline void note_alloc_stats(tag_t def_site_tag, void *mem) {
+  if (__builtin_expect(__alloc_stats_enabled, FALSE) && mem) {
+    alloc_stats_t *stats = &__alloc_stats_ptr[def_site_tag];
+    size_t size = mspace_usable_size(mem);
+
+    __atomic_fetch_add(&stats->allocs, 1, __ATOMIC_RELAXED);
+    uint64_t live =
+        __atomic_add_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+
+    uint64_t peak = __atomic_load_n(&stats->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&stats->peak_bytes, &peak, live, TRUE,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+}
+
+/// Debit `size` bytes from a def site's live-byte statistics
+static inline void note_free_stats(tag_t def_site_tag, size_t size) {
+  if (__builtin_expect(__alloc_stats_enabled, FALSE)) {
+    __atomic_fetch_sub(&__alloc_stats_ptr[def_site_tag].live_bytes, size,
+                       __ATOMIC_RELAXED);
+  }
+}
+
+/// Per-tag "never-touched" frontier: the highest end address ever handed out
+/// for this def site. Memory above the frontier is fresh zero-filled
+/// anonymous pages straight from mmap, so calloc can skip zeroing it. The
+/// frontier only ever grows (it is reset when an mspace's pages are
+/// reclaimed, which zero-fills them again)
+static uintptr_t mspace_frontiers[FUZZALLOC_TAG_MAX + 1];
+
+/// Record that memory up to the end of the given chunk has been handed out
+/// (and may therefore be dirty once recycled)
+static inline void note_frontier(tag_t def_site_tag, void *mem) {
+  if (!mem) {
+    return;
+  }
+
+  uintptr_t end = (uintptr_t)mem + mspace_usable_size(mem);
+  uintptr_t cur =
+      __atomic_load_n(&mspace_frontiers[def_site_tag], __ATOMIC_RELAXED);
+  while (end > cur &&
+         !__atomic_compare_exchange_n(&mspace_frontiers[def_site_tag], &cur,
+                                      end, TRUE, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+}
+
+//===-- Per-thread magazines ----------------------------------------------===//
+
+#if defined(FUZZALLOC_USE_LOCKS)
+
+// With locks enabled, every thread allocating from the same def site contends
+// on that mspace's dlmalloc lock. A small per-thread cache of size-classed
+// chunks (a "magazine") in front of mspace_malloc batches refills so the
+// common allocation path never touches the per-tag lock.
+//
+// Note that the magazines hold freed chunks across __fuzzalloc_reset_all, so
+// persistent-mode harnesses should use the lock-free build
+
+/// Number of direct-mapped (tag, size class) magazine slots per thread. Must
+/// be a power of two
+#define MAGAZINE_SLOTS 64
+
+/// Chunks held per magazine
+#define MAGAZINE_CAPACITY 16
+
+/// Chunks fetched from the owning mspace on a refill (under one lock
+/// acquisition)
+#define MAGAZINE_REFILL (MAGAZINE_CAPACITY / 2)
+
+/// Smallest (log2) cached size class: 16 bytes
+#define MAGAZINE_MIN_CLASS 4
 
-  // Need to ensure that no-one else can update the mapped def sites while we
-  // are doing our own mapping
+/// Largest (log2) cached size class: 512 bytes
+#define MAGAZINE_MAX_CLASS 9
+
+struct magazine {
+  tag_t def_site_tag;
+  uint8_t size_class;
+  uint8_t count;
+  void *chunks[MAGAZINE_CAPACITY];
+};
+
+static __thread struct magazine magazines[MAGAZINE_SLOTS];
+
+static inline unsigned magazine_slot(tag_t def_site_tag, unsigned cls) {
+  return (((unsigned)def_site_tag * 31) + cls) & (MAGAZINE_SLOTS - 1);
+}
+
+/// Smallest size class that can hold `size` bytes
+static inline unsigned magazine_size_class(size_t size) {
+  unsigned cls = MAGAZINE_MIN_CLASS;
+  while ((1UL << cls) < size) {
+    cls++;
+  }
+  return cls;
+}
+
+/// Return all cached chunks to their owning mspace
+static void magazine_flush(struct magazine *mag) {
+  mspace space = LOAD_MSPACE(mag->def_site_tag);
+  assert(space);
+  if (__builtin_expect(reclaim_mspaces, FALSE)) {
+    __atomic_fetch_sub(&live_allocs[mag->def_site_tag], mag->count,
+                       __ATOMIC_RELAXED);
+  }
+  while (mag->count > 0) {
+    mspace_free(space, mag->chunks[--mag->count]);
+  }
+}
+
+/// Try to serve a small allocation from this thread's magazines, refilling
+/// from the owning mspace in one batch on a miss. Returns NULL if the size is
+/// not cacheable or the refill failed (caller falls back to mspace_malloc)
+static void *magazine_alloc(tag_t def_site_tag, size_t size) {
+  if (size == 0 || size > (1UL << MAGAZINE_MAX_CLASS)) {
+    return NULL;
+  }
+
+  unsigned cls = magazine_size_class(size);
+  struct magazine *mag = &magazines[magazine_slot(def_site_tag, cls)];
+
+  if (mag->def_site_tag == def_site_tag && mag->size_class == cls) {
+    if (__builtin_expect(mag->count > 0, TRUE)) {
+      return mag->chunks[--mag->count];
+    }
+  } else {
+    // Repurpose the slot for this (tag, class) pair
+    if (mag->count > 0) {
+      magazine_flush(mag);
+    }
+    mag->def_site_tag = def_site_tag;
+    mag->size_class = cls;
+  }
+
+  // Batch-refill under a single acquisition of the owning mspace's lock
+  mspace space = get_fuzzalloc_mspace(def_site_tag);
+  if (!mspace_independent_calloc(space, MAGAZINE_REFILL, 1UL << cls,
+                                 mag->chunks)) {
+    return NULL;
+  }
+  mag->count = MAGAZINE_REFILL;
+  for (unsigned I = 0; I < MAGAZINE_REFILL; I++) {
+    note_frontier(def_site_tag, mag->chunks[I]);
+  }
+  if (__builtin_expect(reclaim_mspaces, FALSE)) {
+    __atomic_fetch_add(&live_allocs[def_site_tag], MAGAZINE_REFILL,
+                       __ATOMIC_RELAXED);
+  }
+
+  return mag->chunks[--mag->count];
+}
+
+/// Try to cache a freed chunk in this thread's magazines. Returns TRUE if the
+/// chunk was cached (caller must not free it)
+static bool_t magazine_free(tag_t def_site_tag, void *ptr) {
+  size_t usable = mspace_usable_size(ptr);
+  if (usable < (1UL << MAGAZINE_MIN_CLASS)) {
+    return FALSE;
+  }
+
+  // Largest class the chunk can serve, so cached chunks are always big
+  // enough for their magazine's class
+  unsigned cls = MAGAZINE_MIN_CLASS;
+  while (cls < MAGAZINE_MAX_CLASS && (1UL << (cls + 1)) <= usable) {
+    cls++;
+  }
+  if ((1UL << (cls + 1)) <= usable) {
+    // Too big to cache
+    return FALSE;
+  }
+
+  struct magazine *mag = &magazines[magazine_slot(def_site_tag, cls)];
+  if (mag->def_site_tag == def_site_tag && mag->size_class == cls &&
+      mag->count < MAGAZINE_CAPACITY) {
+    mag->chunks[mag->count++] = ptr;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/// Like magazine_free, but sized: the caller (a rewritten sized `delete`)
+/// knows the requested allocation size, so we can classify the chunk without
+/// the mspace_usable_size chunk-header read. The requested size is only a
+/// lower bound on the usable size, so the chunk is cached in the largest
+/// class it is guaranteed to serve
+static bool_t magazine_sized_free(tag_t def_site_tag, void *ptr, size_t size) {
+  if (size < (1UL << MAGAZINE_MIN_CLASS) || size > (1UL << MAGAZINE_MAX_CLASS)) {
+    return FALSE;
+  }
+
+  unsigned cls = MAGAZINE_MIN_CLASS;
+  while (cls < MAGAZINE_MAX_CLASS && (1UL << (cls + 1)) <= size) {
+    cls++;
+  }
+
+  struct magazine *mag = &magazines[magazine_slot(def_site_tag, cls)];
+  if (mag->def_site_tag == def_site_tag && mag->size_class == cls &&
+      mag->count < MAGAZINE_CAPACITY) {
+    mag->chunks[mag->count++] = ptr;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+#endif // defined(FUZZALLOC_USE_LOCKS)
+
+//===-- Persistent mode support -------------------------------------------===//
+
+/// Per-tag snapshot of the prefix of an mspace. Everything dlmalloc has ever
+/// touched - the malloc_state itself, every chunk header, and every free-list
+/// node - lives below the top (wilderness) chunk, so saving the prefix up to
+/// and including the top chunk's header captures the complete allocator state
+typedef struct {
+  void *data;
+  size_t len;
+} mspace_snapshot_t;
+
+/// Maps def site tags to their mspace snapshot (if one has been taken)
+static mspace_snapshot_t mspace_snapshots[FUZZALLOC_TAG_MAX + 1];
+
+/// Snapshot the mspace for the given def site tag
+static void snapshot_mspace(tag_t def_site_tag, mspace space) {
+  struct malloc_state *m = (struct malloc_state *)space;
+  void *base = GET_MSPACE(def_site_tag);
+
+  assert(page_size);
+  size_t len =
+      align((char *)m->top - (char *)base + MCHUNK_SIZE, page_size);
+
+  void *data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == (void *)(-1)) {
+    DEBUG_MSG("snapshot mmap failed: %s\n", strerror(errno));
+    abort();
+  }
+  memcpy(data, base, len);
+
+  DEBUG_MSG("snapshotted %lu bytes of mspace for def site %#x\n", len,
+            def_site_tag);
+  mspace_snapshots[def_site_tag].data = data;
+  mspace_snapshots[def_site_tag].len = len;
+}
+
+static void reset_mspaces_from(tag_t min_tag) {
   ACQUIRE_MALLOC_GLOBAL_LOCK();
 
-  if (mapped_def_sites[def_site_tag] == FALSE) {
-    space = create_fuzzalloc_mspace(def_site_tag);
+  for (size_t tag = min_tag; tag <= FUZZALLOC_TAG_MAX; tag++) {
+    mspace space = LOAD_MSPACE(tag);
+    if (!space) {
+      continue;
+    }
+
+    if (fuzzalloc_snapshot_covers(GET_MSPACE(tag))) {
+      // Already rolled back page-by-page by the process-wide snapshot; the
+      // prefix machinery below is only needed for mspaces created after it
+      continue;
+    }
+
+    if (!mspace_snapshots[tag].data) {
+      // First time we've seen this mspace (either the first reset call, or
+      // the mspace was created during a later iteration): snapshot it so that
+      // allocations made up to this point survive future resets
+      snapshot_mspace(tag, space);
+    } else {
+      // Bulk-restore the mspace to its snapshotted state. Everything
+      // allocated after the snapshot becomes wilderness again in one memcpy
+      // whose cost is independent of the number of live allocations
+      memcpy(GET_MSPACE(tag), mspace_snapshots[tag].data,
+             mspace_snapshots[tag].len);
+    }
+  }
 
-    // Release the global lock - we've updated the def site map
+  RELEASE_MALLOC_GLOBAL_LOCK();
+}
+
+void __fuzzalloc_reset_all(void) {
+  DEBUG_MSG("__fuzzalloc_reset_all called from %p\n",
+            __builtin_return_address(0));
+
+  // Fork-free execution mode (see snapshot.c): roll back the dirty pages of
+  // every private writable mapping - mspaces, .data/.bss, the libc heap -
+  // in-process. AFL++ persistent-mode harnesses calling this from the
+  // __AFL_LOOP body then never need the fork server's per-execution fork.
+  // Note that this deliberately does not apply to __fuzzalloc_reset_def_sites,
+  // whose contract is to leave the host process's own state alone
+  if (fuzzalloc_snapshot_enabled()) {
+    if (!fuzzalloc_snapshot_taken()) {
+      fuzzalloc_snapshot_take();
+    } else {
+      fuzzalloc_snapshot_restore();
+    }
+  }
+
+  reset_mspaces_from(1);
+}
+
+void __fuzzalloc_reset_def_sites(void) {
+  DEBUG_MSG("__fuzzalloc_reset_def_sites called from %p\n",
+            __builtin_return_address(0));
+
+  // Leave the default-tag mspaces alone so the host process's own (untagged)
+  // allocations survive - for in-process fuzzers that share the heap with
+  // the target
+  reset_mspaces_from(FUZZALLOC_TAG_MIN);
+}
+
+//===-- mspace reclamation ------------------------------------------------===//
+
+/// Return a drained mspace's committed pages to the OS (keeping the address
+/// reservation) and reinitialize it for future allocations. Called when a def
+/// site's live allocation count reaches zero
+static void reclaim_fuzzalloc_mspace(tag_t def_site_tag) {
+  ACQUIRE_MALLOC_GLOBAL_LOCK();
+
+  // Re-check under the lock - another thread may have allocated from this
+  // def site in the meantime
+  if (__atomic_load_n(&live_allocs[def_site_tag], __ATOMIC_RELAXED) != 0) {
     RELEASE_MALLOC_GLOBAL_LOCK();
-  } else {
-    // Don't need the global lock anymore - the mspace lock will take care of it
+    return;
+  }
+
+  void *base = GET_MSPACE(def_site_tag);
+  size_t committed = mspace_commits[def_site_tag];
+
+  // Note that MADV_DONTNEED only releases pages of private mappings, so this
+  // is a no-op under FUZZALLOC_SHARED_MSPACES
+  if (madvise(base, committed, MADV_DONTNEED) != 0) {
+    DEBUG_MSG("madvise failed: %s\n", strerror(errno));
     RELEASE_MALLOC_GLOBAL_LOCK();
+    return;
+  }
+  DEBUG_MSG("reclaimed mspace pages for def site %#x\n", def_site_tag);
+
+  // The pages are zero-filled again - rebuild the mspace header on them. A
+  // grown mspace keeps its committed size: the pages stay committed, only
+  // their contents were dropped
+#if defined(FUZZALLOC_USE_LOCKS)
+  mspace space = create_mspace_with_base(base, committed, TRUE);
+#else
+  mspace space = create_mspace_with_base(base, committed, FALSE);
+#endif
+  if (!space) {
+    DEBUG_MSG("create_mspace_with_base failed at base %p (size %lu bytes)\n",
+              base, committed);
+    abort();
+  }
+  STORE_MSPACE(def_site_tag, space);
+
+  // The reclaimed pages are zero again - reset the calloc frontier
+  __atomic_store_n(&mspace_frontiers[def_site_tag], 0, __ATOMIC_RELAXED);
+
+  // Any persistent-mode snapshot of this mspace is now stale
+  if (mspace_snapshots[def_site_tag].data) {
+    munmap(mspace_snapshots[def_site_tag].data,
+           mspace_snapshots[def_site_tag].len);
+    mspace_snapshots[def_site_tag].data = NULL;
+    mspace_snapshots[def_site_tag].len = 0;
+  }
+
+  RELEASE_MALLOC_GLOBAL_LOCK();
+}
+
+//===-- mspace growth -----------------------------------------------------===//
+
+/// Extend a growable mspace so that at least `needed` more bytes can be
+/// carved from its top (wilderness) chunk. The committed region doubles on
+/// each extension (amortizing the mprotect calls), capped at the per-tag
+/// reservation. Returns TRUE if the mspace grew
+static bool_t grow_fuzzalloc_mspace(tag_t def_site_tag, mspace space,
+                                    size_t needed) {
+  bool_t grown = FALSE;
+
+  ACQUIRE_MALLOC_GLOBAL_LOCK();
+
+  size_t committed = mspace_commits[def_site_tag];
+  size_t target = committed;
+  while (target < MSPACE_ALIGNMENT && target - committed < needed) {
+    target *= 2;
+  }
+  if (target > MSPACE_ALIGNMENT) {
+    target = MSPACE_ALIGNMENT;
+  }
+
+  if (target - committed >= needed) {
+    void *base = GET_MSPACE(def_site_tag);
+    size_t delta = target - committed;
+
+    // Commit the next slice of the reservation
+    if (mprotect(base + committed, delta, PROT_READ | PROT_WRITE) != 0) {
+      DEBUG_MSG("mprotect failed: %s\n", strerror(errno));
+      RELEASE_MALLOC_GLOBAL_LOCK();
+      return FALSE;
+    }
+
+    // Graft the new memory onto the end of the top (wilderness) chunk, which
+    // always abuts the end of an mspace's (single) base segment. The fake
+    // trailing chunk dlmalloc keeps at the segment end is re-established on
+    // the fresh zero-filled pages
+    struct malloc_state *m = (struct malloc_state *)space;
+    m->topsize += delta;
+    m->top->head = m->topsize | PINUSE_BIT;
+    ((mchunkptr)((char *)m->top + m->topsize))->head = TOP_FOOT_SIZE;
+    m->seg.size += delta;
+    m->footprint += delta;
+    if (m->footprint > m->max_footprint) {
+      m->max_footprint = m->footprint;
+    }
+
+    mspace_commits[def_site_tag] = target;
+    grown = TRUE;
+    DEBUG_MSG("grew mspace for def site %#x to %lu bytes\n", def_site_tag,
+              target);
+  }
+
+  RELEASE_MALLOC_GLOBAL_LOCK();
+
+  return grown;
+}
+
+/// In growable mode, make sure the mspace's top chunk can serve a `size`-byte
+/// request before dlmalloc looks at it. dlmalloc's fallback for an exhausted
+/// mspace is to map fresh - untagged! - memory from the OS, so growth must
+/// happen before the allocation rather than on failure
+static inline void maybe_grow_mspace(tag_t def_site_tag, mspace space,
+                                     size_t size) {
+  if (__builtin_expect(grow_mspaces, FALSE)) {
+    struct malloc_state *m = (struct malloc_state *)space;
+
+    // Generous upper bound on what dlmalloc needs to carve the request (and
+    // the successor chunk's header) out of the top chunk
+    size_t needed = size + MALLOC_ALIGNMENT + TOP_FOOT_SIZE + MCHUNK_SIZE;
+    if (m->topsize < needed &&
+        mspace_commits[def_site_tag] < MSPACE_ALIGNMENT) {
+      grow_fuzzalloc_mspace(def_site_tag, space, needed);
+    }
+  }
+}
+
+//===-- eager mspace creation ---------------------------------------------===//
+
+/// Link-time tag manifest, emitted at compile time by the TagDynamicAllocs
+/// pass: one entry per assigned def site tag, concatenated across
+/// translation units into the `fuzzalloc_tags` section, whose start/stop
+/// symbols the linker provides. Weak, so binaries without a manifest (e.g.
+/// built before the pass emitted one) still link and simply keep creating
+/// mspaces on first allocation
+extern const tag_t __start_fuzzalloc_tags[] __attribute__((weak));
+extern const tag_t __stop_fuzzalloc_tags[] __attribute__((weak));
+
+/// Create every mspace named in the tag manifest up front. Afterwards the
+/// steady-state allocation path never takes the mspace-creation slow path
+/// (or, in threaded builds, the global lock guarding it), and no run pays
+/// the mmap/mspace-setup latency spike on a site's first allocation. Runs
+/// before main - i.e. in the fork server parent - so every child inherits
+/// the fully set-up heap
+__attribute__((constructor)) static void create_manifest_mspaces(void) {
+  if (!__start_fuzzalloc_tags) {
+    return;
+  }
+
+  size_t num_tags = __stop_fuzzalloc_tags - __start_fuzzalloc_tags;
+  for (size_t i = 0; i < num_tags; i++) {
+    tag_t tag = __start_fuzzalloc_tags[i];
+
+    // Manifest entries are trusted but cheap to sanity-check (duplicates
+    // across translation units are fine - creation is idempotent)
+    if (tag < FUZZALLOC_TAG_MIN || tag > FUZZALLOC_TAG_MAX) {
+      continue;
+    }
+    get_fuzzalloc_mspace(tag);
+  }
+  DEBUG_MSG("created mspaces for %lu manifest tags\n", num_tags);
+}
+
+//===-- large objects -----------------------------------------------------===//
+
+/// Usable capacity of the page-aligned run backing a large object: the
+/// smallest power of two (at least `LARGE_ALLOC_THRESHOLD`) that fits the
+/// request
+static inline size_t large_capacity(size_t size) {
+  size_t capacity = LARGE_ALLOC_THRESHOLD;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+/// Place a large object in its own page-aligned run with a power-of-two
+/// usable capacity. The tail of the run beyond the caller's request is only
+/// a virtual reservation - the kernel commits those pages when (if) a later
+/// realloc grows into them - so the over-allocation costs address space, not
+/// memory. `__tagged_realloc` relies on this layout to grow large buffers in
+/// place
+static void *large_alloc(tag_t def_site_tag, mspace space, size_t size) {
+  size_t capacity = large_capacity(size);
+
+  // Fall back to an exact-size chunk when the rounded-up run would no longer
+  // fit in the mspace
+  if (__builtin_expect(capacity > mspace_limit(), FALSE)) {
+    maybe_grow_mspace(def_site_tag, space, size);
+    return mspace_malloc(space, size);
+  }
+
+  maybe_grow_mspace(def_site_tag, space, capacity + page_size);
+
+  void *mem = mspace_memalign(space, page_size, capacity);
+  DEBUG_MSG("mspace_memalign(%p, %d, %lu) returned %p (large run)\n", space,
+            page_size, capacity, mem);
+
+  return mem;
+}
+
+//===-- tagged malloc interface -------------------------------------------===//
 
-    assert(mspace_overhead >= 0);
-    space = GET_MSPACE(def_site_tag) + mspace_overhead;
+void *__tagged_malloc(tag_t def_site_tag, size_t size) {
+  DEBUG_MSG("__tagged_malloc(%#x, %lu) called from %p\n", def_site_tag, size,
+            __builtin_return_address(0));
+
+#if defined(FUZZALLOC_USE_LOCKS)
+  // Small allocations come from this thread's magazines, avoiding the
+  // per-mspace lock entirely in the common case
+  void *cached = magazine_alloc(def_site_tag, size);
+  if (cached) {
+    note_alloc_stats(def_site_tag, cached);
+    return cached;
   }
+#endif
+
+  mspace space = get_fuzzalloc_mspace(def_site_tag);
 
   // Note that this doesn't look at previously-allocated memory in this mspace
   // (because that would be too expensive)
-  if (__builtin_expect(size > mspace_size, FALSE)) {
+  if (__builtin_expect(size > mspace_limit(), FALSE)) {
     DEBUG_MSG("malloc size (%lu bytes) larger than mspace size (%lu bytes)\n",
-              size, mspace_size);
+              size, mspace_limit());
     errno = ENOMEM;
 
     return NULL;
   }
 
-  void *mem = mspace_malloc(space, size);
+  void *mem;
+  if (__builtin_expect(size >= LARGE_ALLOC_THRESHOLD, FALSE)) {
+    mem = large_alloc(def_site_tag, space, size);
+  } else {
+    maybe_grow_mspace(def_site_tag, space, size);
+    mem = mspace_malloc(space, size);
+  }
   DEBUG_MSG("mspace_malloc(%p, %lu) returned %p\n", space, size, mem);
-  assert(mem > space && mem < (space + mspace_size));
+  assert(mem > space && mem < (space + mspace_limit()));
+  note_frontier(def_site_tag, mem);
+  note_alloc(def_site_tag, mem);
+  note_alloc_stats(def_site_tag, mem);
 
   return mem;
 }
@@ -178,42 +1051,37 @@ void *__tagged_calloc(tag_t def_site_tag, size_t nmemb, size_t size) {
   DEBUG_MSG("__tagged_calloc(%#x, %lu, %lu) called from %p\n", def_site_tag,
             nmemb, size, __builtin_return_address(0));
 
-  mspace space;
-
-  // Need to ensure that no-one else can update the mapped def sites while we
-  // are doing our own mapping
-  ACQUIRE_MALLOC_GLOBAL_LOCK();
-
-  if (mapped_def_sites[def_site_tag] == FALSE) {
-    space = create_fuzzalloc_mspace(def_site_tag);
-
-    // Release the global lock - we've updated the def site map
-    RELEASE_MALLOC_GLOBAL_LOCK();
-  } else {
-    // Don't need the global lock anymore - the mspace lock will take care of it
-    RELEASE_MALLOC_GLOBAL_LOCK();
-
-    assert(mspace_overhead >= 0);
-    space = GET_MSPACE(def_site_tag) + mspace_overhead;
-  }
+  mspace space = get_fuzzalloc_mspace(def_site_tag);
 
   // Need to check this to avoid a division-by-zero
   if (__builtin_expect(size > 0, TRUE)) {
     // Note that this doesn't look at previously-allocated memory in this mspace
     // (because that would be too expensive)
-    if (__builtin_expect(nmemb > mspace_size / size, FALSE)) {
+    if (__builtin_expect(nmemb > mspace_limit() / size, FALSE)) {
       DEBUG_MSG("calloc size (%lu bytes) larger than mspace size (%lu bytes)\n",
-                nmemb * size, mspace_size);
+                nmemb * size, mspace_limit());
       errno = ENOMEM;
 
       return NULL;
     }
   }
 
-  void *mem = mspace_calloc(space, nmemb, size);
-  DEBUG_MSG("mspace_calloc(%p, %lu, %lu) returned %p\n", space, nmemb, size,
-            mem);
-  assert(mem > space && mem < (space + mspace_size));
+  maybe_grow_mspace(def_site_tag, space, nmemb * size);
+
+  // Allocate without zeroing, then only memset chunks that lie below the
+  // never-touched frontier - anything above it is fresh zero-filled pages
+  // straight from mmap
+  void *mem = mspace_malloc(space, nmemb * size);
+  DEBUG_MSG("mspace_malloc(%p, %lu) returned %p\n", space, nmemb * size, mem);
+  assert(mem > space && mem < (space + mspace_limit()));
+  if (mem &&
+      (uintptr_t)mem < __atomic_load_n(&mspace_frontiers[def_site_tag],
+                                       __ATOMIC_RELAXED)) {
+    memset(mem, 0, nmemb * size);
+  }
+  note_frontier(def_site_tag, mem);
+  note_alloc(def_site_tag, mem);
+  note_alloc_stats(def_site_tag, mem);
 
   return mem;
 }
@@ -225,61 +1093,186 @@ void *__tagged_realloc(tag_t def_site_tag, void *ptr, size_t size) {
   mspace space;
 
   if (!ptr) {
-    // We may be allocating a new memory region. Need to ensure that no-one else
-    // can update the mapped def sites while we are doing our own mapping
-    ACQUIRE_MALLOC_GLOBAL_LOCK();
-
-    if (mapped_def_sites[def_site_tag] == FALSE) {
-      space = create_fuzzalloc_mspace(def_site_tag);
-
-      // Release the global lock - we've updated the def site map
-      RELEASE_MALLOC_GLOBAL_LOCK();
-    } else {
-      // Don't need the global lock anymore - the mspace lock will take care of
-      // it
-      RELEASE_MALLOC_GLOBAL_LOCK();
-
-      assert(mspace_overhead >= 0);
-      space = GET_MSPACE(def_site_tag) + mspace_overhead;
-    }
+    // We may be allocating a new memory region
+    space = get_fuzzalloc_mspace(def_site_tag);
   } else {
     // We are resizing an existing memory region, so reuse the def site tag and
     // mspace of the existing pointer
     def_site_tag = GET_DEF_SITE_TAG(ptr);
-
-    assert(mspace_overhead >= 0);
-    space = GET_MSPACE(def_site_tag) + mspace_overhead;
+    space = LOAD_MSPACE(def_site_tag);
+    assert(space);
   }
 
   // Note that this doesn't look at previously-allocated memory in this mspace
   // (because that would be too expensive)
-  if (__builtin_expect(size > mspace_size, FALSE)) {
+  if (__builtin_expect(size > mspace_limit(), FALSE)) {
     DEBUG_MSG("realloc size (%lu bytes) larger than mspace size (%lu bytes)\n",
-              size, mspace_size);
+              size, mspace_limit());
     errno = ENOMEM;
 
     return NULL;
   }
 
-  void *mem = mspace_realloc(space, ptr, size);
+  // Large-object fast path. Large chunks sit in their own page runs with a
+  // power-of-two usable capacity (see large_alloc), so growth that still
+  // fits the run is satisfied in place - the kernel commits the previously
+  // untouched tail pages on first write, making the realloc O(pages touched)
+  // instead of O(bytes copied). Shrinks stay in place too, keeping the
+  // reserve for the next growth spurt
+  if (ptr && size) {
+    size_t usable = mspace_usable_size(ptr);
+    if (__builtin_expect(usable >= LARGE_ALLOC_THRESHOLD, FALSE) &&
+        size <= usable) {
+      DEBUG_MSG("large realloc of %p to %lu bytes satisfied in place "
+                "(capacity %lu bytes)\n",
+                ptr, size, usable);
+      return ptr;
+    }
+  }
+
+  // Capture the old usable size before mspace_realloc recycles the chunk, so
+  // the statistics can account for the size delta below
+  size_t old_size = 0;
+  if (__builtin_expect(__alloc_stats_enabled, FALSE) && ptr) {
+    old_size = mspace_usable_size(ptr);
+  }
+
+  void *mem;
+  if (__builtin_expect(size >= LARGE_ALLOC_THRESHOLD, FALSE)) {
+    // The new size warrants a large run. Move into one by hand (rather than
+    // through mspace_realloc, which would copy into an exact-size chunk and
+    // lose the reserved tail), copying only the old chunk's usable bytes
+    mem = large_alloc(def_site_tag, space, size);
+    if (mem && ptr) {
+      size_t usable = mspace_usable_size(ptr);
+      memcpy(mem, ptr, usable < size ? usable : size);
+      mspace_free(space, ptr);
+    }
+  } else {
+    maybe_grow_mspace(def_site_tag, space, size);
+    mem = mspace_realloc(space, ptr, size);
+  }
   DEBUG_MSG("mspace_realloc(%p, %p, %lu) returned %p\n", space, ptr, size, mem);
-  assert(mem > space && mem < (space + mspace_size));
+  assert(mem > space && mem < (space + mspace_limit()));
+  note_frontier(def_site_tag, mem);
+  if (!ptr) {
+    note_alloc(def_site_tag, mem);
+  }
+  if (mem) {
+    note_free_stats(def_site_tag, old_size);
+    note_alloc_stats(def_site_tag, mem);
+  }
+
+  return mem;
+}
+
+void *__tagged_memalign(tag_t def_site_tag, size_t alignment, size_t size) {
+  DEBUG_MSG("__tagged_memalign(%#x, %lu, %lu) called from %p\n", def_site_tag,
+            alignment, size, __builtin_return_address(0));
+
+  mspace space = get_fuzzalloc_mspace(def_site_tag);
+
+  // Note that this doesn't look at previously-allocated memory in this mspace
+  // (because that would be too expensive)
+  if (__builtin_expect(size > mspace_limit(), FALSE)) {
+    DEBUG_MSG("memalign size (%lu bytes) larger than mspace size (%lu "
+              "bytes)\n",
+              size, mspace_limit());
+    errno = ENOMEM;
+
+    return NULL;
+  }
+
+  // The aligned chunk may need up to `alignment` bytes of leading padding
+  maybe_grow_mspace(def_site_tag, space, size + alignment);
+
+  void *mem = mspace_memalign(space, alignment, size);
+  DEBUG_MSG("mspace_memalign(%p, %lu, %lu) returned %p\n", space, alignment,
+            size, mem);
+  assert(mem > space && mem < (space + mspace_limit()));
+  note_frontier(def_site_tag, mem);
+  note_alloc(def_site_tag, mem);
+  note_alloc_stats(def_site_tag, mem);
 
   return mem;
 }
 
+int __tagged_posix_memalign(tag_t def_site_tag, void **memptr,
+                            size_t alignment, size_t size) {
+  DEBUG_MSG("__tagged_posix_memalign(%#x, %p, %lu, %lu) called from %p\n",
+            def_site_tag, memptr, alignment, size,
+            __builtin_return_address(0));
+
+  // POSIX requires the alignment to be a power-of-two multiple of
+  // sizeof(void *)
+  if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 ||
+      alignment == 0) {
+    return EINVAL;
+  }
+
+  void *mem = __tagged_memalign(def_site_tag, alignment, size);
+  if (!mem) {
+    return ENOMEM;
+  }
+
+  *memptr = mem;
+  return 0;
+}
+
+void *__tagged_aligned_alloc(tag_t def_site_tag, size_t alignment,
+                             size_t size) {
+  DEBUG_MSG("__tagged_aligned_alloc(%#x, %lu, %lu) called from %p\n",
+            def_site_tag, alignment, size, __builtin_return_address(0));
+
+  return __tagged_memalign(def_site_tag, alignment, size);
+}
+
 //===-- malloc interface --------------------------------------------------===//
 
+/// Pick the def site tag for an allocation from non-instrumented code. In
+/// threaded builds the default tag space is sharded per thread (round-robin
+/// over the FUZZALLOC_NUM_DEFAULT_TAGS reserved tags), so background
+/// allocation traffic from libc and third-party libraries doesn't contend on
+/// a single mspace lock
+static inline tag_t default_tag(void) {
+#if defined(FUZZALLOC_USE_LOCKS)
+  static __thread tag_t shard = 0;
+
+  if (__builtin_expect(shard == 0, FALSE)) {
+    static unsigned next_shard = 0;
+    shard = FUZZALLOC_DEFAULT_TAG +
+            (__atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) %
+             FUZZALLOC_NUM_DEFAULT_TAGS);
+  }
+
+  return shard;
+#else
+  return FUZZALLOC_DEFAULT_TAG;
+#endif
+}
+
 void *malloc(size_t size) {
-  return __tagged_malloc(FUZZALLOC_DEFAULT_TAG, size);
+  return __tagged_malloc(default_tag(), size);
 }
 
 void *calloc(size_t nmemb, size_t size) {
-  return __tagged_calloc(FUZZALLOC_DEFAULT_TAG, nmemb, size);
+  return __tagged_calloc(default_tag(), nmemb, size);
 }
 
 void *realloc(void *ptr, size_t size) {
-  return __tagged_realloc(FUZZALLOC_DEFAULT_TAG, ptr, size);
+  return __tagged_realloc(default_tag(), ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  return __tagged_posix_memalign(default_tag(), memptr, alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return __tagged_aligned_alloc(default_tag(), alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  return __tagged_memalign(default_tag(), alignment, size);
 }
 
 void free(void *ptr) {
@@ -289,13 +1282,89 @@ void free(void *ptr) {
     return;
   }
 
+  // Interop fast path: chunks from a foreign allocator (handed out before we
+  // were interposed, or by a dlopen'd library bundling its own malloc) must
+  // not land in an mspace - hand them back to libc
+  if (__builtin_expect(!owns_ptr(ptr), FALSE)) {
+    DEBUG_MSG("foreign pointer %p routed to __libc_free\n", ptr);
+    __libc_free(ptr);
+    return;
+  }
+
+  tag_t def_site_tag = GET_DEF_SITE_TAG(ptr);
+
+  // Debit the statistics before the chunk is recycled (the magazine may hand
+  // it out again immediately)
+  if (__builtin_expect(__alloc_stats_enabled, FALSE)) {
+    note_free_stats(def_site_tag, mspace_usable_size(ptr));
+  }
+
+#if defined(FUZZALLOC_USE_LOCKS)
+  // Cache small chunks in this thread's magazines for lock-free reuse
+  if (magazine_free(def_site_tag, ptr)) {
+    return;
+  }
+#endif
+
+  mspace space = LOAD_MSPACE(def_site_tag);
+  assert(space);
+
+  DEBUG_MSG("mspace_free(%p, %p)\n", space, ptr);
+  mspace_free(space, ptr);
+
+  // When the last live allocation for a def site is freed, return the
+  // mspace's committed pages to the OS
+  if (__builtin_expect(reclaim_mspaces, FALSE)) {
+    if (__atomic_sub_fetch(&live_allocs[def_site_tag], 1,
+                           __ATOMIC_RELAXED) == 0) {
+      reclaim_fuzzalloc_mspace(def_site_tag);
+    }
+  }
+}
+
+void __sized_free(void *ptr, size_t size) {
+  DEBUG_MSG("__sized_free(%p, %zu) called from %p\n", ptr, size,
+            __builtin_return_address(0));
+
+  if (!ptr) {
+    return;
+  }
+
+  // Same foreign-pointer interop check as free
+  if (__builtin_expect(!owns_ptr(ptr), FALSE)) {
+    DEBUG_MSG("foreign pointer %p routed to __libc_free\n", ptr);
+    __libc_free(ptr);
+    return;
+  }
+
   tag_t def_site_tag = GET_DEF_SITE_TAG(ptr);
 
-  assert(mspace_overhead >= 0);
-  mspace space = GET_MSPACE(def_site_tag) + mspace_overhead;
+  // The statistics are kept in usable sizes, so read the chunk header rather
+  // than trusting the (smaller) static size. Only paid when statistics are on
+  if (__builtin_expect(__alloc_stats_enabled, FALSE)) {
+    note_free_stats(def_site_tag, mspace_usable_size(ptr));
+  }
+
+#if defined(FUZZALLOC_USE_LOCKS)
+  // The statically-known size lets the magazine skip the chunk-header read
+  // that free's fast path pays for mspace_usable_size
+  if (magazine_sized_free(def_site_tag, ptr, size)) {
+    return;
+  }
+#else
+  (void)size;
+#endif
+
+  mspace space = LOAD_MSPACE(def_site_tag);
+  assert(space);
 
   DEBUG_MSG("mspace_free(%p, %p)\n", space, ptr);
   mspace_free(space, ptr);
 
-  // TODO destroy mspace?
+  if (__builtin_expect(reclaim_mspaces, FALSE)) {
+    if (__atomic_sub_fetch(&live_allocs[def_site_tag], 1,
+                           __ATOMIC_RELAXED) == 0) {
+      reclaim_fuzzalloc_mspace(def_site_tag);
+    }
+  }
 }
@@ -0,0 +1,371 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+// Bump-pointer "fuzzing mode" allocation engine. Provides the same tagged
+// malloc interface as malloc.c, but services allocations with a per-tag bump
+// pointer and no free-list bookkeeping: free is a no-op and memory is only
+// reclaimed in bulk via __fuzzalloc_reset_all. Built as the separate
+// libfuzzalloc-fast library, selectable at link time
+//
+
+#include <errno.h>    // for errno, ENOMEM
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uintptr_t
+#include <stdlib.h>   // for abort, getenv
+#include <string.h>   // for memcpy, memset
+#include <sys/mman.h> // for mmap
+#include <unistd.h>   // for getpagesize
+
+#include "alloc_stats.h"
+#include "debug.h"
+#include "malloc_internal.h"
+
+//===-- Global variables --------------------------------------------------===//
+
+/// Maps def site tags to the base of their bump region (NULL if not yet
+/// created). Published with a release store and read with a relaxed load, as
+/// in malloc.c
+static void *bump_bases[FUZZALLOC_TAG_MAX + 1];
+
+/// Per-tag bump offset (bytes allocated so far)
+static size_t bump_offsets[FUZZALLOC_TAG_MAX + 1];
+
+/// Per-tag high-water mark: offsets below this may contain recycled (dirty)
+/// memory after a reset; offsets at or above it are fresh zero pages
+static size_t bump_high_water[FUZZALLOC_TAG_MAX + 1];
+
+/// Per-tag bump offset at snapshot time (for __fuzzalloc_reset_all)
+static size_t bump_snapshots[FUZZALLOC_TAG_MAX + 1];
+
+/// Whether a snapshot has been taken (the first __fuzzalloc_reset_all call)
+static bool_t snapshotted = FALSE;
+
+/// Page size determined at runtime by `getpagesize`
+static int page_size = 0;
+
+/// Constant determined on first allocation. Size of a bump region, determined
+/// from the `MSPACE_SIZE_ENV_VAR` environment variable
+static size_t mspace_size = 0;
+
+#if defined(FUZZALLOC_USE_LOCKS)
+static pthread_mutex_t malloc_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+//===-- Private helper functions ------------------------------------------===//
+
+/// Alignment of returned chunks. Each chunk is preceded by a header of the
+/// same size holding the allocation size (needed by realloc)
+#define BUMP_CHUNK_ALIGNMENT 16
+
+static inline uintptr_t align(uintptr_t n, size_t alignment) {
+  return (n + alignment - 1) & -alignment;
+}
+
+static size_t init_mspace_size(void) {
+  size_t psize = MSPACE_DEFAULT_SIZE;
+
+  char *mspace_size_str = getenv(MSPACE_SIZE_ENV_VAR);
+  if (mspace_size_str) {
+    char *endptr;
+    psize = strtoul(mspace_size_str, &endptr, 0);
+    if (psize == 0 || *endptr != '\0' || mspace_size_str == endptr) {
+      DEBUG_MSG("unable to read %s environment variable: %s\n",
+                MSPACE_SIZE_ENV_VAR, mspace_size_str);
+      psize = MSPACE_DEFAULT_SIZE;
+    }
+  }
+
+  assert(page_size);
+  return align(psize, page_size);
+}
+
+static void *create_bump_region(tag_t def_site_tag) {
+  assert(def_site_tag != 0);
+
+  if (__builtin_expect(page_size == 0, FALSE)) {
+    page_size = getpagesize();
+  }
+  if (__builtin_expect(mspace_size == 0, FALSE)) {
+    mspace_size = init_mspace_size();
+    assert(mspace_size <= MSPACE_ALIGNMENT);
+    DEBUG_MSG("using bump region size %lu bytes\n", mspace_size);
+  }
+
+  // Reserve the tag-addressed range. MAP_NORESERVE keeps setup cheap - the
+  // bump pointer only ever touches pages it hands out
+  void *mmap_base_addr = GET_MSPACE(def_site_tag);
+  void *mmap_base =
+      mmap(mmap_base_addr, mspace_size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  if (mmap_base == (void *)(-1)) {
+    DEBUG_MSG("mmap failed: %s\n", strerror(errno));
+    abort();
+  }
+
+  DEBUG_MSG("bump region (size %lu bytes) created for def site %#x\n",
+            mspace_size, def_site_tag);
+  __atomic_store_n(&bump_bases[def_site_tag], mmap_base, __ATOMIC_RELEASE);
+
+  return mmap_base;
+}
+
+static void *get_bump_region(tag_t def_site_tag) {
+  void *base = __atomic_load_n(&bump_bases[def_site_tag], __ATOMIC_RELAXED);
+  if (__builtin_expect(base != NULL, TRUE)) {
+    return base;
+  }
+
+  ACQUIRE_MALLOC_GLOBAL_LOCK();
+  base = __atomic_load_n(&bump_bases[def_site_tag], __ATOMIC_RELAXED);
+  if (!base) {
+    base = create_bump_region(def_site_tag);
+  }
+  RELEASE_MALLOC_GLOBAL_LOCK();
+
+  return base;
+}
+
+/// Carve `size` usable bytes (plus the size header) off the given tag's bump
+/// region. Returns NULL (with errno set) if the region is exhausted
+static void *bump_alloc(tag_t def_site_tag, size_t size) {
+  void *base = get_bump_region(def_site_tag);
+
+  size_t chunk_size =
+      align(size, BUMP_CHUNK_ALIGNMENT) + BUMP_CHUNK_ALIGNMENT;
+  size_t offset =
+      __atomic_fetch_add(&bump_offsets[def_site_tag], chunk_size,
+                         __ATOMIC_RELAXED);
+  if (__builtin_expect(offset + chunk_size > mspace_size, FALSE)) {
+    DEBUG_MSG("bump region for def site %#x exhausted\n", def_site_tag);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  void *mem = base + offset + BUMP_CHUNK_ALIGNMENT;
+  *(size_t *)(base + offset) = size;
+
+  // Credit the shared-memory statistics (see alloc_stats.c). Free is a no-op
+  // here, so live bytes only ever grow
+  if (__builtin_expect(__alloc_stats_enabled, FALSE)) {
+    alloc_stats_t *stats = &__alloc_stats_ptr[def_site_tag];
+
+    __atomic_fetch_add(&stats->allocs, 1, __ATOMIC_RELAXED);
+    uint64_t live =
+        __atomic_add_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&stats->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&stats->peak_bytes, &peak, live, TRUE,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  return mem;
+}
+
+/// Get the usable size of a chunk returned by bump_alloc
+static inline size_t bump_chunk_size(void *ptr) {
+  return *(size_t *)(ptr - BUMP_CHUNK_ALIGNMENT);
+}
+
+//===-- Persistent mode support -------------------------------------------===//
+
+static void reset_mspaces_from(tag_t min_tag) {
+  ACQUIRE_MALLOC_GLOBAL_LOCK();
+
+  if (!snapshotted) {
+    // First call: remember where startup allocations end (for every tag, so
+    // a later reset over a wider range still has a snapshot to rewind to)
+    for (size_t tag = 1; tag <= FUZZALLOC_TAG_MAX; tag++) {
+      bump_snapshots[tag] = bump_offsets[tag];
+    }
+    snapshotted = TRUE;
+  } else {
+    // Rewind every bump pointer to its snapshot. Memory above the snapshot
+    // is recycled wholesale; the high-water mark remembers that it is dirty
+    for (size_t tag = min_tag; tag <= FUZZALLOC_TAG_MAX; tag++) {
+      if (bump_offsets[tag] > bump_high_water[tag]) {
+        bump_high_water[tag] = bump_offsets[tag];
+      }
+      bump_offsets[tag] = bump_snapshots[tag];
+    }
+  }
+
+  RELEASE_MALLOC_GLOBAL_LOCK();
+}
+
+void __fuzzalloc_reset_all(void) {
+  DEBUG_MSG("__fuzzalloc_reset_all called from %p\n",
+            __builtin_return_address(0));
+
+  // Fork-free execution mode (see snapshot.c): also roll back .data/.bss and
+  // the libc heap, which the bump rewind below cannot reach
+  if (fuzzalloc_snapshot_enabled()) {
+    if (!fuzzalloc_snapshot_taken()) {
+      fuzzalloc_snapshot_take();
+    } else {
+      fuzzalloc_snapshot_restore();
+    }
+  }
+
+  reset_mspaces_from(1);
+}
+
+void __fuzzalloc_reset_def_sites(void) {
+  DEBUG_MSG("__fuzzalloc_reset_def_sites called from %p\n",
+            __builtin_return_address(0));
+
+  // Leave the default-tag regions alone so the host process's own (untagged)
+  // allocations survive - for in-process fuzzers that share the heap with
+  // the target
+  reset_mspaces_from(FUZZALLOC_TAG_MIN);
+}
+
+//===-- tagged malloc interface -------------------------------------------===//
+
+void *__tagged_malloc(tag_t def_site_tag, size_t size) {
+  DEBUG_MSG("__tagged_malloc(%#x, %lu) called from %p\n", def_site_tag, size,
+            __builtin_return_address(0));
+
+  return bump_alloc(def_site_tag, size);
+}
+
+void *__tagged_calloc(tag_t def_site_tag, size_t nmemb, size_t size) {
+  DEBUG_MSG("__tagged_calloc(%#x, %lu, %lu) called from %p\n", def_site_tag,
+            nmemb, size, __builtin_return_address(0));
+
+  // Need to check this to avoid a division-by-zero
+  if (__builtin_expect(size > 0, TRUE)) {
+    if (__builtin_expect(nmemb > mspace_size / size, FALSE)) {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  void *mem = bump_alloc(def_site_tag, nmemb * size);
+  if (!mem) {
+    return NULL;
+  }
+
+  // Fresh pages from the bump frontier are already zero; only recycled
+  // memory (below the high-water mark after a reset) needs clearing
+  void *base = bump_bases[def_site_tag];
+  if ((size_t)(mem - base) < bump_high_water[def_site_tag]) {
+    memset(mem, 0, nmemb * size);
+  }
+
+  return mem;
+}
+
+void *__tagged_realloc(tag_t def_site_tag, void *ptr, size_t size) {
+  DEBUG_MSG("__tagged_realloc(%#x, %p, %lu) called from %p\n", def_site_tag,
+            ptr, size, __builtin_return_address(0));
+
+  if (!ptr) {
+    return bump_alloc(def_site_tag, size);
+  }
+  if (size == 0) {
+    return NULL;
+  }
+
+  // Reuse the def site tag of the existing pointer, as in malloc.c. There is
+  // no in-place growth without free lists - allocate and copy
+  def_site_tag = GET_DEF_SITE_TAG(ptr);
+  size_t old_size = bump_chunk_size(ptr);
+  if (size <= old_size) {
+    return ptr;
+  }
+
+  void *mem = bump_alloc(def_site_tag, size);
+  if (!mem) {
+    return NULL;
+  }
+  memcpy(mem, ptr, old_size);
+
+  return mem;
+}
+
+void *__tagged_memalign(tag_t def_site_tag, size_t alignment, size_t size) {
+  DEBUG_MSG("__tagged_memalign(%#x, %lu, %lu) called from %p\n", def_site_tag,
+            alignment, size, __builtin_return_address(0));
+
+  if (alignment <= BUMP_CHUNK_ALIGNMENT) {
+    return bump_alloc(def_site_tag, size);
+  }
+
+  // Over-allocate so that the result can be aligned up, keeping room for the
+  // size header immediately below the returned pointer
+  void *mem = bump_alloc(def_site_tag, size + alignment);
+  if (!mem) {
+    return NULL;
+  }
+
+  void *aligned = (void *)align((uintptr_t)mem, alignment);
+  if (aligned != mem) {
+    *(size_t *)(aligned - BUMP_CHUNK_ALIGNMENT) = size;
+  }
+
+  return aligned;
+}
+
+int __tagged_posix_memalign(tag_t def_site_tag, void **memptr,
+                            size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 ||
+      alignment == 0) {
+    return EINVAL;
+  }
+
+  void *mem = __tagged_memalign(def_site_tag, alignment, size);
+  if (!mem) {
+    return ENOMEM;
+  }
+
+  *memptr = mem;
+  return 0;
+}
+
+void *__tagged_aligned_alloc(tag_t def_site_tag, size_t alignment,
+                             size_t size) {
+  return __tagged_memalign(def_site_tag, alignment, size);
+}
+
+//===-- malloc interface --------------------------------------------------===//
+
+void *malloc(size_t size) {
+  return __tagged_malloc(FUZZALLOC_DEFAULT_TAG, size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  return __tagged_calloc(FUZZALLOC_DEFAULT_TAG, nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  return __tagged_realloc(FUZZALLOC_DEFAULT_TAG, ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  return __tagged_posix_memalign(FUZZALLOC_DEFAULT_TAG, memptr, alignment,
+                                 size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return __tagged_aligned_alloc(FUZZALLOC_DEFAULT_TAG, alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  return __tagged_memalign(FUZZALLOC_DEFAULT_TAG, alignment, size);
+}
+
+void free(void *ptr) {
+  // No free-list bookkeeping: memory is reclaimed in bulk by
+  // __fuzzalloc_reset_all between fuzzing iterations
+  (void)ptr;
+}
+
+void __sized_free(void *ptr, size_t size) {
+  // As with free: reclaimed in bulk by __fuzzalloc_reset_all
+  (void)ptr;
+  (void)size;
+}
@@ -40,13 +40,100 @@ typedef uint8_t bool_t;
 
 //===-- mspace ------------------------------------------------------------===//
 
-/// Default mspace size (in bytes). Configurable at run-time via an environment
-/// variable
-#define MSPACE_DEFAULT_SIZE 0x100000000UL
+/// Default mspace size (in bytes): the full per-tag address span.
+/// Configurable at run-time via an environment variable
+#define MSPACE_DEFAULT_SIZE (1UL << FUZZALLOC_TAG_SHIFT)
 
 /// The mspace size environment variable
 #define MSPACE_SIZE_ENV_VAR "FUZZALLOC_MSPACE_SIZE"
 
+/// Environment variable enabling sparse mspace reservation. When set, mspaces
+/// are reserved `PROT_NONE`/`MAP_NORESERVE` and pages are committed on demand
+/// by a fault handler, so per-tag setup cost does not scale with mspace size
+#define SPARSE_MSPACES_ENV_VAR "FUZZALLOC_SPARSE_MSPACES"
+
+/// Granularity (in bytes) at which sparsely-reserved mspace pages are
+/// committed by the fault handler. Must be a power of two
+#define SPARSE_COMMIT_SIZE (1UL << 20)
+
+/// Environment variable enabling shared (rather than private) mspace
+/// mappings. Children forked by the AFL fork server then write mspace pages
+/// in place instead of taking a copy-on-write fault per page per execution.
+/// Only safe together with the persistent-mode `__fuzzalloc_reset_all` reset,
+/// since heap writes are no longer isolated between executions
+#define SHARED_MSPACES_ENV_VAR "FUZZALLOC_SHARED_MSPACES"
+
+/// Environment variable giving the number of bytes of each new mspace to
+/// pre-fault in the fork server parent, so children inherit populated page
+/// tables instead of faulting hot pages on every execution
+#define PREFAULT_MSPACES_ENV_VAR "FUZZALLOC_PREFAULT_MSPACES"
+
+/// Environment variable enabling on-demand mspace page reclamation. When set,
+/// an mspace whose live allocation count drops to zero has its committed
+/// pages returned to the OS with `MADV_DONTNEED` (keeping the reservation),
+/// so resident memory tracks live data instead of high-water marks
+#define RECLAIM_MSPACES_ENV_VAR "FUZZALLOC_RECLAIM_MSPACES"
+
+/// Environment variable enabling growable mspaces. When set, each def site
+/// reserves its full per-tag address span up front and commits only a small
+/// initial region, which is extended on demand as the mspace fills - so the
+/// memory footprint starts small and no run ever dies because the
+/// `FUZZALLOC_MSPACE_SIZE` guess was too low. `FUZZALLOC_MSPACE_SIZE`, if
+/// set, gives the initial committed size
+#define GROW_MSPACES_ENV_VAR "FUZZALLOC_GROW_MSPACES"
+
+/// Default initial committed size (in bytes) of a growable mspace
+#define MSPACE_GROW_INITIAL_SIZE (1UL << 24)
+
+/// Environment variable enabling transparent-hugepage backing for mspaces.
+/// When set, each mspace is sized in 2 MB units and advised `MADV_HUGEPAGE`,
+/// so pointer-chasing over a def site's allocations covers gigabytes with a
+/// handful of dTLB entries instead of thousands. Purely advisory: when THP is
+/// unavailable the mspace silently stays on 4 KB pages
+#define HUGEPAGE_MSPACES_ENV_VAR "FUZZALLOC_HUGEPAGE_MSPACES"
+
+/// Environment variable giving a comma-separated list of def site tags that
+/// opt out of hugepage backing (small, sparsely-used sites would waste most
+/// of each huge page)
+#define NOHUGEPAGE_TAGS_ENV_VAR "FUZZALLOC_NOHUGEPAGE_TAGS"
+
+/// Transparent huge page size (in bytes) on x86-64
+#define HUGEPAGE_SIZE (1UL << 21)
+
+/// Environment variable enabling NUMA-aware mspace placement. When set, each
+/// mspace reservation is `mbind`-ed before its first page is touched, so a
+/// fork-server child migrated to the other socket keeps allocator memory on
+/// its home node instead of paying remote-memory latency on every tagged
+/// access. Binds to the node of the creating process unless
+/// `FUZZALLOC_NUMA_NODE` says otherwise
+#define NUMA_MSPACES_ENV_VAR "FUZZALLOC_NUMA_MSPACES"
+
+/// Environment variable overriding the NUMA node that mspace pages are bound
+/// to (implies `FUZZALLOC_NUMA_MSPACES`). Useful when packing one campaign
+/// per socket on a shared box
+#define NUMA_NODE_ENV_VAR "FUZZALLOC_NUMA_NODE"
+
+/// Allocations at least this large (in bytes) are placed in their own
+/// page-aligned runs with a power-of-two usable capacity, so incremental
+/// realloc growth is absorbed by the run's reserved tail pages (committed on
+/// demand by the OS) instead of dlmalloc's allocate-copy-free fallback
+#define LARGE_ALLOC_THRESHOLD (1UL << 18)
+
+/// Environment variable enabling fork-free snapshot/restore execution (see
+/// snapshot.c). The first `__fuzzalloc_reset_all` call records every private
+/// writable mapping (mspaces, `.data`/`.bss`, the libc heap) and arms the
+/// kernel's soft-dirty page tracking; later calls copy back only the pages
+/// the last execution wrote, so iteration cost no longer includes `fork`'s
+/// page-table copy over the mspace reservations. Single-threaded targets only
+#define SNAPSHOT_ENV_VAR "FUZZALLOC_SNAPSHOT"
+
+/// Environment variable giving the size (in bytes) of each per-tag
+/// frame-scoped bump region (see stack_alloc.c)
+#define STACK_REGION_SIZE_ENV_VAR "FUZZALLOC_STACK_REGION_SIZE"
+
+/// Default per-tag frame-scoped bump region size (in bytes)
+#define STACK_REGION_DEFAULT_SIZE (1UL << 20)
+
 /// Mspace alignment. This ensures that the upper \p NUM_TAG_BITS of the mspace
 /// address are unique to a single mspace
 #define MSPACE_ALIGNMENT (1UL << FUZZALLOC_TAG_SHIFT)
@@ -57,4 +144,22 @@ typedef uint8_t bool_t;
 /// Get the def site tag associated with a pointer
 #define GET_DEF_SITE_TAG(p) ((tag_t)((uintptr_t)(p) >> FUZZALLOC_TAG_SHIFT))
 
+//===-- Snapshot/restore (snapshot.c) -------------------------------------===//
+
+/// Whether `SNAPSHOT_ENV_VAR` is set
+bool_t fuzzalloc_snapshot_enabled(void);
+
+/// Whether the process-wide snapshot has been taken
+bool_t fuzzalloc_snapshot_taken(void);
+
+/// Record every private writable mapping and arm soft-dirty page tracking
+void fuzzalloc_snapshot_take(void);
+
+/// Copy back the pages written since the last snapshot/restore
+void fuzzalloc_snapshot_restore(void);
+
+/// Whether the given address falls inside a snapshotted region (mappings
+/// created after the snapshot are not covered)
+bool_t fuzzalloc_snapshot_covers(const void *ptr);
+
 #endif // MALLOC_INTERNAL_H
@@ -5,12 +5,97 @@
 // Author: Adrian Herrera
 //
 
-#include <stdio.h>
+#include <fcntl.h>    // for open
+#include <stdio.h>    // for snprintf (via debug.h)
+#include <stdlib.h>   // for getenv, strtoul
+#include <sys/mman.h> // for mmap
+#include <unistd.h>   // for ftruncate, close
 
 #include "debug.h"
 #include "malloc_internal.h"
+#include "mem_trace.h"
+
+/// The mmap-ed trace ring buffer, or NULL when tracing to the debug log
+static mem_trace_header_t *trace_header = NULL;
+
+/// The record array, immediately following the header
+static mem_trace_record_t *trace_records = NULL;
+
+/// Capacity mask (`num_records - 1`)
+static uint64_t trace_mask = 0;
+
+/// Map the binary trace ring buffer. Runs before main, like the dataflow map
+/// handshake
+__attribute__((constructor)) static void __mem_trace_init(void) {
+  char *trace_file = getenv(MEM_TRACE_FILE_ENV_VAR);
+  if (!trace_file) {
+    // No trace file - fall back to the printf-style debug log
+    return;
+  }
+
+  uint64_t num_records = MEM_TRACE_DEFAULT_RECORDS;
+  char *num_records_str = getenv(MEM_TRACE_RECORDS_ENV_VAR);
+  if (num_records_str) {
+    char *endptr;
+    num_records = strtoul(num_records_str, &endptr, 0);
+    if (num_records == 0 || (num_records & (num_records - 1)) != 0 ||
+        *endptr != '\0' || num_records_str == endptr) {
+      DEBUG_MSG("unable to read %s environment variable: %s\n",
+                MEM_TRACE_RECORDS_ENV_VAR, num_records_str);
+      num_records = MEM_TRACE_DEFAULT_RECORDS;
+    }
+  }
+
+  size_t trace_size = sizeof(mem_trace_header_t) +
+                      num_records * sizeof(mem_trace_record_t);
+
+  int fd = open(trace_file, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    DEBUG_MSG("unable to open trace file %s\n", trace_file);
+    return;
+  }
+  if (ftruncate(fd, trace_size) != 0) {
+    DEBUG_MSG("unable to size trace file %s\n", trace_file);
+    close(fd);
+    return;
+  }
+
+  // A shared mapping so that the decoder (and the fuzzer) can drain the ring
+  // while the target runs
+  void *map =
+      mmap(NULL, trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == (void *)(-1)) {
+    DEBUG_MSG("unable to map trace file %s\n", trace_file);
+    return;
+  }
+
+  trace_header = (mem_trace_header_t *)map;
+  trace_header->magic = MEM_TRACE_MAGIC;
+  trace_header->num_records = num_records;
+  trace_records = (mem_trace_record_t *)(trace_header + 1);
+  trace_mask = num_records - 1;
+
+  DEBUG_MSG("trace ring buffer (%lu records) mapped at %p\n", num_records,
+            map);
+}
 
 void __mem_access(tag_t def_site, int64_t offset) {
+  if (__builtin_expect(trace_header != NULL, 1)) {
+    // Claim a slot with a single atomic increment - no locks, no formatting.
+    // The ring wraps, overwriting the oldest records
+    uint64_t slot =
+        __atomic_fetch_add(&trace_header->head, 1, __ATOMIC_RELAXED);
+    mem_trace_record_t *record = &trace_records[slot & trace_mask];
+
+    record->def_site = def_site;
+    record->unused = 0;
+    record->offset = (int32_t)offset;
+    record->ret_addr = (uint64_t)__builtin_return_address(0);
+
+    return;
+  }
+
   DEBUG_MSG("accessing def site %#x from %p (at offset %ld)\n", def_site,
             __builtin_return_address(0), offset);
 }
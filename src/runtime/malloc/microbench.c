@@ -0,0 +1,273 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+// Microbenchmarks for the tagged allocator. Exercises the tagged malloc
+// interface across size classes, tag counts, thread counts and alloc/free
+// patterns, reporting nanoseconds per alloc/free pair. The same source is
+// also built as fuzzalloc-microbench-glibc (with MICROBENCH_GLIBC defined
+// and no libfuzzalloc linked), giving a glibc baseline for every number, so
+// allocator regressions show up in seconds rather than an end-to-end
+// fuzzing campaign
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fuzzalloc.h"
+
+#if defined(MICROBENCH_GLIBC)
+// Baseline build: the tagged interface maps straight onto glibc malloc and
+// the tags are ignored
+#define TAGGED_MALLOC(tag, size) ((void)(tag), malloc(size))
+#define TAGGED_CALLOC(tag, nmemb, size) ((void)(tag), calloc(nmemb, size))
+#define TAGGED_REALLOC(tag, ptr, size) ((void)(tag), realloc(ptr, size))
+#else
+void *__tagged_malloc(tag_t def_site_tag, size_t size);
+void *__tagged_calloc(tag_t def_site_tag, size_t nmemb, size_t size);
+void *__tagged_realloc(tag_t def_site_tag, void *ptr, size_t size);
+
+#define TAGGED_MALLOC(tag, size) __tagged_malloc((tag), (size))
+#define TAGGED_CALLOC(tag, nmemb, size) __tagged_calloc((tag), (nmemb), (size))
+#define TAGGED_REALLOC(tag, ptr, size) __tagged_realloc((tag), (ptr), (size))
+#endif // MICROBENCH_GLIBC
+
+/// Live allocations per round. Large enough to defeat a single-slot cache,
+/// small enough to stay resident
+#define BATCH 256
+
+/// Alloc/free orderings
+enum pattern { PATTERN_LIFO, PATTERN_FIFO, PATTERN_RANDOM };
+
+static const size_t bench_sizes[] = {16,   64,    256,   1024,
+                                     4096, 16384, 65536};
+#define NUM_BENCH_SIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+/// Rounds per benchmark cell, settable with -n
+static unsigned num_rounds = 2000;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// xorshift64, good enough for shuffling free orders
+static uint64_t rng_next(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static void make_free_order(unsigned *order, enum pattern pattern,
+                            uint64_t *rng) {
+  for (unsigned i = 0; i < BATCH; i++) {
+    order[i] = (pattern == PATTERN_LIFO) ? BATCH - 1 - i : i;
+  }
+  if (pattern == PATTERN_RANDOM) {
+    for (unsigned i = BATCH - 1; i > 0; i--) {
+      unsigned j = rng_next(rng) % (i + 1);
+      unsigned tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+  }
+}
+
+/// Benchmark malloc/free pairs. Allocations are spread round-robin over
+/// `num_tags` tags starting at `base_tag`. Returns ns per alloc/free pair
+static double bench_malloc_free(tag_t base_tag, unsigned num_tags, size_t size,
+                                enum pattern pattern, unsigned rounds) {
+  void *ptrs[BATCH];
+  unsigned order[BATCH];
+  uint64_t rng = 0x8c15f1fu + size + pattern;
+  unsigned next_tag = 0;
+
+  make_free_order(order, pattern, &rng);
+
+  uint64_t start = now_ns();
+  for (unsigned r = 0; r < rounds; r++) {
+    for (unsigned i = 0; i < BATCH; i++) {
+      tag_t tag = base_tag + (next_tag++ % num_tags);
+      ptrs[i] = TAGGED_MALLOC(tag, size);
+      if (!ptrs[i]) {
+        fprintf(stderr, "allocation of %zu bytes failed\n", size);
+        exit(1);
+      }
+      // Touch the memory so lazily-mapped pages are paid for here, as they
+      // would be in a real target
+      *(volatile char *)ptrs[i] = 1;
+    }
+    for (unsigned i = 0; i < BATCH; i++) {
+      free(ptrs[order[i]]);
+    }
+  }
+
+  return (double)(now_ns() - start) / ((uint64_t)rounds * BATCH);
+}
+
+/// Benchmark calloc/free pairs (LIFO). Returns ns per pair
+static double bench_calloc(tag_t base_tag, size_t size, unsigned rounds) {
+  void *ptrs[BATCH];
+
+  uint64_t start = now_ns();
+  for (unsigned r = 0; r < rounds; r++) {
+    for (unsigned i = 0; i < BATCH; i++) {
+      ptrs[i] = TAGGED_CALLOC(base_tag, 1, size);
+      *(volatile char *)ptrs[i] = 1;
+    }
+    for (unsigned i = 0; i < BATCH; i++) {
+      free(ptrs[BATCH - 1 - i]);
+    }
+  }
+
+  return (double)(now_ns() - start) / ((uint64_t)rounds * BATCH);
+}
+
+/// Benchmark a realloc growth chain (16 bytes doubled up to 64K). Returns ns
+/// per realloc call
+static double bench_realloc(tag_t base_tag, unsigned rounds) {
+  uint64_t num_reallocs = 0;
+
+  uint64_t start = now_ns();
+  for (unsigned r = 0; r < rounds; r++) {
+    void *ptr = NULL;
+    for (size_t size = 16; size <= 65536; size *= 2) {
+      ptr = TAGGED_REALLOC(base_tag, ptr, size);
+      *(volatile char *)ptr = 1;
+      num_reallocs++;
+    }
+    free(ptr);
+  }
+
+  return (double)(now_ns() - start) / num_reallocs;
+}
+
+struct thread_args {
+  tag_t base_tag;
+  unsigned rounds;
+  double ns_per_op;
+};
+
+static void *thread_bench(void *arg) {
+  struct thread_args *args = arg;
+  args->ns_per_op = bench_malloc_free(args->base_tag, 16, 64, PATTERN_LIFO,
+                                      args->rounds);
+  return NULL;
+}
+
+/// Benchmark malloc/free pairs with `num_threads` threads on disjoint tag
+/// ranges. Returns aggregate million ops/sec
+static double bench_threads(tag_t base_tag, unsigned num_threads,
+                            unsigned rounds) {
+  pthread_t threads[64];
+  struct thread_args args[64];
+
+  uint64_t start = now_ns();
+  for (unsigned t = 0; t < num_threads; t++) {
+    args[t].base_tag = base_tag + t * 16;
+    args[t].rounds = rounds;
+    if (pthread_create(&threads[t], NULL, thread_bench, &args[t])) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
+  }
+  for (unsigned t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  return ((double)num_threads * rounds * BATCH * 1000.0) / elapsed;
+}
+
+int main(int argc, char **argv) {
+  unsigned max_threads = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:t:")) > 0) {
+    switch (opt) {
+    case 'n':
+      num_rounds = atoi(optarg);
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-n rounds] [-t max threads]\n\n"
+              "Thread counts above 1 require a FUZZALLOC_USE_LOCKS build of "
+              "libfuzzalloc\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (!num_rounds || !max_threads || max_threads > 64) {
+    fprintf(stderr, "bad -n/-t value\n");
+    return 1;
+  }
+
+#if !defined(MICROBENCH_GLIBC)
+  // Keep the per-tag address space reservation small so that the tag-count
+  // sweep below doesn't exhaust virtual memory
+  setenv("FUZZALLOC_MSPACE_SIZE", "0x4000000", 0);
+#endif
+
+  const tag_t base_tag = FUZZALLOC_TAG_MIN;
+  const unsigned max_tags = FUZZALLOC_TAG_MAX - FUZZALLOC_TAG_MIN + 1;
+
+#if defined(MICROBENCH_GLIBC)
+  printf("fuzzalloc-microbench (glibc baseline)\n\n");
+#else
+  printf("fuzzalloc-microbench\n\n");
+#endif
+
+  printf("malloc/free (ns per pair, single tag):\n");
+  printf("%10s %8s %8s %8s\n", "size", "LIFO", "FIFO", "random");
+  for (unsigned s = 0; s < NUM_BENCH_SIZES; s++) {
+    printf("%10zu", bench_sizes[s]);
+    for (enum pattern p = PATTERN_LIFO; p <= PATTERN_RANDOM; p++) {
+      printf(" %8.1f",
+             bench_malloc_free(base_tag, 1, bench_sizes[s], p, num_rounds));
+    }
+    printf("\n");
+  }
+
+  printf("\nmalloc/free (ns per pair, 64-byte LIFO, spread over tags):\n");
+  printf("%10s %8s\n", "tags", "ns");
+  const unsigned tag_counts[] = {1, 16, 256, 4096, max_tags};
+  for (unsigned t = 0; t < sizeof(tag_counts) / sizeof(tag_counts[0]); t++) {
+    unsigned num_tags = tag_counts[t] < max_tags ? tag_counts[t] : max_tags;
+    printf("%10u %8.1f\n", num_tags,
+           bench_malloc_free(base_tag, num_tags, 64, PATTERN_LIFO,
+                             num_rounds));
+  }
+
+  printf("\ncalloc/free (ns per pair, single tag):\n");
+  printf("%10s %8s\n", "size", "ns");
+  for (unsigned s = 0; s < NUM_BENCH_SIZES; s++) {
+    printf("%10zu %8.1f\n", bench_sizes[s],
+           bench_calloc(base_tag, bench_sizes[s], num_rounds));
+  }
+
+  printf("\nrealloc growth chain 16B -> 64K (ns per realloc): %.1f\n",
+         bench_realloc(base_tag, num_rounds));
+
+  if (max_threads > 1) {
+    printf("\nmalloc/free throughput (Mops/sec, 64-byte LIFO, 16 tags per "
+           "thread):\n");
+    printf("%10s %10s\n", "threads", "Mops/sec");
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+      printf("%10u %10.2f\n", t, bench_threads(base_tag, t, num_rounds));
+    }
+  }
+
+  return 0;
+}
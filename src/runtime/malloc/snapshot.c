@@ -0,0 +1,270 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+// Page-granular snapshot/restore for fork-free persistent fuzzing
+// (`FUZZALLOC_SNAPSHOT`). Even with a fork server, `fork` itself - the
+// page-table copy and copy-on-write setup over every mspace reservation -
+// caps execution rates regardless of target speed. Because all heap state is
+// confined to private writable mappings with known bounds, the process can
+// instead be rolled back in place: the first `__fuzzalloc_reset_all` records
+// a copy of every private writable region (mspaces, `.data`/`.bss` of all
+// loaded objects, the libc heap) and clears the kernel's soft-dirty page
+// bits; later calls consult /proc/self/pagemap and copy back only the pages
+// the last execution actually wrote. Single-threaded targets only - restoring
+// another thread's stack or heap out from under it is not supported
+//
+
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for open
+#include <stdint.h>   // for uintptr_t, uint64_t
+#include <stdio.h>    // for sscanf
+#include <stdlib.h>   // for abort, getenv
+#include <string.h>   // for memcpy, strcmp
+#include <sys/mman.h> // for mmap
+#include <unistd.h>   // for read, write, pread, close, getpagesize
+
+#include "debug.h"
+#include "malloc_internal.h"
+
+/// Maximum number of tracked regions. /proc/self/maps rarely exceeds a few
+/// hundred entries even for heavily-instrumented targets
+#define SNAPSHOT_MAX_REGIONS 4096
+
+/// Soft-dirty bit in a /proc/self/pagemap entry (see
+/// Documentation/admin-guide/mm/soft-dirty.rst)
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+
+/// Number of pagemap entries read per `pread`
+#define PAGEMAP_BATCH 1024
+
+/// A private writable mapping recorded at snapshot time, together with a copy
+/// of its contents
+typedef struct {
+  uint8_t *base;
+  size_t len;
+  uint8_t *copy;
+} snapshot_region_t;
+
+static snapshot_region_t snapshot_regions[SNAPSHOT_MAX_REGIONS];
+static size_t num_snapshot_regions = 0;
+
+/// Kept open across iterations - reopening per restore would cost two
+/// syscalls per execution
+static int pagemap_fd = -1;
+static int clear_refs_fd = -1;
+
+static bool_t snapshot_exists = FALSE;
+
+bool_t fuzzalloc_snapshot_enabled(void) {
+  static int enabled = -1;
+
+  if (enabled < 0) {
+    enabled = getenv(SNAPSHOT_ENV_VAR) != NULL;
+  }
+
+  return enabled;
+}
+
+bool_t fuzzalloc_snapshot_taken(void) { return snapshot_exists; }
+
+bool_t fuzzalloc_snapshot_covers(const void *ptr) {
+  for (size_t i = 0; i < num_snapshot_regions; i++) {
+    if ((const uint8_t *)ptr >= snapshot_regions[i].base &&
+        (const uint8_t *)ptr <
+            snapshot_regions[i].base + snapshot_regions[i].len) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/// Clear the soft-dirty bits of every page in the process, so the next
+/// pagemap read reports exactly the pages written since this call
+static void clear_soft_dirty(void) {
+  if (lseek(clear_refs_fd, 0, SEEK_SET) != 0 ||
+      write(clear_refs_fd, "4", 1) != 1) {
+    DEBUG_MSG("clearing soft-dirty bits failed: %s\n", strerror(errno));
+    abort();
+  }
+}
+
+/// Decide whether a /proc/self/maps line describes a region the snapshot
+/// should cover, and if so record its bounds
+static void maybe_track_region(const char *line) {
+  uintptr_t start, end;
+  char perms[8];
+
+  if (sscanf(line, "%lx-%lx %7s", &start, &end, perms) != 3) {
+    return;
+  }
+
+  // Only private writable mappings hold rollback-relevant state. Shared
+  // mappings are excluded deliberately: the AFL SHM coverage maps must keep
+  // their contents until the fuzzer has read them
+  if (perms[1] != 'w' || perms[3] != 'p') {
+    return;
+  }
+
+  // Never restore a stack out from under ourselves
+  const char *path = strchr(line, '[');
+  if (path && (!strcmp(path, "[stack]") || !strcmp(path, "[vvar]") ||
+               !strcmp(path, "[vdso]") || !strcmp(path, "[vsyscall]"))) {
+    return;
+  }
+  uintptr_t sp = (uintptr_t)&start;
+  if (sp >= start && sp < end) {
+    return;
+  }
+
+  if (num_snapshot_regions == SNAPSHOT_MAX_REGIONS) {
+    DEBUG_MSG("too many regions to snapshot\n");
+    abort();
+  }
+
+  snapshot_regions[num_snapshot_regions].base = (uint8_t *)start;
+  snapshot_regions[num_snapshot_regions].len = end - start;
+  num_snapshot_regions++;
+}
+
+/// Soft-dirty reporting is optional (CONFIG_MEM_SOFT_DIRTY): on kernels
+/// built without it the clear_refs write still succeeds but pagemap bit 55
+/// is never set, which would turn every restore into a silent no-op and leak
+/// heap/.data state across iterations. Dirty a probe page and insist the bit
+/// sticks before trusting the mechanism
+static void verify_soft_dirty(void) {
+  const size_t page_size = (size_t)getpagesize();
+
+  uint8_t *probe = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (probe == (void *)(-1)) {
+    DEBUG_MSG("probe mmap failed: %s\n", strerror(errno));
+    abort();
+  }
+
+  *probe = 1;
+  clear_soft_dirty();
+  *probe = 2;
+
+  uint64_t entry = 0;
+  if (pread(pagemap_fd, &entry, sizeof(entry),
+            (off_t)((uintptr_t)probe / page_size) * sizeof(entry)) !=
+      sizeof(entry)) {
+    DEBUG_MSG("pagemap read failed: %s\n", strerror(errno));
+    abort();
+  }
+  if (!(entry & PAGEMAP_SOFT_DIRTY)) {
+    DEBUG_MSG("soft-dirty tracking is not functional on this kernel "
+              "(missing CONFIG_MEM_SOFT_DIRTY?)\n");
+    abort();
+  }
+
+  munmap(probe, page_size);
+}
+
+/// Walk /proc/self/maps line by line. Read with raw syscalls into static
+/// buffers - going through stdio would allocate, mutating the very heap
+/// being snapshotted mid-walk
+static void collect_regions(void) {
+  static char line[512];
+  static char buf[4096];
+  size_t line_len = 0;
+  ssize_t n;
+
+  int fd = open("/proc/self/maps", O_RDONLY);
+  if (fd < 0) {
+    DEBUG_MSG("unable to open /proc/self/maps: %s\n", strerror(errno));
+    abort();
+  }
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] != '\n') {
+        if (line_len < sizeof(line) - 1) {
+          line[line_len++] = buf[i];
+        }
+        continue;
+      }
+      line[line_len] = '\0';
+      line_len = 0;
+      maybe_track_region(line);
+    }
+  }
+
+  close(fd);
+}
+
+void fuzzalloc_snapshot_take(void) {
+  pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+  clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (pagemap_fd < 0 || clear_refs_fd < 0) {
+    DEBUG_MSG("soft-dirty tracking unavailable: %s\n", strerror(errno));
+    abort();
+  }
+  verify_soft_dirty();
+
+  collect_regions();
+
+  // Populate all bookkeeping (copy pointers included) before copying any
+  // contents: this module's own .bss is one of the tracked regions, so the
+  // snapshotted metadata must already match its live values - restoring it
+  // is then a no-op instead of a corruption
+  for (size_t i = 0; i < num_snapshot_regions; i++) {
+    void *copy = mmap(NULL, snapshot_regions[i].len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == (void *)(-1)) {
+      DEBUG_MSG("snapshot mmap failed: %s\n", strerror(errno));
+      abort();
+    }
+    snapshot_regions[i].copy = copy;
+  }
+  snapshot_exists = TRUE;
+
+  for (size_t i = 0; i < num_snapshot_regions; i++) {
+    memcpy(snapshot_regions[i].copy, snapshot_regions[i].base,
+           snapshot_regions[i].len);
+    DEBUG_MSG("snapshotted %lu bytes at %p\n", snapshot_regions[i].len,
+              snapshot_regions[i].base);
+  }
+
+  clear_soft_dirty();
+}
+
+void fuzzalloc_snapshot_restore(void) {
+  static uint64_t entries[PAGEMAP_BATCH];
+  const size_t page_size = (size_t)getpagesize();
+
+  for (size_t i = 0; i < num_snapshot_regions; i++) {
+    const snapshot_region_t *region = &snapshot_regions[i];
+    const size_t num_pages = region->len / page_size;
+    const uintptr_t first_page = (uintptr_t)region->base / page_size;
+
+    for (size_t page = 0; page < num_pages; page += PAGEMAP_BATCH) {
+      size_t batch = num_pages - page;
+      if (batch > PAGEMAP_BATCH) {
+        batch = PAGEMAP_BATCH;
+      }
+
+      if (pread(pagemap_fd, entries, batch * sizeof(uint64_t),
+                (off_t)(first_page + page) * sizeof(uint64_t)) !=
+          (ssize_t)(batch * sizeof(uint64_t))) {
+        DEBUG_MSG("pagemap read failed: %s\n", strerror(errno));
+        abort();
+      }
+
+      for (size_t j = 0; j < batch; j++) {
+        if (entries[j] & PAGEMAP_SOFT_DIRTY) {
+          const size_t offset = (page + j) * page_size;
+          memcpy(region->base + offset, region->copy + offset, page_size);
+        }
+      }
+    }
+  }
+
+  // Clearing last means our own restore writes are wiped too, so the next
+  // restore copies exactly the pages the next execution dirties
+  clear_soft_dirty();
+}
@@ -0,0 +1,151 @@
+//
+// fuzzalloc
+// A memory allocator for fuzzing
+//
+// Author: Adrian Herrera
+//
+
+#include <stdlib.h> // for getenv, strtoul, free
+
+#include "debug.h"
+#include "malloc_internal.h"
+
+/// A frame-scoped bump region. Heapified allocas keep stack-like allocation
+/// cost: `__tagged_stack_alloc` bumps `top` and `__tagged_stack_restore` pops
+/// it back, so a function entry/exit pair costs two pointer adjustments
+/// instead of a malloc/free round trip. The region itself is carved out of
+/// the tag's mspace (with `__tagged_malloc`), so the def site tag stays in
+/// the upper bits of every address handed out
+struct stack_region {
+  uint8_t *base;
+  uint8_t *top;
+  uint8_t *end;
+};
+
+/// Map def site tags to their bump regions. Regions are created lazily on the
+/// first allocation for a given tag
+static struct stack_region stack_regions[FUZZALLOC_TAG_MAX + 1];
+
+/// Constant determined on first allocation. Size of a bump region, determined
+/// from the `STACK_REGION_SIZE_ENV_VAR` environment variable
+static size_t stack_region_size = 0;
+
+/// Alignment of the pointers handed out by `__tagged_stack_alloc`. Matches
+/// dlmalloc's allocation alignment
+#define STACK_ALLOC_ALIGNMENT (2 * sizeof(void *))
+
+#if defined(FUZZALLOC_USE_LOCKS)
+static pthread_mutex_t stack_alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ACQUIRE_STACK_ALLOC_LOCK() (pthread_mutex_lock(&stack_alloc_mutex))
+#define RELEASE_STACK_ALLOC_LOCK() (pthread_mutex_unlock(&stack_alloc_mutex))
+#else // No locking
+#define ACQUIRE_STACK_ALLOC_LOCK()
+#define RELEASE_STACK_ALLOC_LOCK()
+#endif // defined(FUZZALLOC_USE_LOCKS)
+
+extern void *__tagged_malloc(tag_t def_site_tag, size_t size);
+
+static size_t init_stack_region_size(void) {
+  size_t rsize = STACK_REGION_DEFAULT_SIZE;
+
+  char *region_size_str = getenv(STACK_REGION_SIZE_ENV_VAR);
+  if (region_size_str) {
+    char *endptr;
+    rsize = strtoul(region_size_str, &endptr, 0);
+    if (rsize == 0 || *endptr != '\0' || region_size_str == endptr) {
+      DEBUG_MSG("unable to read %s environment variable: %s\n",
+                STACK_REGION_SIZE_ENV_VAR, region_size_str);
+      rsize = STACK_REGION_DEFAULT_SIZE;
+    }
+  }
+
+  return rsize;
+}
+
+void *__tagged_stack_alloc(tag_t def_site_tag, size_t size) {
+  DEBUG_MSG("__tagged_stack_alloc(%#x, %lu) called from %p\n", def_site_tag,
+            size, __builtin_return_address(0));
+
+  ACQUIRE_STACK_ALLOC_LOCK();
+
+  struct stack_region *region = &stack_regions[def_site_tag];
+
+  if (!region->base) {
+    if (stack_region_size == 0) {
+      stack_region_size = init_stack_region_size();
+    }
+
+    // Carve the bump region out of the tag's mspace so that the def site tag
+    // is encoded in the upper bits of every pointer we hand out
+    uint8_t *base = __tagged_malloc(def_site_tag, stack_region_size);
+    if (!base) {
+      RELEASE_STACK_ALLOC_LOCK();
+      return NULL;
+    }
+
+    region->base = base;
+    region->top = base;
+    region->end = base + stack_region_size;
+
+    DEBUG_MSG("stack region for def site %#x at %p (%lu bytes)\n",
+              def_site_tag, base, stack_region_size);
+  }
+
+  size = (size + STACK_ALLOC_ALIGNMENT - 1) & ~(STACK_ALLOC_ALIGNMENT - 1);
+
+  if ((size_t)(region->end - region->top) < size) {
+    // The region is exhausted (deep recursion or an oversized buffer). Fall
+    // back to a regular tagged allocation; `__tagged_stack_restore` frees
+    // pointers that fall outside the region
+    RELEASE_STACK_ALLOC_LOCK();
+
+    DEBUG_MSG("stack region for def site %#x exhausted - falling back to "
+              "__tagged_malloc\n",
+              def_site_tag);
+    return __tagged_malloc(def_site_tag, size);
+  }
+
+  void *mem = region->top;
+  region->top += size;
+
+  RELEASE_STACK_ALLOC_LOCK();
+
+  return mem;
+}
+
+void __tagged_stack_restore(void *ptr) {
+  DEBUG_MSG("__tagged_stack_restore(%p) called from %p\n", ptr,
+            __builtin_return_address(0));
+
+  if (!ptr) {
+    return;
+  }
+
+  tag_t def_site_tag = GET_DEF_SITE_TAG(ptr);
+
+  ACQUIRE_STACK_ALLOC_LOCK();
+
+  struct stack_region *region = &stack_regions[def_site_tag];
+
+  if ((uint8_t *)ptr >= region->base && (uint8_t *)ptr < region->end) {
+    // Pop the region back to this allocation, releasing it and everything
+    // allocated after it. Restores only ever move the top downwards: a frame
+    // with several heapified allocas restores each of them at function exit,
+    // and the lowest pointer wins
+    if ((uint8_t *)ptr < region->top) {
+      region->top = ptr;
+    }
+    RELEASE_STACK_ALLOC_LOCK();
+    return;
+  }
+
+  RELEASE_STACK_ALLOC_LOCK();
+
+  // An overflow fallback allocation (see __tagged_stack_alloc)
+  free(ptr);
+}
+
+/// Untagged entry point, for code built without the TagDynamicAllocs pass
+void *__stack_alloc(size_t size) {
+  return __tagged_stack_alloc(FUZZALLOC_DEFAULT_TAG, size);
+}
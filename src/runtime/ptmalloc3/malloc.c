@@ -1759,13 +1759,8 @@ static MLOCK_T morecore_mutex;
 /* -----------------------  User-defined locks ------------------------ */
 
 #if USE_LOCKS > 1
-/* Define your own lock implementation here */
-/* #define INITIAL_LOCK(sl)  ... */
-/* #define ACQUIRE_LOCK(sl)  ... */
-/* #define RELEASE_LOCK(sl)  ... */
-/* #define TRY_LOCK(sl) ... */
-/* #define IS_LOCKED(sl) ... */
-/* #define NULL_LOCK_INITIALIZER ... */
+/* Adaptive futex lock (Linux-only): bounded spinning, then FUTEX_WAIT */
+#include "futex-lock.h"
 
 static MLOCK_T magic_init_mutex = NULL_LOCK_INITIALIZER;
 #if HAVE_MORECORE
@@ -0,0 +1,122 @@
+/*
+  Adaptive futex-based lock for ptmalloc3's mspaces, plugged in through
+  malloc.c's user-defined lock hook (USE_LOCKS == 2).
+
+  The stock USE_LOCKS == 1 spin lock busy-waits (with sched_yield
+  syscalls) for as long as the holder is preempted, which shows up as
+  heavy spin/yield time in multi-threaded targets. This lock spins only
+  briefly - a contended mspace critical section is typically a few
+  hundred cycles - and then sleeps in the kernel with FUTEX_WAIT, waking
+  exactly one waiter on release. The uncontended paths are a single
+  compare-and-swap in and a single exchange out; the kernel is only
+  entered when a waiter has advertised itself. Linux-only, like the rest
+  of fuzzalloc.
+
+  Lock word states: 0 - unlocked, 1 - locked, 2 - locked with (possible)
+  waiters. Recursive acquisition is supported, as dlmalloc requires.
+*/
+
+#ifndef _PTHREAD_FUTEX_LOCK_H
+#define _PTHREAD_FUTEX_LOCK_H
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct futex_mlock_t
+{
+  volatile unsigned int l;     /* 0 free, 1 locked, 2 contended */
+  volatile unsigned int c;     /* recursion count */
+  volatile pthread_t threadid; /* current owner */
+};
+#define MLOCK_T struct futex_mlock_t
+#define CURRENT_THREAD        pthread_self()
+
+/* Spin this many times (with pause) before sleeping in the kernel */
+#define FUTEX_LOCK_SPINS      128
+
+static FORCEINLINE long futex_lock_wait(volatile unsigned int *l) {
+  return syscall(SYS_futex, l, FUTEX_WAIT_PRIVATE, 2, (void *)0, (void *)0, 0);
+}
+
+static FORCEINLINE long futex_lock_wake(volatile unsigned int *l) {
+  return syscall(SYS_futex, l, FUTEX_WAKE_PRIVATE, 1, (void *)0, (void *)0, 0);
+}
+
+static FORCEINLINE int futex_acquire_lock (MLOCK_T *sl) {
+  unsigned int prev;
+
+  if (CURRENT_THREAD == sl->threadid) {
+    ++sl->c;
+    return 0;
+  }
+
+  prev = 0;
+  if (!__atomic_compare_exchange_n(&sl->l, &prev, 1, 0, __ATOMIC_ACQUIRE,
+                                   __ATOMIC_RELAXED)) {
+    int spins;
+
+    /* Bounded adaptive spin: if the holder is running it will release
+       shortly; if it was preempted, stop burning its timeslice and sleep */
+    for (spins = 0; spins < FUTEX_LOCK_SPINS; ++spins) {
+      __asm__ __volatile__("pause");
+      if (__atomic_load_n(&sl->l, __ATOMIC_RELAXED) == 0) {
+        prev = 0;
+        if (__atomic_compare_exchange_n(&sl->l, &prev, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+          goto locked;
+      }
+    }
+
+    /* Slow path: advertise a waiter and sleep until the lock is handed
+       over. The lock word stays 2 for as long as anyone might be waiting,
+       so the releaser knows to issue a wake */
+    while (__atomic_exchange_n(&sl->l, 2, __ATOMIC_ACQUIRE) != 0)
+      futex_lock_wait(&sl->l);
+  }
+
+locked:
+  assert(!sl->threadid);
+  sl->threadid = CURRENT_THREAD;
+  sl->c = 1;
+  return 0;
+}
+
+static FORCEINLINE void futex_release_lock (MLOCK_T *sl) {
+  assert(CURRENT_THREAD == sl->threadid);
+  if (!--sl->c) {
+    sl->threadid = 0;
+    /* Only enter the kernel when a waiter advertised itself */
+    if (__atomic_exchange_n(&sl->l, 0, __ATOMIC_RELEASE) == 2)
+      futex_lock_wake(&sl->l);
+  }
+}
+
+static FORCEINLINE int futex_try_lock (MLOCK_T *sl) {
+  unsigned int prev;
+
+  if (CURRENT_THREAD == sl->threadid) {
+    ++sl->c;
+    return 1;
+  }
+
+  prev = 0;
+  if (__atomic_compare_exchange_n(&sl->l, &prev, 1, 0, __ATOMIC_ACQUIRE,
+                                  __ATOMIC_RELAXED)) {
+    assert(!sl->threadid);
+    sl->threadid = CURRENT_THREAD;
+    sl->c = 1;
+    return 1;
+  }
+  return 0;
+}
+
+#define INITIAL_LOCK(sl)      (memset((void *)(sl), 0, sizeof(MLOCK_T)), 0)
+#define ACQUIRE_LOCK(sl)      futex_acquire_lock(sl)
+#define RELEASE_LOCK(sl)      futex_release_lock(sl)
+#define TRY_LOCK(sl)          futex_try_lock(sl)
+#define IS_LOCKED(sl)         ((sl)->l != 0)
+#define NULL_LOCK_INITIALIZER { 0, 0, 0 }
+
+#endif /* !defined(_PTHREAD_FUTEX_LOCK_H) */
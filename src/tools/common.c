@@ -5,7 +5,15 @@
 // Author: Adrian Herrera
 //
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// AFL include files
+#include "alloc-inl.h"
+#include "debug.h"
 
 #include "common.h"
 
@@ -25,3 +33,211 @@ u8 check_if_assembler(u32 argc, const char **argv) {
 
   return 0;
 }
+
+/* 64-bit FNV-1a */
+
+static u64 hash_bytes(u64 hash, const u8 *data, size_t len) {
+  while (len--) {
+    hash ^= *data++;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+static u8 is_source_file(const char *arg) {
+  const char *ext = strrchr(arg, '.');
+  if (!ext) {
+    return 0;
+  }
+  ext++;
+
+  return !strcmp(ext, "c") || !strcmp(ext, "cc") || !strcmp(ext, "cpp") ||
+         !strcmp(ext, "cxx") || !strcmp(ext, "C");
+}
+
+/* Run the given preprocess-only (-E) command and fold its stdout into the
+   hash. Returns 0 if the preprocessor fails or produces no output */
+
+static u8 hash_preprocessed(u8 **pp_params, u64 *hash) {
+  int pipe_fds[2];
+
+  if (pipe(pipe_fds)) {
+    return 0;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    PFATAL("fork() failed");
+  }
+  if (!pid) {
+    close(pipe_fds[0]);
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    close(pipe_fds[1]);
+    execvp((char *)pp_params[0], (char **)pp_params);
+    exit(EXIT_FAILURE);
+  }
+  close(pipe_fds[1]);
+
+  u8 buf[1 << 16];
+  ssize_t len;
+  u8 got_output = 0;
+
+  while ((len = read(pipe_fds[0], buf, sizeof(buf))) > 0) {
+    *hash = hash_bytes(*hash, buf, len);
+    got_output = 1;
+  }
+  close(pipe_fds[0]);
+
+  int status;
+  if (waitpid(pid, &status, 0) <= 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    return 0;
+  }
+
+  return got_output;
+}
+
+u8 try_bitcode_cache(u32 argc, const char **argv, u8 **cc_params,
+                     u32 *cc_par_cnt) {
+  u8 *cache_dir = getenv(BITCODE_CACHE_ENV_VAR);
+  if (!cache_dir) {
+    return 0;
+  }
+
+  /* Only plain single-source compiles are cacheable. Anything unusual
+     (preprocessing, assembly output, explicit language overrides, response
+     files, stdin) falls through to a normal compile */
+
+  const char *src = NULL;
+  u8 have_c = 0;
+
+  for (u32 i = 1; i < argc; i++) {
+    const char *cur = argv[i];
+
+    if (!strcmp(cur, "-c")) {
+      have_c = 1;
+    } else if (!strcmp(cur, "-E") || !strcmp(cur, "-S") || !strcmp(cur, "-x") ||
+               !strcmp(cur, "-") || cur[0] == '@') {
+      return 0;
+    } else if (is_source_file(cur)) {
+      if (src) {
+        return 0;
+      }
+      src = cur;
+    }
+  }
+
+  if (!have_c || !src) {
+    return 0;
+  }
+
+  /* Frontend argument vector shared by the hash (preprocess) and fill
+     (bitcode emission) steps: the original arguments minus the output path,
+     plus the frontend-relevant flags the wrappers add unconditionally (keep
+     in sync with edit_params in dataflow-cc.c). -mdisable-const-array-pack
+     in particular changes the IR shape the fuzzalloc passes depend on, so
+     cached bitcode must be produced with it. The fuzzalloc plugin arguments
+     themselves are excluded, so dataflow-preprocess and dataflow-cc (and
+     dataflow-cc runs with different pass configurations) share entries */
+
+  u8 **fe_params = ck_alloc((argc + 16) * sizeof(u8 *));
+  u32 fe_par_cnt = 0;
+
+  fe_params[fe_par_cnt++] = cc_params[0];
+
+  for (u32 i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o")) {
+      i++;
+      continue;
+    }
+    fe_params[fe_par_cnt++] = (u8 *)argv[i];
+  }
+
+  fe_params[fe_par_cnt++] = "-Xclang";
+  fe_params[fe_par_cnt++] = "-mdisable-const-array-pack";
+  fe_params[fe_par_cnt++] = "-Qunused-arguments";
+
+  if (!getenv("AFL_DONT_OPTIMIZE")) {
+    fe_params[fe_par_cnt++] = "-g";
+    fe_params[fe_par_cnt++] = "-O3";
+    fe_params[fe_par_cnt++] = "-funroll-loops";
+  }
+
+  u64 hash = 0xcbf29ce484222325ULL;
+
+  for (u32 i = 1; i < fe_par_cnt; i++) {
+    hash = hash_bytes(hash, fe_params[i], strlen((char *)fe_params[i]) + 1);
+  }
+
+  /* Key on the preprocessed translation unit rather than the raw source
+     bytes, so edits to included headers change the key too - a stale hit
+     would silently miscompile the target */
+
+  fe_params[fe_par_cnt] = (u8 *)"-E";
+  fe_params[fe_par_cnt + 1] = NULL;
+  if (!hash_preprocessed(fe_params, &hash)) {
+    ck_free(fe_params);
+    return 0;
+  }
+
+  u8 *bc_path =
+      alloc_printf("%s/%016llx.bc", cache_dir, (unsigned long long)hash);
+
+  if (access(bc_path, R_OK)) {
+    /* Miss: run the frontend once, without the fuzzalloc plugins, and store
+       the post-frontend bitcode under its content hash. Filling through a
+       temporary file plus rename keeps parallel build jobs from observing a
+       half-written entry */
+
+    u8 *tmp_path = alloc_printf("%s.%u.tmp", bc_path, (u32)getpid());
+
+    fe_params[fe_par_cnt] = (u8 *)"-emit-llvm";
+    fe_params[fe_par_cnt + 1] = (u8 *)"-o";
+    fe_params[fe_par_cnt + 2] = tmp_path;
+    fe_params[fe_par_cnt + 3] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      PFATAL("fork() failed");
+    }
+    if (!pid) {
+      execvp((char *)fe_params[0], (char **)fe_params);
+      exit(EXIT_FAILURE);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) <= 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || rename((char *)tmp_path, (char *)bc_path)) {
+      unlink((char *)tmp_path);
+      ck_free(fe_params);
+      ck_free(tmp_path);
+      ck_free(bc_path);
+      return 0;
+    }
+
+    ck_free(tmp_path);
+  }
+
+  ck_free(fe_params);
+
+  /* Hit: compile the cached bitcode instead of the source, so only the
+     fuzzalloc passes and code generation run */
+
+  for (u32 i = 1; i < *cc_par_cnt; i++) {
+    if (!strcmp((char *)cc_params[i], src)) {
+      memmove(cc_params + i + 2, cc_params + i,
+              (*cc_par_cnt - i + 1) * sizeof(u8 *));
+      cc_params[i] = "-x";
+      cc_params[i + 1] = "ir";
+      cc_params[i + 2] = bc_path;
+      *cc_par_cnt += 2;
+
+      return 1;
+    }
+  }
+
+  ck_free(bc_path);
+
+  return 0;
+}
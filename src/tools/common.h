@@ -11,8 +11,19 @@
 // AFL include files
 #include "types.h"
 
+/* Environment variable giving the directory of the content-addressed bitcode
+   cache shared by dataflow-preprocess and dataflow-cc. The first phase to
+   compile a source file stores the post-frontend bitcode under a hash of the
+   preprocessed source and frontend flags; later phases (and later configuration
+   sweeps) feed the cached bitcode straight into the fuzzalloc passes instead
+   of redoing all frontend work */
+#define BITCODE_CACHE_ENV_VAR "FUZZALLOC_BITCODE_CACHE"
+
 u8 prefix(const char *str, const char *pre);
 
 u8 check_if_assembler(u32 argc, const char **argv);
 
+u8 try_bitcode_cache(u32 argc, const char **argv, u8 **cc_params,
+                     u32 *cc_par_cnt);
+
 #endif // FUZZALLOC_TOOLS_COMMON_H
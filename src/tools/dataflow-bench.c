@@ -0,0 +1,387 @@
+/*
+ * Native corpus-replay benchmark for datAFLow targets. Replays every file in
+ * a corpus directory against an instrumented binary through the AFL fork
+ * server (so there is no per-input exec cost polluting the numbers) and
+ * reports execs/sec, per-input latency percentiles, tagged allocation counts
+ * and dataflow map population. A typical usage would be:
+ *
+ *   dataflow-bench ./corpus ./target --some-flag @@
+ *
+ * If the target's arguments contain "@@" it is replaced with the path of the
+ * current input; otherwise the input is fed on stdin, as in afl-fuzz.
+ */
+
+// AFL include files
+#include "alloc-inl.h"
+#include "config.h"
+#include "debug.h"
+#include "types.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/select.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "dataflow_map.h"
+
+/* Per-exec timeout (milliseconds), settable with -t */
+static u32 exec_tmout = 5000;
+
+static s32 fsrv_ctl_fd = -1; /* Fork server control pipe (write)  */
+static s32 fsrv_st_fd = -1;  /* Fork server status pipe (read)    */
+static s32 fsrv_pid = -1;    /* Fork server PID                   */
+static s32 child_pid = -1;   /* Currently-running child PID       */
+
+static s32 out_fd = -1;   /* Current input file descriptor     */
+static u8 *out_file;      /* Current input file path           */
+static u8 use_stdin = 1;  /* Feed input on stdin (no @@)?      */
+
+static u8 *trace_bits;        /* AFL edge map                  */
+static u8 *dataflow_map;      /* Dataflow map                  */
+static alloc_stats_t *stats;  /* Per-tag allocation statistics */
+
+static s32 trace_shm_id = -1;
+static s32 dataflow_shm_id = -1;
+static s32 stats_shm_id = -1;
+
+/* Set up the shared memory segments the target's runtimes attach to: AFL's
+   edge map, the dataflow map and the per-tag allocation statistics */
+static void setup_shm(void) {
+  trace_shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  if (trace_shm_id < 0) {
+    PFATAL("shmget() failed");
+  }
+  trace_bits = shmat(trace_shm_id, NULL, 0);
+  if (trace_bits == (void *)(-1)) {
+    PFATAL("shmat() failed");
+  }
+  setenv(SHM_ENV_VAR, alloc_printf("%d", trace_shm_id), 1);
+
+  dataflow_shm_id =
+      shmget(IPC_PRIVATE, DATAFLOW_MAP_DEFAULT_SIZE, IPC_CREAT | 0600);
+  if (dataflow_shm_id < 0) {
+    PFATAL("shmget() failed");
+  }
+  dataflow_map = shmat(dataflow_shm_id, NULL, 0);
+  if (dataflow_map == (void *)(-1)) {
+    PFATAL("shmat() failed");
+  }
+  setenv(DATAFLOW_SHM_ENV_VAR, alloc_printf("%d", dataflow_shm_id), 1);
+
+  /* The allocation statistics handshake is keyed, not ID-based, because the
+     target creates the segment itself (see alloc_stats.c) */
+  key_t stats_key = (key_t)(0x46410000 | (getpid() & 0xFFFF));
+  stats_shm_id = shmget(stats_key, ALLOC_STATS_SIZE, IPC_CREAT | 0600);
+  if (stats_shm_id < 0) {
+    PFATAL("shmget() failed");
+  }
+  stats = shmat(stats_shm_id, NULL, 0);
+  if (stats == (void *)(-1)) {
+    PFATAL("shmat() failed");
+  }
+  setenv(ALLOC_STATS_KEY_ENV_VAR, alloc_printf("%#x", stats_key), 1);
+}
+
+static void remove_shm(void) {
+  if (trace_shm_id >= 0) {
+    shmctl(trace_shm_id, IPC_RMID, NULL);
+  }
+  if (dataflow_shm_id >= 0) {
+    shmctl(dataflow_shm_id, IPC_RMID, NULL);
+  }
+  if (stats_shm_id >= 0) {
+    shmctl(stats_shm_id, IPC_RMID, NULL);
+  }
+  if (out_file) {
+    unlink(out_file);
+  }
+}
+
+/* Spin up the fork server, as in afl-fuzz's init_forkserver */
+static void init_forkserver(char **argv) {
+  s32 st_pipe[2], ctl_pipe[2];
+  s32 status;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) {
+    PFATAL("pipe() failed");
+  }
+
+  fsrv_pid = fork();
+  if (fsrv_pid < 0) {
+    PFATAL("fork() failed");
+  }
+
+  if (!fsrv_pid) {
+    s32 dev_null_fd = open("/dev/null", O_RDWR);
+    if (dev_null_fd < 0) {
+      PFATAL("Unable to open /dev/null");
+    }
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (use_stdin) {
+      dup2(out_fd, 0);
+    } else {
+      dup2(dev_null_fd, 0);
+    }
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0 ||
+        dup2(st_pipe[1], FORKSRV_FD + 1) < 0) {
+      PFATAL("dup2() failed");
+    }
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    execv(argv[0], argv);
+    exit(EXIT_FAILURE);
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd = st_pipe[0];
+
+  /* Wait for the fork server to come up */
+  if (read(fsrv_st_fd, &status, 4) != 4) {
+    FATAL("Fork server handshake failed - is '%s' an instrumented binary?",
+          argv[0]);
+  }
+}
+
+/* Write one input to the shared .cur_input file */
+static void write_to_testcase(const u8 *path) {
+  s32 fd = open((char *)path, O_RDONLY);
+  if (fd < 0) {
+    PFATAL("Unable to open '%s'", path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    PFATAL("fstat() failed");
+  }
+
+  u8 *buf = ck_alloc(st.st_size ? st.st_size : 1);
+  if (st.st_size && read(fd, buf, st.st_size) != st.st_size) {
+    PFATAL("Short read from '%s'", path);
+  }
+  close(fd);
+
+  lseek(out_fd, 0, SEEK_SET);
+  if (st.st_size && write(out_fd, buf, st.st_size) != st.st_size) {
+    PFATAL("Short write to '%s'", out_file);
+  }
+  if (ftruncate(out_fd, st.st_size)) {
+    PFATAL("ftruncate() failed");
+  }
+  lseek(out_fd, 0, SEEK_SET);
+
+  ck_free(buf);
+}
+
+/* Run one input through the fork server. Returns the wait() status, or -1 on
+   a timeout (the child is killed) */
+static s32 run_target(void) {
+  s32 status = 0;
+
+  if (write(fsrv_ctl_fd, &status, 4) != 4) {
+    FATAL("Unable to request new process from fork server");
+  }
+  if (read(fsrv_st_fd, &child_pid, 4) != 4) {
+    FATAL("Unable to read child PID from fork server");
+  }
+
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(fsrv_st_fd, &readfds);
+  struct timeval timeout = {exec_tmout / 1000, (exec_tmout % 1000) * 1000};
+
+  if (select(fsrv_st_fd + 1, &readfds, NULL, NULL, &timeout) <= 0) {
+    kill(child_pid, SIGKILL);
+    if (read(fsrv_st_fd, &status, 4) != 4) {
+      FATAL("Unable to read child status from fork server");
+    }
+    return -1;
+  }
+
+  if (read(fsrv_st_fd, &status, 4) != 4) {
+    FATAL("Unable to read child status from fork server");
+  }
+  child_pid = -1;
+
+  return status;
+}
+
+static int cmp_str(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  u64 ua = *(const u64 *)a, ub = *(const u64 *)b;
+  return (ua > ub) - (ua < ub);
+}
+
+static u64 get_time_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv) {
+  s32 opt;
+
+  SAYF(cCYA "dataflow-bench " cBRI VERSION cRST
+            " by <adrian.herrera@anu.edu.au>\n");
+
+  while ((opt = getopt(argc, argv, "+t:")) > 0) {
+    switch (opt) {
+    case 't':
+      exec_tmout = atoi(optarg);
+      if (!exec_tmout) {
+        FATAL("Bad value for -t");
+      }
+      break;
+    default:
+      FATAL("Usage: %s [-t msec] /path/to/corpus /path/to/target [args...]",
+            argv[0]);
+    }
+  }
+
+  if (argc - optind < 2) {
+    SAYF("\n"
+         "Replays a corpus directory against an instrumented target via the "
+         "AFL fork server and reports execs/sec, per-input latency "
+         "percentiles, tagged allocation counts and dataflow map "
+         "population. A typical usage would be:\n\n"
+
+         "  dataflow-bench [-t msec] /path/to/corpus /path/to/target "
+         "[args...]\n\n"
+
+         "Use @@ in the target's arguments to pass the input as a file; "
+         "otherwise it is fed on stdin.\n\n");
+
+    exit(1);
+  }
+
+  u8 *corpus_dir = argv[optind];
+  char **target_argv = argv + optind + 1;
+
+  /* Collect (and sort, for stable runs) the corpus */
+
+  DIR *dir = opendir((char *)corpus_dir);
+  if (!dir) {
+    PFATAL("Unable to open '%s'", corpus_dir);
+  }
+
+  u32 num_inputs = 0, max_inputs = 1024;
+  char **inputs = ck_alloc(max_inputs * sizeof(char *));
+
+  struct dirent *ent;
+  while ((ent = readdir(dir))) {
+    u8 *path = alloc_printf("%s/%s", corpus_dir, ent->d_name);
+    struct stat st;
+    if (stat((char *)path, &st) || !S_ISREG(st.st_mode)) {
+      ck_free(path);
+      continue;
+    }
+    if (num_inputs == max_inputs) {
+      max_inputs *= 2;
+      inputs = ck_realloc(inputs, max_inputs * sizeof(char *));
+    }
+    inputs[num_inputs++] = (char *)path;
+  }
+  closedir(dir);
+
+  if (!num_inputs) {
+    FATAL("No inputs in '%s'", corpus_dir);
+  }
+  qsort(inputs, num_inputs, sizeof(char *), cmp_str);
+
+  /* Substitute @@ with the shared input file */
+
+  out_file = alloc_printf("/tmp/.dataflow-bench-%d", getpid());
+  out_fd = open((char *)out_file, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (out_fd < 0) {
+    PFATAL("Unable to create '%s'", out_file);
+  }
+
+  for (char **arg = target_argv; *arg; arg++) {
+    if (strstr(*arg, "@@")) {
+      *arg = (char *)out_file;
+      use_stdin = 0;
+    }
+  }
+
+  setup_shm();
+  atexit(remove_shm);
+  init_forkserver(target_argv);
+
+  OKF("Fork server is up, replaying %u inputs...", num_inputs);
+
+  u64 *latencies = ck_alloc(num_inputs * sizeof(u64));
+  u32 num_crashes = 0, num_timeouts = 0;
+
+  u64 start_us = get_time_us();
+
+  for (u32 i = 0; i < num_inputs; i++) {
+    write_to_testcase((u8 *)inputs[i]);
+
+    u64 exec_start_us = get_time_us();
+    s32 status = run_target();
+    latencies[i] = get_time_us() - exec_start_us;
+
+    if (status < 0) {
+      num_timeouts++;
+    } else if (WIFSIGNALED(status)) {
+      num_crashes++;
+    }
+  }
+
+  u64 total_us = get_time_us() - start_us;
+
+  /* Tally the runtime counters the target's runtimes left in shared memory */
+
+  u64 total_allocs = 0;
+  for (u32 tag = 0; tag <= FUZZALLOC_TAG_MAX; tag++) {
+    total_allocs += stats[tag].allocs;
+  }
+
+  u32 map_bytes_set = 0;
+  for (u32 i = 0; i < DATAFLOW_MAP_DEFAULT_SIZE; i++) {
+    if (dataflow_map[i]) {
+      map_bytes_set++;
+    }
+  }
+
+  qsort(latencies, num_inputs, sizeof(u64), cmp_u64);
+
+  SAYF("\n");
+  OKF("execs         : %u (%u crashes, %u timeouts)", num_inputs, num_crashes,
+      num_timeouts);
+  OKF("total time    : %.2f s", total_us / 1000000.0);
+  OKF("execs/sec     : %.1f", num_inputs / (total_us / 1000000.0));
+  OKF("latency (us)  : p50 %llu, p90 %llu, p99 %llu, max %llu",
+      latencies[num_inputs / 2], latencies[(u64)num_inputs * 90 / 100],
+      latencies[(u64)num_inputs * 99 / 100], latencies[num_inputs - 1]);
+  OKF("tagged allocs : %llu (%.1f per exec)", total_allocs,
+      (double)total_allocs / num_inputs);
+  OKF("dataflow map  : %u / %u bytes set (%.2f%%)", map_bytes_set,
+      (u32)DATAFLOW_MAP_DEFAULT_SIZE,
+      100.0 * map_bytes_set / DATAFLOW_MAP_DEFAULT_SIZE);
+
+  return 0;
+}
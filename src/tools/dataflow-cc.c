@@ -114,41 +114,72 @@ static void edit_params(u32 argc, char **argv) {
   cc_params[cc_par_cnt++] = "-Xclang";
   cc_params[cc_par_cnt++] = "-mdisable-const-array-pack";
 
-  cc_params[cc_par_cnt++] =
-      "-fplugin=" FUZZALLOC_LLVM_DIR "/Utils/libfuzzalloc-utils.so";
+  /* All of the passes below are also available fused into a single plugin,
+   * which cuts the per-TU plugin load cost on large builds */
+
+  u8 fused_pipeline = !!getenv("FUZZALLOC_PIPELINE");
+
+  if (fused_pipeline) {
+    cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
+                              "/Pipeline/libfuzzalloc-pipeline.so";
+  }
 
-  /* Rewrite calls to new with calls to malloc */
+  if (!fused_pipeline) {
+    cc_params[cc_par_cnt++] =
+        "-fplugin=" FUZZALLOC_LLVM_DIR "/Utils/libfuzzalloc-utils.so";
+
+    /* Rewrite calls to new with calls to malloc */
 
-  cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
-                            "/Transforms/RewriteNews/"
-                            "libfuzzalloc-rewrite-news.so";
+    cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
+                              "/Transforms/RewriteNews/"
+                              "libfuzzalloc-rewrite-news.so";
 
-  /* Expand global variables with static ConstantAggregate initializers */
+    /* Expand global variables with static ConstantAggregate initializers */
 
-  cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
-                            "/Transforms/HeapifyObjects/"
-                            "libfuzzalloc-expand-gv-initializers.so";
+    cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
+                              "/Transforms/HeapifyObjects/"
+                              "libfuzzalloc-expand-gv-initializers.so";
 
-  /* Heapify static arrays to dynamically allocated arrays */
+    /* Heapify static arrays to dynamically allocated arrays */
 
-  cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
-                            "/Transforms/HeapifyObjects/"
-                            "libfuzzalloc-heapify-allocas.so";
-  cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
-                            "/Transforms/HeapifyObjects/"
-                            "libfuzzalloc-heapify-global-vars.so";
+    cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
+                              "/Transforms/HeapifyObjects/"
+                              "libfuzzalloc-heapify-allocas.so";
+    cc_params[cc_par_cnt++] = "-fplugin=" FUZZALLOC_LLVM_DIR
+                              "/Transforms/HeapifyObjects/"
+                              "libfuzzalloc-heapify-global-vars.so";
+  }
 
   if (getenv("FUZZALLOC_HEAPIFY_STRUCTS")) {
     cc_params[cc_par_cnt++] = "-mllvm";
     cc_params[cc_par_cnt++] = "-fuzzalloc-heapify-structs";
   }
 
+  if (getenv("FUZZALLOC_STACK_ALLOC")) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] = "-fuzzalloc-stack-alloc";
+  }
+
+  if (getenv("FUZZALLOC_CACHE_ALLOCAS")) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] = "-fuzzalloc-cache-allocas";
+  }
+
+  char *fuzzalloc_heapify_filter = getenv("FUZZALLOC_HEAPIFY_FILTER");
+  if (fuzzalloc_heapify_filter) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-heapify-filter=%s", fuzzalloc_heapify_filter);
+  }
+
   /* Tag dynamically allocated arrays and redirect them to the fuzzalloc
    * allocator library */
 
-  cc_params[cc_par_cnt++] =
-      "-fplugin=" FUZZALLOC_LLVM_DIR
-      "/Transforms/TagDynamicAllocs/libfuzzalloc-tag-dyn-allocs.so";
+  if (!fused_pipeline) {
+    cc_params[cc_par_cnt++] =
+        "-fplugin=" FUZZALLOC_LLVM_DIR
+        "/Transforms/TagDynamicAllocs/libfuzzalloc-tag-dyn-allocs.so";
+  }
 
   char *fuzzalloc_tag_log = getenv("FUZZALLOC_TAG_LOG");
   if (fuzzalloc_tag_log && !maybe_assembler) {
@@ -157,20 +188,48 @@ static void edit_params(u32 argc, char **argv) {
         alloc_printf("-fuzzalloc-tag-log=%s", fuzzalloc_tag_log);
   }
 
-  /* Instrument memory accesses */
+  char *fuzzalloc_tag_profile = getenv("FUZZALLOC_TAG_PROFILE");
+  if (fuzzalloc_tag_profile && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-tag-profile=%s", fuzzalloc_tag_profile);
+  }
 
-  cc_params[cc_par_cnt++] =
-      "-fplugin=" FUZZALLOC_LLVM_DIR
-      "/Transforms/LowerAtomics/libfuzzalloc-lower-atomics.so";
+  if (getenv("FUZZALLOC_DETERMINISTIC_TAGS") && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] = "-fuzzalloc-deterministic-tags";
+  }
 
-  cc_params[cc_par_cnt++] =
-      "-fplugin=" FUZZALLOC_LLVM_DIR
-      "/Transforms/LowerMemIntrinsics/libfuzzalloc-lower-mem-intrinsics.so";
+  char *fuzzalloc_tag_db = getenv("FUZZALLOC_TAG_DB");
+  if (fuzzalloc_tag_db && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-tag-db=%s", fuzzalloc_tag_db);
+  }
 
-  if (!maybe_assembler) {
+  /* Instrument memory accesses */
+
+  if (!fused_pipeline) {
     cc_params[cc_par_cnt++] =
         "-fplugin=" FUZZALLOC_LLVM_DIR
-        "/Transforms/InstrumentMemAccesses/libfuzzalloc-inst-mem-accesses.so";
+        "/Transforms/LowerAtomics/libfuzzalloc-lower-atomics.so";
+
+    cc_params[cc_par_cnt++] =
+        "-fplugin=" FUZZALLOC_LLVM_DIR
+        "/Transforms/LowerMemIntrinsics/libfuzzalloc-lower-mem-intrinsics.so";
+  }
+
+  if (getenv("FUZZALLOC_SINGLE_THREADED") && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] = "-fuzzalloc-single-threaded";
+  }
+
+  if (!maybe_assembler) {
+    if (!fused_pipeline) {
+      cc_params[cc_par_cnt++] =
+          "-fplugin=" FUZZALLOC_LLVM_DIR
+          "/Transforms/InstrumentMemAccesses/libfuzzalloc-inst-mem-accesses.so";
+    }
 
     char *fuzzalloc_fuzzer = getenv("FUZZALLOC_FUZZER");
     if (fuzzalloc_fuzzer) {
@@ -178,11 +237,35 @@ static void edit_params(u32 argc, char **argv) {
       cc_params[cc_par_cnt++] = alloc_printf("-%s", fuzzalloc_fuzzer);
     }
 
+    if (getenv("FUZZALLOC_INLINE_DATAFLOW")) {
+      cc_params[cc_par_cnt++] = "-mllvm";
+      cc_params[cc_par_cnt++] = "-fuzzalloc-inline-dataflow";
+    }
+
+    if (getenv("FUZZALLOC_CRC32_HASH")) {
+      cc_params[cc_par_cnt++] = "-mllvm";
+      cc_params[cc_par_cnt++] = "-fuzzalloc-crc32-hash";
+    }
+
     char *fuzzalloc_sensitivity = getenv("FUZZALLOC_SENSITIVITY");
     if (fuzzalloc_sensitivity) {
       cc_params[cc_par_cnt++] = "-mllvm";
       cc_params[cc_par_cnt++] = alloc_printf("-%s", fuzzalloc_sensitivity);
     }
+
+    char *fuzzalloc_deref_filter = getenv("FUZZALLOC_DEREF_FILTER");
+    if (fuzzalloc_deref_filter) {
+      cc_params[cc_par_cnt++] = "-mllvm";
+      cc_params[cc_par_cnt++] =
+          alloc_printf("-fuzzalloc-deref-filter=%s", fuzzalloc_deref_filter);
+    }
+
+    char *fuzzalloc_cost_budget = getenv("FUZZALLOC_COST_BUDGET");
+    if (fuzzalloc_cost_budget) {
+      cc_params[cc_par_cnt++] = "-mllvm";
+      cc_params[cc_par_cnt++] =
+          alloc_printf("-fuzzalloc-cost-budget=%s", fuzzalloc_cost_budget);
+    }
   }
 
   cc_params[cc_par_cnt++] = "-Qunused-arguments";
@@ -430,6 +513,8 @@ int main(int argc, char **argv) {
 
   edit_params(argc, argv);
 
+  try_bitcode_cache(argc, (const char **)argv, cc_params, &cc_par_cnt);
+
   execvp(cc_params[0], (char **)cc_params);
 
   FATAL("Oops, failed to execute '%s' - check your PATH", cc_params[0]);
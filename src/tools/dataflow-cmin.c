@@ -0,0 +1,476 @@
+/*
+ * Dataflow-aware corpus minimization for datAFLow targets. afl-cmin only
+ * understands edge coverage, so it happily discards inputs whose only value
+ * is exercising unique def-use pairs. This tool replays a corpus through an
+ * instrumented binary via the AFL fork server, harvests both the edge map
+ * and the dataflow map after every execution, and computes a minimal
+ * covering subset with a greedy set cover over mmap'd per-input feature
+ * bitsets - so re-minimizing a large corpus nightly is cheap. A typical
+ * usage would be:
+ *
+ *   dataflow-cmin -i ./corpus -o ./corpus.min ./target --some-flag @@
+ *
+ * If the target's arguments contain "@@" it is replaced with the path of the
+ * current input; otherwise the input is fed on stdin, as in afl-fuzz.
+ */
+
+// AFL include files
+#include "alloc-inl.h"
+#include "config.h"
+#include "debug.h"
+#include "types.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dataflow_classify.h"
+#include "dataflow_map.h"
+
+/* Per-exec timeout (milliseconds), settable with -t */
+static u32 exec_tmout = 5000;
+
+static s32 fsrv_ctl_fd = -1; /* Fork server control pipe (write)  */
+static s32 fsrv_st_fd = -1;  /* Fork server status pipe (read)    */
+static s32 fsrv_pid = -1;    /* Fork server PID                   */
+static s32 child_pid = -1;   /* Currently-running child PID       */
+
+static s32 out_fd = -1;  /* Current input file descriptor     */
+static u8 *out_file;     /* Current input file path           */
+static u8 use_stdin = 1; /* Feed input on stdin (no @@)?      */
+
+static u8 *trace_bits;   /* AFL edge map                      */
+static u8 *dataflow_map; /* Dataflow map                      */
+
+static u32 df_map_size = DATAFLOW_MAP_DEFAULT_SIZE;
+
+static s32 trace_shm_id = -1;
+static s32 dataflow_shm_id = -1;
+
+/* Set up the shared memory segments the target's runtimes attach to: AFL's
+   edge map and the dataflow map */
+static void setup_shm(void) {
+  trace_shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  if (trace_shm_id < 0) {
+    PFATAL("shmget() failed");
+  }
+  trace_bits = shmat(trace_shm_id, NULL, 0);
+  if (trace_bits == (void *)(-1)) {
+    PFATAL("shmat() failed");
+  }
+  setenv(SHM_ENV_VAR, alloc_printf("%d", trace_shm_id), 1);
+
+  dataflow_shm_id = shmget(IPC_PRIVATE, df_map_size, IPC_CREAT | 0600);
+  if (dataflow_shm_id < 0) {
+    PFATAL("shmget() failed");
+  }
+  dataflow_map = shmat(dataflow_shm_id, NULL, 0);
+  if (dataflow_map == (void *)(-1)) {
+    PFATAL("shmat() failed");
+  }
+  setenv(DATAFLOW_SHM_ENV_VAR, alloc_printf("%d", dataflow_shm_id), 1);
+}
+
+static void remove_shm(void) {
+  if (trace_shm_id >= 0) {
+    shmctl(trace_shm_id, IPC_RMID, NULL);
+  }
+  if (dataflow_shm_id >= 0) {
+    shmctl(dataflow_shm_id, IPC_RMID, NULL);
+  }
+  if (out_file) {
+    unlink(out_file);
+  }
+}
+
+/* Spin up the fork server, as in afl-fuzz's init_forkserver */
+static void init_forkserver(char **argv) {
+  s32 st_pipe[2], ctl_pipe[2];
+  s32 status;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) {
+    PFATAL("pipe() failed");
+  }
+
+  fsrv_pid = fork();
+  if (fsrv_pid < 0) {
+    PFATAL("fork() failed");
+  }
+
+  if (!fsrv_pid) {
+    s32 dev_null_fd = open("/dev/null", O_RDWR);
+    if (dev_null_fd < 0) {
+      PFATAL("Unable to open /dev/null");
+    }
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (use_stdin) {
+      dup2(out_fd, 0);
+    } else {
+      dup2(dev_null_fd, 0);
+    }
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0 ||
+        dup2(st_pipe[1], FORKSRV_FD + 1) < 0) {
+      PFATAL("dup2() failed");
+    }
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    execv(argv[0], argv);
+    exit(EXIT_FAILURE);
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd = st_pipe[0];
+
+  /* Wait for the fork server to come up */
+  if (read(fsrv_st_fd, &status, 4) != 4) {
+    FATAL("Fork server handshake failed - is '%s' an instrumented binary?",
+          argv[0]);
+  }
+}
+
+/* Write one input to the shared .cur_input file */
+static void write_to_testcase(const u8 *path) {
+  s32 fd = open((char *)path, O_RDONLY);
+  if (fd < 0) {
+    PFATAL("Unable to open '%s'", path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    PFATAL("fstat() failed");
+  }
+
+  u8 *buf = ck_alloc(st.st_size ? st.st_size : 1);
+  if (st.st_size && read(fd, buf, st.st_size) != st.st_size) {
+    PFATAL("Short read from '%s'", path);
+  }
+  close(fd);
+
+  lseek(out_fd, 0, SEEK_SET);
+  if (st.st_size && write(out_fd, buf, st.st_size) != st.st_size) {
+    PFATAL("Short write to '%s'", out_file);
+  }
+  if (ftruncate(out_fd, st.st_size)) {
+    PFATAL("ftruncate() failed");
+  }
+  lseek(out_fd, 0, SEEK_SET);
+
+  ck_free(buf);
+}
+
+/* Run one input through the fork server. Returns the wait() status, or -1 on
+   a timeout (the child is killed) */
+static s32 run_target(void) {
+  s32 status = 0;
+
+  if (write(fsrv_ctl_fd, &status, 4) != 4) {
+    FATAL("Unable to request new process from fork server");
+  }
+  if (read(fsrv_st_fd, &child_pid, 4) != 4) {
+    FATAL("Unable to read child PID from fork server");
+  }
+
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(fsrv_st_fd, &readfds);
+  struct timeval timeout = {exec_tmout / 1000, (exec_tmout % 1000) * 1000};
+
+  if (select(fsrv_st_fd + 1, &readfds, NULL, NULL, &timeout) <= 0) {
+    kill(child_pid, SIGKILL);
+    if (read(fsrv_st_fd, &status, 4) != 4) {
+      FATAL("Unable to read child status from fork server");
+    }
+    return -1;
+  }
+
+  if (read(fsrv_st_fd, &status, 4) != 4) {
+    FATAL("Unable to read child status from fork server");
+  }
+  child_pid = -1;
+
+  return status;
+}
+
+static int cmp_str(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Copy an input into the output directory, keeping its basename */
+static void copy_input(const char *src, const u8 *out_dir) {
+  const char *base = strrchr(src, '/');
+  base = base ? base + 1 : src;
+
+  u8 *dst = alloc_printf("%s/%s", out_dir, base);
+
+  s32 src_fd = open(src, O_RDONLY);
+  if (src_fd < 0) {
+    PFATAL("Unable to open '%s'", src);
+  }
+  s32 dst_fd = open((char *)dst, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (dst_fd < 0) {
+    PFATAL("Unable to create '%s'", dst);
+  }
+
+  u8 buf[65536];
+  ssize_t len;
+  while ((len = read(src_fd, buf, sizeof(buf))) > 0) {
+    if (write(dst_fd, buf, len) != len) {
+      PFATAL("Short write to '%s'", dst);
+    }
+  }
+  if (len < 0) {
+    PFATAL("Short read from '%s'", src);
+  }
+
+  close(src_fd);
+  close(dst_fd);
+  ck_free(dst);
+}
+
+int main(int argc, char **argv) {
+  s32 opt;
+  u8 *in_dir = NULL, *out_dir = NULL;
+
+  SAYF(cCYA "dataflow-cmin " cBRI VERSION cRST
+            " by <adrian.herrera@anu.edu.au>\n");
+
+  while ((opt = getopt(argc, argv, "+i:o:t:")) > 0) {
+    switch (opt) {
+    case 'i':
+      in_dir = (u8 *)optarg;
+      break;
+    case 'o':
+      out_dir = (u8 *)optarg;
+      break;
+    case 't':
+      exec_tmout = atoi(optarg);
+      if (!exec_tmout) {
+        FATAL("Bad value for -t");
+      }
+      break;
+    default:
+      FATAL("Usage: %s [-t msec] -i /path/to/corpus -o /path/to/out "
+            "/path/to/target [args...]",
+            argv[0]);
+    }
+  }
+
+  if (!in_dir || !out_dir || argc - optind < 1) {
+    SAYF("\n"
+         "Minimizes a corpus directory against an instrumented target, "
+         "keeping every input that contributes a unique edge or def-use "
+         "feature. Unlike afl-cmin, the dataflow map is part of the "
+         "coverage criterion, so inputs that only differ in the def-use "
+         "pairs they exercise survive minimization. A typical usage would "
+         "be:\n\n"
+
+         "  dataflow-cmin [-t msec] -i /path/to/corpus -o /path/to/out "
+         "/path/to/target [args...]\n\n"
+
+         "Use @@ in the target's arguments to pass the input as a file; "
+         "otherwise it is fed on stdin.\n\n");
+
+    exit(1);
+  }
+
+  char **target_argv = argv + optind;
+
+  if (getenv(DATAFLOW_MAP_SIZE_ENV_VAR)) {
+    df_map_size = strtoul(getenv(DATAFLOW_MAP_SIZE_ENV_VAR), NULL, 0);
+    if (!df_map_size || (df_map_size & (df_map_size - 1))) {
+      FATAL("Bad value for %s", DATAFLOW_MAP_SIZE_ENV_VAR);
+    }
+  }
+
+  if (mkdir((char *)out_dir, 0700) && errno != EEXIST) {
+    PFATAL("Unable to create '%s'", out_dir);
+  }
+
+  /* Collect (and sort, for stable runs) the corpus */
+
+  DIR *dir = opendir((char *)in_dir);
+  if (!dir) {
+    PFATAL("Unable to open '%s'", in_dir);
+  }
+
+  u32 num_inputs = 0, max_inputs = 1024;
+  char **inputs = ck_alloc(max_inputs * sizeof(char *));
+
+  struct dirent *ent;
+  while ((ent = readdir(dir))) {
+    u8 *path = alloc_printf("%s/%s", in_dir, ent->d_name);
+    struct stat st;
+    if (stat((char *)path, &st) || !S_ISREG(st.st_mode)) {
+      ck_free(path);
+      continue;
+    }
+    if (num_inputs == max_inputs) {
+      max_inputs *= 2;
+      inputs = ck_realloc(inputs, max_inputs * sizeof(char *));
+    }
+    inputs[num_inputs++] = (char *)path;
+  }
+  closedir(dir);
+
+  if (!num_inputs) {
+    FATAL("No inputs in '%s'", in_dir);
+  }
+  qsort(inputs, num_inputs, sizeof(char *), cmp_str);
+
+  /* Substitute @@ with the shared input file */
+
+  out_file = alloc_printf("/tmp/.dataflow-cmin-%d", getpid());
+  out_fd = open((char *)out_file, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (out_fd < 0) {
+    PFATAL("Unable to create '%s'", out_file);
+  }
+
+  for (char **arg = target_argv; *arg; arg++) {
+    if (strstr(*arg, "@@")) {
+      *arg = (char *)out_file;
+      use_stdin = 0;
+    }
+  }
+
+  setup_shm();
+  atexit(remove_shm);
+  init_forkserver(target_argv);
+
+  /* Per-input feature bitsets: the bucket-classified edge map followed by
+     the bucket-classified dataflow map, stored byte for byte in a single
+     anonymous mapping. A classified byte is a one-hot bucket mask, so the
+     concatenated maps already are a bitset over (map byte, hit bucket)
+     features and the set cover below works on them directly with word-wise
+     OR/ANDN/popcount. MAP_NORESERVE keeps the arena cheap for big corpora:
+     only the words an input actually touches are ever committed */
+
+  u64 words_per_input = (MAP_SIZE + df_map_size) / 8;
+  u64 *features =
+      mmap(NULL, (u64)num_inputs * words_per_input * sizeof(u64),
+           PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (features == MAP_FAILED) {
+    PFATAL("mmap() failed");
+  }
+
+  OKF("Fork server is up, replaying %u inputs...", num_inputs);
+
+  u32 num_crashes = 0, num_timeouts = 0;
+
+  for (u32 i = 0; i < num_inputs; i++) {
+    write_to_testcase((u8 *)inputs[i]);
+
+    memset(trace_bits, 0, MAP_SIZE);
+    memset(dataflow_map, 0, df_map_size);
+
+    s32 status = run_target();
+
+    if (status < 0) {
+      num_timeouts++;
+      continue;
+    }
+    if (WIFSIGNALED(status)) {
+      num_crashes++;
+      continue;
+    }
+
+    dataflow_classify_counts(trace_bits, MAP_SIZE);
+    dataflow_classify_counts(dataflow_map, df_map_size);
+
+    u8 *vec = (u8 *)(features + (u64)i * words_per_input);
+    memcpy(vec, trace_bits, MAP_SIZE);
+    memcpy(vec + MAP_SIZE, dataflow_map, df_map_size);
+  }
+
+  /* Greedy set cover: repeatedly keep the input contributing the most
+     not-yet-covered features (smallest file on a tie), until nothing is
+     left to cover. Timed-out and crashing inputs contribute no features and
+     are never selected */
+
+  u64 *covered = ck_alloc(words_per_input * sizeof(u64));
+  u8 *selected = ck_alloc(num_inputs);
+  u32 num_selected = 0;
+  u64 total_features = 0;
+
+  for (;;) {
+    u64 best_gain = 0;
+    u32 best_input = 0;
+    off_t best_size = 0;
+
+    for (u32 i = 0; i < num_inputs; i++) {
+      if (selected[i]) {
+        continue;
+      }
+
+      u64 *vec = features + (u64)i * words_per_input;
+      u64 gain = 0;
+      for (u64 w = 0; w < words_per_input; w++) {
+        gain += __builtin_popcountll(vec[w] & ~covered[w]);
+      }
+      if (!gain) {
+        continue;
+      }
+
+      struct stat st;
+      if (stat(inputs[i], &st)) {
+        st.st_size = 0;
+      }
+      if (gain > best_gain ||
+          (gain == best_gain && st.st_size < best_size)) {
+        best_gain = gain;
+        best_input = i;
+        best_size = st.st_size;
+      }
+    }
+
+    if (!best_gain) {
+      break;
+    }
+
+    u64 *vec = features + (u64)best_input * words_per_input;
+    for (u64 w = 0; w < words_per_input; w++) {
+      covered[w] |= vec[w];
+    }
+    selected[best_input] = 1;
+    num_selected++;
+    total_features += best_gain;
+
+    copy_input(inputs[best_input], out_dir);
+  }
+
+  SAYF("\n");
+  OKF("inputs    : %u (%u crashes, %u timeouts)", num_inputs, num_crashes,
+      num_timeouts);
+  OKF("features  : %llu (bucketed edges + def-use pairs)", total_features);
+  OKF("kept      : %u (%.1f%%)", num_selected,
+      100.0 * num_selected / num_inputs);
+
+  if (!num_selected) {
+    WARNF("No coverage observed - is '%s' an instrumented binary?",
+          target_argv[0]);
+  }
+
+  return 0;
+}
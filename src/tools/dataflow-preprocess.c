@@ -55,6 +55,13 @@ static void edit_params(u32 argc, char **argv) {
         alloc_printf("-fuzzalloc-tag-log=%s", fuzzalloc_tag_log);
   }
 
+  char *fuzzalloc_tag_db = getenv("FUZZALLOC_TAG_DB");
+  if (fuzzalloc_tag_db && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-tag-db=%s", fuzzalloc_tag_db);
+  }
+
   char *fuzzalloc_mem_funcs = getenv("FUZZALLOC_MEM_FUNCS");
   if (fuzzalloc_mem_funcs && !maybe_assembler) {
     cc_params[cc_par_cnt++] = "-mllvm";
@@ -62,6 +69,13 @@ static void edit_params(u32 argc, char **argv) {
         alloc_printf("-fuzzalloc-mem-funcs=%s", fuzzalloc_mem_funcs);
   }
 
+  /* Allocation wrappers are detected automatically by default; this turns
+     the detection off for targets where the heuristic misfires */
+  if (getenv("FUZZALLOC_NO_AUTO_MEM_FUNCS") && !maybe_assembler) {
+    cc_params[cc_par_cnt++] = "-mllvm";
+    cc_params[cc_par_cnt++] = "-fuzzalloc-auto-mem-funcs=0";
+  }
+
   if (getenv("FUZZALLOC_DEBUG")) {
     cc_params[cc_par_cnt++] = "-mllvm";
     cc_params[cc_par_cnt++] = "-debug";
@@ -109,6 +123,8 @@ int main(int argc, char **argv) {
 
   edit_params(argc, argv);
 
+  try_bitcode_cache(argc, (const char **)argv, cc_params, &cc_par_cnt);
+
   execvp(cc_params[0], (char **)cc_params);
 
   FATAL("Oops, failed to execute '%s' - check your PATH", cc_params[0]);
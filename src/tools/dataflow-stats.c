@@ -38,6 +38,10 @@ static void edit_params(u32 argc, char **argv) {
       FUZZALLOC_LLVM_DIR "/Analysis/CollectStats/fuzzalloc-collect-stats.so";
   cc_params[cc_par_cnt++] = "-fuzzalloc-collect-stats";
 
+  if (getenv("FUZZALLOC_COST_REPORT")) {
+    cc_params[cc_par_cnt++] = "-fuzzalloc-cost-report";
+  }
+
   if (getenv("FUZZALLOC_DEBUG")) {
     cc_params[cc_par_cnt++] = "-mllvm";
     cc_params[cc_par_cnt++] = "-debug";
@@ -0,0 +1,76 @@
+/*
+ * Decoder for the binary memory access trace ring buffer produced by
+ * libfuzzalloc's debug-log instrumentation (see mem_trace.h). Records are
+ * printed oldest-first, one per line:
+ *
+ *   <def site tag> <use site offset> <return address>
+ *
+ * A typical usage would be:
+ *
+ *   FUZZALLOC_TRACE_FILE=trace.bin ./target input
+ *   dataflow-trace trace.bin
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mem_trace.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s /path/to/trace/file\n", argv[0]);
+    return 1;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("fstat");
+    return 1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == (void *)(-1)) {
+    perror("mmap");
+    return 1;
+  }
+
+  const mem_trace_header_t *header = map;
+  if ((size_t)st.st_size < sizeof(mem_trace_header_t) ||
+      header->magic != MEM_TRACE_MAGIC || header->num_records == 0 ||
+      (header->num_records & (header->num_records - 1)) != 0) {
+    fprintf(stderr, "%s is not a fuzzalloc trace file\n", argv[1]);
+    return 1;
+  }
+
+  const mem_trace_record_t *records =
+      (const mem_trace_record_t *)(header + 1);
+  uint64_t mask = header->num_records - 1;
+
+  /* If the ring wrapped, the oldest surviving record is at the head slot */
+  uint64_t start = 0;
+  uint64_t count = header->head;
+  if (count > header->num_records) {
+    start = count - header->num_records;
+  }
+
+  for (uint64_t n = start; n < count; n++) {
+    const mem_trace_record_t *record = &records[n & mask];
+    printf("%#x %d %#lx\n", record->def_site, record->offset,
+           record->ret_addr);
+  }
+
+  munmap(map, st.st_size);
+
+  return 0;
+}
@@ -46,6 +46,33 @@ static void edit_params(u32 argc, char **argv) {
     cc_params[cc_par_cnt++] = "-stats";
   }
 
+  /* Write the never-aliasing dereference filter for the second build phase */
+
+  char *deref_filter = getenv("FUZZALLOC_DEREF_FILTER");
+  if (deref_filter) {
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-deref-filter=%s", deref_filter);
+  }
+
+  /* Write the never-accessed heapified alloca filter for the second build
+     phase */
+
+  char *heapify_filter = getenv("FUZZALLOC_HEAPIFY_FILTER");
+  if (heapify_filter) {
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-heapify-filter=%s", heapify_filter);
+  }
+
+  /* Cache the analysis results so that rebuilding an unchanged (or mostly
+     unchanged) bitcode file doesn't re-pay the whole-program pointer
+     analysis */
+
+  char *analysis_cache = getenv("FUZZALLOC_ANALYSIS_CACHE");
+  if (analysis_cache) {
+    cc_params[cc_par_cnt++] =
+        alloc_printf("-fuzzalloc-analysis-cache=%s", analysis_cache);
+  }
+
   while (--argc) {
     u8 *cur = *(++argv);
 
@@ -0,0 +1,66 @@
+/*
+ * Dumps the shared-memory per-tag allocation statistics kept by libfuzzalloc
+ * (see alloc_stats.h). Attaches read-only, so it can be run repeatedly while
+ * the target is still fuzzing. Tags with no recorded allocations are
+ * skipped. A typical usage would be:
+ *
+ *   FUZZALLOC_ALLOC_STATS=0x4655 ./target input &
+ *   fuzzalloc-stat 0x4655
+ *
+ * Pass -d to remove the segment once a campaign is finished.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+
+#include "alloc_stats.h"
+
+int main(int argc, char **argv) {
+  int delete_segment = 0;
+
+  if (argc == 3 && strcmp(argv[1], "-d") == 0) {
+    delete_segment = 1;
+  } else if (argc != 2) {
+    fprintf(stderr, "usage: %s [-d] <shm key>\n", argv[0]);
+    return 1;
+  }
+
+  key_t key = (key_t)strtol(argv[argc - 1], NULL, 0);
+
+  int shm_id = shmget(key, ALLOC_STATS_SIZE, 0);
+  if (shm_id < 0) {
+    perror("shmget");
+    return 1;
+  }
+
+  if (delete_segment) {
+    if (shmctl(shm_id, IPC_RMID, NULL) != 0) {
+      perror("shmctl");
+      return 1;
+    }
+    return 0;
+  }
+
+  const alloc_stats_t *stats = shmat(shm_id, NULL, SHM_RDONLY);
+  if (stats == (void *)(-1)) {
+    perror("shmat");
+    return 1;
+  }
+
+  printf("%6s %12s %14s %14s\n", "tag", "allocs", "live bytes", "peak bytes");
+  for (unsigned tag = 0; tag <= FUZZALLOC_TAG_MAX; tag++) {
+    const alloc_stats_t *entry = &stats[tag];
+    if (entry->allocs == 0) {
+      continue;
+    }
+
+    printf("%#6x %12lu %14lu %14lu\n", tag, entry->allocs, entry->live_bytes,
+           entry->peak_bytes);
+  }
+
+  shmdt((void *)stats);
+
+  return 0;
+}